@@ -36,6 +36,9 @@ private:
   bool hash_spgemm = false;
 
 public:
+  // output of the last iteration
+  shared_ptr<distblas::core::SpMat<VALUE_TYPE>> output;
+
   Baseline(distblas::core::SpMat<VALUE_TYPE> *sp_local_native,
                  distblas::core::SpMat<VALUE_TYPE> *sp_local_receiver,
                  distblas::core::SpMat<VALUE_TYPE> *sp_local_sender,
@@ -80,6 +83,13 @@ public:
           batches =
               static_cast<int>(sp_local_receiver->proc_row_width / batch_size) + 1;
         }
+        // A and the tiling do not change across iterations, so the
+        // communication plan is built once and only reset between iterations
+        auto main_comm =
+            unique_ptr<TileDataComm<INDEX_TYPE, VALUE_TYPE, embedding_dim>>(
+                new TileDataComm<INDEX_TYPE, VALUE_TYPE, embedding_dim>(
+                    sp_local_receiver, sp_local_sender, sparse_local, grid, alpha,
+                    batches, tile_width_fraction, hash_spgemm));
         for (int i = 0; i < iterations; i++) {
 
           auto t = start_clock();
@@ -88,11 +98,6 @@ public:
           auto rows =  sp_local_receiver->proc_row_width;
           auto cols = static_cast<INDEX_TYPE>(embedding_dim);
           auto sparse_out = make_shared<distblas::core::SpMat<VALUE_TYPE>>(grid,rows,cols,hash_spgemm);
-          auto main_comm =
-              unique_ptr<TileDataComm<INDEX_TYPE, VALUE_TYPE, embedding_dim>>(
-                  new TileDataComm<INDEX_TYPE, VALUE_TYPE, embedding_dim>(
-                      sp_local_receiver, sp_local_sender, sparse_local, grid, alpha,
-                      batches, tile_width_fraction, hash_spgemm));
 //          if (test_remote) {
 //            if (i % iterations == 0) {
 //              main_comm.get()->onboard_data(false);
@@ -122,6 +127,7 @@ public:
 //          } else {
             spgemm_algo.get()->algo_spgemm(1, batch_size, lr, false);
 //          }
+          main_comm->reset();
           stop_clock_and_add(t, "Total Time");
           auto size_r = sparse_out->csr_local_data->handler->rowStart.size();
           double output_nnz = sparse_out->csr_local_data->handler->rowStart[size_r-1];
@@ -137,6 +143,7 @@ public:
           }
 
           add_perf_stats(total_memory, "Memory usage");
+          output = sparse_out;
           json out = json_perf_statistics();
 //          out["tile_width_fraction"] = fraction_array[w];
 //          out["tile_height_fraction"] = fraction_array[h];
@@ -0,0 +1,654 @@
+/**
+ * Multi source BFS on bitsets. Every local vertex keeps one bit per source
+ * (embedding_dim sources packed into 64 bit words) for its frontier and its
+ * visited set. The frontier words of remote neighbours are pulled once per
+ * level with a single all to all over a plan built up front.
+ *
+ * Levels are expanded either top down, pushing the words of every frontier
+ * vertex to the vertices that have it as a neighbour, or bottom up, where
+ * every vertex that still misses sources ORs the words of its neighbours and
+ * stops as soon as it has them all. The direction is picked per level with
+ * the heuristics of Beamer et al. (SC'12).
+ *
+ * Optionally the level of every (vertex, source) pair is recorded as a
+ * uint16, and so is the global id of a parent.
+ */
+#pragma once
+#include "../core/sparse_mat.hpp"
+#include "../net/process_3D_grid.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <numeric>
+#include <vector>
+
+using namespace std;
+using namespace distblas::core;
+
+namespace distblas::algo {
+
+enum class BFSDirection { OPTIMIZING, TOP_DOWN, BOTTOM_UP };
+
+template <typename INDEX_TYPE, typename VALUE_TYPE, size_t embedding_dim>
+class BitsetMSBFS {
+
+private:
+  static constexpr size_t WORDS = (embedding_dim + 63) / 64;
+
+  distblas::core::SpMat<VALUE_TYPE> *sp_local_native;
+  distblas::core::SpMat<VALUE_TYPE> *sp_local_receiver;
+  distblas::core::SpMat<VALUE_TYPE> *sparse_local;
+
+  Process3DGrid *grid;
+
+  BFSDirection direction;
+
+  // switch to bottom up once the frontier edges exceed unvisited edges / alpha
+  double alpha;
+
+  // switch back to top down once the frontier is below vertices / beta
+  double beta;
+
+  INDEX_TYPE rows = 0;
+
+  // frontier words of the local vertices, followed by those of the ghosts
+  vector<uint64_t> frontier;
+  // frontier words of the local vertices for the next level
+  vector<uint64_t> next;
+  vector<uint64_t> visited;
+
+  // adjacency of the local vertices, columns renumbered to frontier slots
+  vector<INDEX_TYPE> adj_start;
+  vector<INDEX_TYPE> adj_slot;
+
+  // the same adjacency by slot, the local vertices each slot is a neighbour of
+  vector<INDEX_TYPE> slot_start;
+  vector<INDEX_TYPE> slot_rows;
+
+  // bits of the lanes that currently run a source, per word
+  uint64_t lane_mask[WORDS];
+
+  // global id of the vertex behind every frontier slot
+  vector<INDEX_TYPE> slot_ids;
+
+  bool record_levels;
+  bool record_parents;
+
+  // source vertices (global ids), the columns of sparse_local when empty
+  vector<INDEX_TYPE> source_vertices;
+
+  INDEX_TYPE num_sources = 0;
+
+  // next source waiting for a lane
+  INDEX_TYPE next_source = 0;
+
+  // source run by every lane (-1 when idle) and the step it started at
+  vector<int64_t> lane_source;
+  vector<int> lane_start;
+
+  // local vertices requested by every process, grouped by process
+  vector<INDEX_TYPE> send_ids;
+  vector<int> send_id_displs;
+
+  // first ghost slot of every owner, relative to rows
+  vector<INDEX_TYPE> ghost_displs;
+
+  // ghost slots set by the last exchange
+  vector<INDEX_TYPE> received_slots;
+
+  // exchange buffers, counts are in words
+  vector<int> send_counts, send_displs;
+  vector<int> recv_counts, recv_displs;
+  vector<uint64_t> sendbuf, recvbuf;
+
+  /**
+   * Renumbers the neighbours of the local vertices to frontier slots (local
+   * vertices first, then the ghosts grouped by owner) and tells every owner
+   * which of its vertices this process pulls.
+   */
+  void build_plan() {
+    CSRHandle *handle = (sp_local_native->csr_local_data)->handler.get();
+    INDEX_TYPE width = sp_local_receiver->proc_col_width;
+    int world_size = grid->col_world_size;
+    int me = grid->rank_in_col;
+    rows = handle->rowStart.size() - 1;
+
+    vector<vector<INDEX_TYPE>> ghosts(world_size);
+    for (INDEX_TYPE i = 0; i < rows; i++) {
+      for (auto j = handle->rowStart[i]; j < handle->rowStart[i + 1]; j++) {
+        INDEX_TYPE col = handle->col_idx[j];
+        int owner = static_cast<int>(col / width);
+        if (owner != me) {
+          ghosts[owner].push_back(col);
+        }
+      }
+    }
+    vector<INDEX_TYPE> ghost_offset(world_size + 1, rows);
+    for (int r = 0; r < world_size; r++) {
+      sort(ghosts[r].begin(), ghosts[r].end());
+      ghosts[r].erase(unique(ghosts[r].begin(), ghosts[r].end()),
+                      ghosts[r].end());
+      ghost_offset[r + 1] = ghost_offset[r] + ghosts[r].size();
+    }
+
+    slot_ids.resize(ghost_offset[world_size]);
+    for (INDEX_TYPE i = 0; i < rows; i++) {
+      slot_ids[i] = me * width + i;
+    }
+    for (int r = 0; r < world_size; r++) {
+      copy(ghosts[r].begin(), ghosts[r].end(),
+           slot_ids.begin() + ghost_offset[r]);
+    }
+
+    adj_start.assign(handle->rowStart.begin(), handle->rowStart.end());
+    adj_slot.resize(handle->rowStart[rows]);
+#pragma omp parallel for schedule(static)
+    for (INDEX_TYPE i = 0; i < rows; i++) {
+      for (auto j = handle->rowStart[i]; j < handle->rowStart[i + 1]; j++) {
+        INDEX_TYPE col = handle->col_idx[j];
+        int owner = static_cast<int>(col / width);
+        if (owner == me) {
+          adj_slot[j] = col - me * width;
+        } else {
+          adj_slot[j] = ghost_offset[owner] +
+                        (lower_bound(ghosts[owner].begin(), ghosts[owner].end(),
+                                     col) -
+                         ghosts[owner].begin());
+        }
+      }
+    }
+
+    vector<int> request_counts(world_size), requested_counts(world_size);
+    vector<int> request_displs(world_size, 0), requested_displs(world_size, 0);
+    vector<INDEX_TYPE> requests;
+    for (int r = 0; r < world_size; r++) {
+      request_counts[r] = ghosts[r].size();
+      requests.insert(requests.end(), ghosts[r].begin(), ghosts[r].end());
+    }
+    MPI_Alltoall(request_counts.data(), 1, MPI_INT, requested_counts.data(), 1,
+                 MPI_INT, grid->col_world);
+    for (int r = 1; r < world_size; r++) {
+      request_displs[r] = request_displs[r - 1] + request_counts[r - 1];
+      requested_displs[r] = requested_displs[r - 1] + requested_counts[r - 1];
+    }
+    send_ids.resize(requested_displs[world_size - 1] +
+                    requested_counts[world_size - 1]);
+    MPI_Alltoallv(requests.data(), request_counts.data(), request_displs.data(),
+                  MPI_UINT64_T, send_ids.data(), requested_counts.data(),
+                  requested_displs.data(), MPI_UINT64_T, grid->col_world);
+    for (auto &id : send_ids) {
+      id -= me * width;
+    }
+
+    send_id_displs.assign(requested_displs.begin(), requested_displs.end());
+    send_id_displs.push_back(send_ids.size());
+    ghost_displs.assign(request_displs.begin(), request_displs.end());
+    received_slots.clear();
+    send_counts.resize(world_size);
+    send_displs.resize(world_size);
+    recv_counts.resize(world_size);
+    recv_displs.resize(world_size);
+
+    INDEX_TYPE slots = ghost_offset[world_size];
+    slot_start.assign(slots + 1, 0);
+    for (INDEX_TYPE j = 0; j < adj_slot.size(); j++) {
+      slot_start[adj_slot[j] + 1]++;
+    }
+    partial_sum(slot_start.begin(), slot_start.end(), slot_start.begin());
+    slot_rows.resize(adj_slot.size());
+    vector<INDEX_TYPE> slot_fill(slot_start.begin(), slot_start.end() - 1);
+    for (INDEX_TYPE i = 0; i < rows; i++) {
+      for (INDEX_TYPE j = adj_start[i]; j < adj_start[i + 1]; j++) {
+        slot_rows[slot_fill[adj_slot[j]]++] = i;
+      }
+    }
+
+    for (size_t w = 0; w < WORDS; w++) {
+      size_t lanes = min<size_t>(64, embedding_dim - w * 64);
+      lane_mask[w] = lanes == 64 ? ~uint64_t(0) : (uint64_t(1) << lanes) - 1;
+    }
+
+    frontier.assign(slots * WORDS, 0);
+    next.assign(rows * WORDS, 0);
+    visited.assign(rows * WORDS, 0);
+  }
+
+  /**
+   * Starts source s in a lane at the given step: its vertex joins the lane's
+   * frontier at level 0 and is its own parent. Returns 1 if the vertex is
+   * local.
+   */
+  INDEX_TYPE start_source(size_t lane, INDEX_TYPE s, int step) {
+    lane_source[lane] = s;
+    lane_start[lane] = step;
+    lane_mask[lane / 64] |= uint64_t(1) << (lane % 64);
+    INDEX_TYPE first = grid->rank_in_col * sp_local_receiver->proc_col_width;
+    INDEX_TYPE vertex = source_vertices[s];
+    if (vertex < first or vertex >= first + rows) {
+      return 0;
+    }
+    INDEX_TYPE i = vertex - first;
+    frontier[i * WORDS + lane / 64] |= uint64_t(1) << (lane % 64);
+    visited[i * WORDS + lane / 64] |= uint64_t(1) << (lane % 64);
+    if (record_levels) {
+      levels[i * num_sources + s] = 0;
+    }
+    if (record_parents) {
+      parents[i * num_sources + s] = vertex;
+    }
+    return 1;
+  }
+
+  /**
+   * Sources are source_vertices if given (source k starts at vertex
+   * source_vertices[k]); the first embedding_dim of them get a lane and the
+   * rest wait for one. Otherwise the sources are the columns of the local
+   * rows of sparse_local, one per lane.
+   */
+  INDEX_TYPE load_sources() {
+    lane_source.assign(embedding_dim, -1);
+    lane_start.assign(embedding_dim, 0);
+    if (!source_vertices.empty()) {
+      num_sources = source_vertices.size();
+      allocate_results();
+      fill(lane_mask, lane_mask + WORDS, 0);
+      INDEX_TYPE bits = 0;
+      for (next_source = 0; next_source < min<INDEX_TYPE>(num_sources, embedding_dim); next_source++) {
+        bits += start_source(next_source, next_source, 0);
+      }
+      return bits;
+    }
+
+    num_sources = embedding_dim;
+    next_source = num_sources;
+    allocate_results();
+    for (size_t lane = 0; lane < embedding_dim; lane++) {
+      lane_source[lane] = lane;
+    }
+    CSRHandle *handle = (sparse_local->csr_local_data)->handler.get();
+    INDEX_TYPE source_rows = min(rows, static_cast<INDEX_TYPE>(handle->rowStart.size() - 1));
+    INDEX_TYPE bits = 0;
+#pragma omp parallel for schedule(static) reduction(+ : bits)
+    for (INDEX_TYPE i = 0; i < source_rows; i++) {
+      for (auto j = handle->rowStart[i]; j < handle->rowStart[i + 1]; j++) {
+        INDEX_TYPE s = handle->col_idx[j];
+        if (s < embedding_dim) {
+          frontier[i * WORDS + s / 64] |= uint64_t(1) << (s % 64);
+        }
+      }
+      for (size_t w = 0; w < WORDS; w++) {
+        uint64_t word = frontier[i * WORDS + w];
+        visited[i * WORDS + w] = word;
+        bits += __builtin_popcountll(word);
+        for (; word != 0; word &= word - 1) {
+          INDEX_TYPE s = w * 64 + __builtin_ctzll(word);
+          if (record_levels) {
+            levels[i * num_sources + s] = 0;
+          }
+          if (record_parents) {
+            parents[i * num_sources + s] = slot_ids[i];
+          }
+        }
+      }
+    }
+    return bits;
+  }
+
+  void allocate_results() {
+    if (record_levels) {
+      levels.assign(rows * num_sources, UNREACHED);
+    }
+    if (record_parents) {
+      parents.assign(rows * num_sources, -1);
+    }
+  }
+
+  /**
+   * Frees the lanes whose frontier died out on every process, or that ran
+   * max_levels levels, and hands them the next waiting sources. New sources
+   * start at step. Returns the number of local frontier bits added, dropped
+   * is set to the local frontier bits of the retired lanes that were cleared.
+   */
+  INDEX_TYPE recycle_lanes(int step, int max_levels, INDEX_TYPE &dropped) {
+    dropped = 0;
+    uint64_t active[WORDS] = {0};
+    for (INDEX_TYPE i = 0; i < rows; i++) {
+      for (size_t w = 0; w < WORDS; w++) {
+        active[w] |= frontier[i * WORDS + w];
+      }
+    }
+    MPI_Allreduce(MPI_IN_PLACE, active, WORDS, MPI_UINT64_T, MPI_BOR,
+                  grid->col_world);
+
+    uint64_t retired[WORDS] = {0};
+    bool any_retired = false;
+    for (size_t lane = 0; lane < embedding_dim; lane++) {
+      bool running = (active[lane / 64] >> (lane % 64)) & 1;
+      if (lane_source[lane] >= 0 and
+          (!running or step - lane_start[lane] >= max_levels)) {
+        retired[lane / 64] |= uint64_t(1) << (lane % 64);
+        lane_source[lane] = -1;
+        any_retired = true;
+      }
+    }
+    if (!any_retired) {
+      return 0;
+    }
+    for (size_t w = 0; w < WORDS; w++) {
+      lane_mask[w] &= ~retired[w];
+    }
+    INDEX_TYPE cleared = 0;
+#pragma omp parallel for schedule(static) reduction(+ : cleared)
+    for (INDEX_TYPE i = 0; i < rows; i++) {
+      for (size_t w = 0; w < WORDS; w++) {
+        visited[i * WORDS + w] &= ~retired[w];
+        cleared += __builtin_popcountll(frontier[i * WORDS + w] & retired[w]);
+        frontier[i * WORDS + w] &= ~retired[w];
+      }
+    }
+    dropped = cleared;
+    INDEX_TYPE bits = 0;
+    for (size_t lane = 0; lane < embedding_dim and next_source < num_sources; lane++) {
+      if ((retired[lane / 64] >> (lane % 64)) & 1) {
+        bits += start_source(lane, next_source++, step);
+      }
+    }
+    return bits;
+  }
+
+  /**
+   * Sends every process the frontier words of the vertices it pulls, but only
+   * for vertices that are in some frontier: a record is the vertex's index in
+   * the requested list followed by its words. The frontier holds the pairs
+   * discovered in the last level, so the volume follows the discoveries. The
+   * ghost slots set by the previous exchange are cleared before the new
+   * records are applied.
+   */
+  void exchange_frontier() {
+    constexpr size_t RECORD = WORDS + 1;
+    int world_size = grid->col_world_size;
+#pragma omp parallel for schedule(static)
+    for (int r = 0; r < world_size; r++) {
+      int count = 0;
+      for (int k = send_id_displs[r]; k < send_id_displs[r + 1]; k++) {
+        count += in_frontier(send_ids[k]);
+      }
+      send_counts[r] = count * RECORD;
+    }
+    MPI_Alltoall(send_counts.data(), 1, MPI_INT, recv_counts.data(), 1, MPI_INT,
+                 grid->col_world);
+    send_displs[0] = recv_displs[0] = 0;
+    for (int r = 1; r < world_size; r++) {
+      send_displs[r] = send_displs[r - 1] + send_counts[r - 1];
+      recv_displs[r] = recv_displs[r - 1] + recv_counts[r - 1];
+    }
+    sendbuf.resize(send_displs[world_size - 1] + send_counts[world_size - 1]);
+    recvbuf.resize(recv_displs[world_size - 1] + recv_counts[world_size - 1]);
+
+#pragma omp parallel for schedule(static)
+    for (int r = 0; r < world_size; r++) {
+      uint64_t *record = sendbuf.data() + send_displs[r];
+      for (int k = send_id_displs[r]; k < send_id_displs[r + 1]; k++) {
+        if (in_frontier(send_ids[k])) {
+          record[0] = k - send_id_displs[r];
+          copy(frontier.begin() + send_ids[k] * WORDS,
+               frontier.begin() + (send_ids[k] + 1) * WORDS, record + 1);
+          record += RECORD;
+        }
+      }
+    }
+    MPI_Alltoallv(sendbuf.data(), send_counts.data(), send_displs.data(),
+                  MPI_UINT64_T, recvbuf.data(), recv_counts.data(),
+                  recv_displs.data(), MPI_UINT64_T, grid->col_world);
+    add_perf_stats(sendbuf.size(), "Data transfers");
+
+#pragma omp parallel for schedule(static)
+    for (INDEX_TYPE k = 0; k < received_slots.size(); k++) {
+      fill(frontier.begin() + received_slots[k] * WORDS,
+           frontier.begin() + (received_slots[k] + 1) * WORDS, 0);
+    }
+    received_slots.resize(recvbuf.size() / RECORD);
+#pragma omp parallel for schedule(static)
+    for (int r = 0; r < world_size; r++) {
+      for (INDEX_TYPE k = recv_displs[r] / RECORD;
+           k < (recv_displs[r] + recv_counts[r]) / RECORD; k++) {
+        const uint64_t *record = recvbuf.data() + k * RECORD;
+        INDEX_TYPE slot = rows + ghost_displs[r] + record[0];
+        copy(record + 1, record + RECORD, frontier.begin() + slot * WORDS);
+        received_slots[k] = slot;
+      }
+    }
+  }
+
+  bool in_frontier(INDEX_TYPE slot) const {
+    for (size_t w = 0; w < WORDS; w++) {
+      if (frontier[slot * WORDS + w] != 0) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /**
+   * Decides the direction of the next level. The frontier and unvisited edge
+   * counts and the frontier and vertex counts are summed over all processes
+   * with one allreduce.
+   */
+  bool choose_bottom_up(bool bottom_up) {
+    if (direction != BFSDirection::OPTIMIZING) {
+      return direction == BFSDirection::BOTTOM_UP;
+    }
+    double counts[4] = {0, 0, 0, static_cast<double>(rows)};
+    double frontier_edges = 0, unvisited_edges = 0, frontier_vertices = 0;
+#pragma omp parallel for schedule(static) reduction(+ : frontier_edges, unvisited_edges, frontier_vertices)
+    for (INDEX_TYPE i = 0; i < rows; i++) {
+      INDEX_TYPE degree = adj_start[i + 1] - adj_start[i];
+      if (in_frontier(i)) {
+        frontier_edges += degree;
+        frontier_vertices++;
+      }
+      for (size_t w = 0; w < WORDS; w++) {
+        if ((~visited[i * WORDS + w] & lane_mask[w]) != 0) {
+          unvisited_edges += degree;
+          break;
+        }
+      }
+    }
+    counts[0] = frontier_edges;
+    counts[1] = unvisited_edges;
+    counts[2] = frontier_vertices;
+    MPI_Allreduce(MPI_IN_PLACE, counts, 4, MPI_DOUBLE, MPI_SUM, grid->col_world);
+    if (!bottom_up) {
+      return counts[0] > counts[1] / alpha;
+    }
+    return counts[2] >= counts[3] / beta;
+  }
+
+  /**
+   * Marks the reached bits that are new, records their level (relative to
+   * the step their lane's source started at) and a parent (a neighbour that
+   * has the source in the current frontier) and returns their number.
+   */
+  INDEX_TYPE settle(INDEX_TYPE i, const uint64_t *reached, int step) {
+    INDEX_TYPE discovered = 0;
+    for (size_t w = 0; w < WORDS; w++) {
+      uint64_t fresh = reached[w] & ~visited[i * WORDS + w];
+      next[i * WORDS + w] = fresh;
+      visited[i * WORDS + w] |= fresh;
+      discovered += __builtin_popcountll(fresh);
+      for (; (record_levels or record_parents) and fresh != 0; fresh &= fresh - 1) {
+        int bit = __builtin_ctzll(fresh);
+        size_t lane = w * 64 + bit;
+        INDEX_TYPE s = lane_source[lane];
+        if (record_levels) {
+          levels[i * num_sources + s] = static_cast<uint16_t>(
+              min(step - lane_start[lane], UNREACHED - 1));
+        }
+        if (record_parents) {
+          for (INDEX_TYPE j = adj_start[i]; j < adj_start[i + 1]; j++) {
+            if ((frontier[adj_slot[j] * WORDS + w] >> bit) & 1) {
+              parents[i * num_sources + s] = slot_ids[adj_slot[j]];
+              break;
+            }
+          }
+        }
+      }
+    }
+    return discovered;
+  }
+
+  /**
+   * Top down level: the words of every frontier slot are ORed into the
+   * vertices it is a neighbour of. Only edges of the frontier are inspected.
+   */
+  INDEX_TYPE expand_top_down(INDEX_TYPE &inspected, int step) {
+    INDEX_TYPE discovered = 0;
+    INDEX_TYPE edges = 0;
+    fill(next.begin(), next.begin() + rows * WORDS, 0);
+    INDEX_TYPE slots = slot_start.size() - 1;
+#pragma omp parallel for schedule(dynamic, 256) reduction(+ : edges)
+    for (INDEX_TYPE s = 0; s < slots; s++) {
+      if (!in_frontier(s)) {
+        continue;
+      }
+      const uint64_t *words = frontier.data() + s * WORDS;
+      for (INDEX_TYPE j = slot_start[s]; j < slot_start[s + 1]; j++) {
+        uint64_t *target = next.data() + slot_rows[j] * WORDS;
+        for (size_t w = 0; w < WORDS; w++) {
+          if ((words[w] & ~__atomic_load_n(target + w, __ATOMIC_RELAXED)) != 0) {
+            __atomic_fetch_or(target + w, words[w], __ATOMIC_RELAXED);
+          }
+        }
+      }
+      edges += slot_start[s + 1] - slot_start[s];
+    }
+#pragma omp parallel for schedule(static) reduction(+ : discovered)
+    for (INDEX_TYPE i = 0; i < rows; i++) {
+      uint64_t reached[WORDS];
+      copy(next.begin() + i * WORDS, next.begin() + (i + 1) * WORDS, reached);
+      discovered += settle(i, reached, step);
+    }
+    inspected = edges;
+    return discovered;
+  }
+
+  /**
+   * Bottom up level: every vertex that still misses sources ORs the words of
+   * its neighbours and stops once all missing sources are reached.
+   */
+  INDEX_TYPE expand_bottom_up(INDEX_TYPE &inspected, int step) {
+    INDEX_TYPE discovered = 0;
+    INDEX_TYPE edges = 0;
+#pragma omp parallel for schedule(dynamic, 256) reduction(+ : discovered, edges)
+    for (INDEX_TYPE i = 0; i < rows; i++) {
+      uint64_t missing[WORDS];
+      bool any_missing = false;
+      for (size_t w = 0; w < WORDS; w++) {
+        missing[w] = ~visited[i * WORDS + w] & lane_mask[w];
+        any_missing = any_missing or missing[w] != 0;
+      }
+      uint64_t reached[WORDS] = {0};
+      if (any_missing) {
+        for (INDEX_TYPE j = adj_start[i]; j < adj_start[i + 1]; j++) {
+          const uint64_t *words = frontier.data() + adj_slot[j] * WORDS;
+          bool complete = true;
+          for (size_t w = 0; w < WORDS; w++) {
+            reached[w] |= words[w];
+            complete = complete and (missing[w] & ~reached[w]) == 0;
+          }
+          edges++;
+          if (complete) {
+            break;
+          }
+        }
+      }
+      discovered += settle(i, reached, step);
+    }
+    inspected = edges;
+    return discovered;
+  }
+
+public:
+  static constexpr uint16_t UNREACHED = 0xFFFF;
+
+  // rows x sources BFS levels, UNREACHED where a source never arrives
+  vector<uint16_t> levels;
+
+  // rows x sources global parent ids, -1 where a source never arrives
+  vector<int64_t> parents;
+
+  BitsetMSBFS(distblas::core::SpMat<VALUE_TYPE> *sp_local_native,
+              distblas::core::SpMat<VALUE_TYPE> *sp_local_receiver,
+              distblas::core::SpMat<VALUE_TYPE> *sparse_local,
+              Process3DGrid *grid,
+              BFSDirection direction = BFSDirection::OPTIMIZING,
+              double alpha = 14, double beta = 24, bool record_levels = false,
+              bool record_parents = false,
+              vector<INDEX_TYPE> source_vertices = vector<INDEX_TYPE>())
+      : sp_local_native(sp_local_native), sp_local_receiver(sp_local_receiver),
+        sparse_local(sparse_local), grid(grid), direction(direction),
+        alpha(alpha), beta(beta), record_levels(record_levels),
+        record_parents(record_parents),
+        source_vertices(std::move(source_vertices)) {}
+
+  INDEX_TYPE local_rows() const { return rows; }
+
+  INDEX_TYPE sources() const { return num_sources; }
+
+  /**
+   * Runs every source for at most iterations levels. Sources beyond
+   * embedding_dim run in waves: a lane is handed the next waiting source as
+   * soon as its previous source's frontier died out on every process, so the
+   * graph and the plan are set up once. Statistics are reported per step as
+   * in MultiSourceBFS.
+   */
+  json execute(int iterations) {
+    json jobj;
+    build_plan();
+    INDEX_TYPE frontier_bits = load_sources();
+    INDEX_TYPE visited_bits = frontier_bits;
+    bool bottom_up = false;
+
+    for (int i = 0;; i++) {
+      size_t total_memory = 0;
+      INDEX_TYPE global_frontier = 0;
+      MPI_Allreduce(&frontier_bits, &global_frontier, 1, MPI_UINT64_T, MPI_SUM,
+                    grid->col_world);
+      if (global_frontier == 0) {
+        break;
+      }
+
+      auto t = start_clock();
+      auto t_comm = start_clock();
+      exchange_frontier();
+      stop_clock_and_add(t_comm, "Communication Time");
+      auto t_comp = start_clock();
+      bottom_up = choose_bottom_up(bottom_up);
+      INDEX_TYPE inspected = 0;
+      INDEX_TYPE discovered = bottom_up ? expand_bottom_up(inspected, i + 1)
+                                        : expand_top_down(inspected, i + 1);
+      copy(next.begin(), next.end(), frontier.begin());
+      INDEX_TYPE dropped = 0;
+      INDEX_TYPE started = recycle_lanes(i + 1, iterations, dropped);
+      stop_clock_and_add(t_comp, "Computation Time");
+      stop_clock_and_add(t, "Total Time");
+
+      total_memory += get_memory_usage();
+      visited_bits += discovered;
+      add_perf_stats(visited_bits, "Output NNZ");
+      if (frontier_bits > 0) {
+        add_perf_stats(frontier_bits, "BFS Frontier");
+      }
+      add_perf_stats(total_memory, "Memory usage");
+      add_perf_stats(inspected, "BFS Edge Inspections");
+      add_perf_stats(bottom_up ? 1 : 0, "BFS Bottom Up");
+      frontier_bits = discovered - dropped + started;
+      visited_bits += started;
+
+      jobj[i] = json_perf_statistics();
+      reset_performance_timers();
+    }
+    return jobj;
+  }
+};
+
+} // namespace distblas::algo
@@ -53,7 +53,8 @@ public:
   json execute(int iterations, int batch_size, VALUE_TYPE lr) {
     json jobj;
     distblas::core::SpMat<VALUE_TYPE> *sparse_input = nullptr;
-    unique_ptr<DenseMat<INDEX_TYPE,VALUE_TYPE,embedding_dim>> state_holder= make_unique<DenseMat<INDEX_TYPE,VALUE_TYPE,embedding_dim>>(grid,sp_local_receiver->proc_row_width);
+    // complemented visited mask, a level only produces unvisited pairs
+    OutputMask visited(sp_local_receiver->proc_row_width, embedding_dim, true);
     int batches=0;
     if (sp_local_receiver->proc_row_width % batch_size == 0) {
       batches =
@@ -88,14 +89,20 @@ public:
       bool enable_remote = global_mode>0?true:false;
 
       cout<<grid->rank_in_col<<" iteration "<<i<<" enable remote "<<enable_remote<<endl;
-      unique_ptr<distblas::algo::SpGEMMAlgoWithTiling<INDEX_TYPE, VALUE_TYPE,embedding_dim>>
+      // reuses the tile index sets of A, only the tile modes are renegotiated
+      // after the frontier changed
+      main_comm->onboard_data(false);
+      this->mark_visited(sparse_input, &visited);
+      // levels only need reachability, frontier entries stay 1 instead of
+      // shrinking by lr every level
+      unique_ptr<distblas::algo::SpGEMMAlgoWithTiling<INDEX_TYPE, VALUE_TYPE,embedding_dim,OrAnd<VALUE_TYPE>>>
           spgemm_algo = unique_ptr<distblas::algo::SpGEMMAlgoWithTiling<
-              INDEX_TYPE, VALUE_TYPE, embedding_dim>>(
+              INDEX_TYPE, VALUE_TYPE, embedding_dim, OrAnd<VALUE_TYPE>>>(
               new distblas::algo::SpGEMMAlgoWithTiling<INDEX_TYPE, VALUE_TYPE,
-                                                       embedding_dim>(
+                                                       embedding_dim, OrAnd<VALUE_TYPE>>(
                   sp_local_native, sp_local_receiver, sp_local_sender,
                   sparse_input, sparse_out.get(), grid, alpha, beta, col_major,
-                  sync, tile_width_fraction, hash_spgemm,main_comm.get(),state_holder.get()));
+                  sync, tile_width_fraction, hash_spgemm,main_comm.get(),&visited));
 
 
       auto t = start_clock();
@@ -103,15 +110,13 @@ public:
       stop_clock_and_add(t, "Total Time");
       double totalLocalSpGEMM = std::accumulate((spgemm_algo->timing_info).begin(), (spgemm_algo->timing_info).end(), 0.0)/16;
       add_perf_stats(totalLocalSpGEMM,"Local SpGEMM");
-//      t = start_clock();
-//      sparse_out->initialize_CSR_blocks(false);
-      this->update_state_holder(sparse_input,state_holder.get());
-//      stop_clock_and_add(t, "CSR Conversion");
       total_memory += get_memory_usage();
 
-      double totalSum = std::accumulate((*(state_holder->nnz_count)).begin(), (*(state_holder->nnz_count)).end(), 0);
-      (*(sparse_input->csr_local_data)) =(*(sparse_out->csr_local_data));
+      double totalSum = visited.count();
+      // the output is the next frontier, hand its CSR over instead of copying
+      swap(sparse_input->csr_local_data, sparse_out->csr_local_data);
       main_comm->update_local_input(sparse_input);
+      main_comm->reset();
       add_perf_stats(totalSum,"Output NNZ");
       if (bfs_frontier>0) {
         add_perf_stats(bfs_frontier, "BFS Frontier");
@@ -124,15 +129,15 @@ public:
    return jobj;
   }
 
-  void update_state_holder( distblas::core::SpMat<VALUE_TYPE> *sparse_input, DenseMat<INDEX_TYPE,VALUE_TYPE,embedding_dim> *dense_mat){
+  // adds the pairs of the current frontier to the visited mask
+  void mark_visited(distblas::core::SpMat<VALUE_TYPE> *sparse_input, OutputMask *visited) {
     CSRHandle *handle = sparse_input->csr_local_data->handler.get();
     #pragma omp parallel for
     for(auto i=0;i<handle->rowStart.size()-1;i++){
-      auto bfs_frontier=(*(dense_mat->nnz_count))[i];
       for(auto j=handle->rowStart[i];j<handle->rowStart[i+1];j++){
-        auto d = handle->col_idx[j];
-        (*(dense_mat->state_metadata))[i][d]=1;
-        (*(dense_mat->nnz_count))[i]++;
+        if (handle->col_idx[j] < embedding_dim) {
+          visited->set(i, handle->col_idx[j]);
+        }
       }
     }
   }
@@ -1,7 +1,6 @@
 #pragma once
 #include "../core/sparse_mat_tile.hpp"
 #include "../net/tile_based_data_comm.hpp"
-#include <queue>
 
 
 using namespace std;
@@ -13,20 +12,6 @@ using namespace distblas::core;
 
 namespace distblas::algo {
 
-template <typename INDEX_TYPE, typename VALUE_TYPE>
-struct index_value_pair {
-  INDEX_TYPE index;
-  VALUE_TYPE value;
-};
-
-template <typename INDEX_TYPE, typename VALUE_TYPE>
-struct MIN_HEAP_OPERATOR {
-  bool operator()(const index_value_pair<INDEX_TYPE, VALUE_TYPE>& a, const index_value_pair<INDEX_TYPE, VALUE_TYPE>& b) const {
-    return a.value > b.value; // Change to a.value > b.value for max heap
-  }
-};
-
-
 template <typename INDEX_TYPE, typename VALUE_TYPE, size_t embedding_dim>
 class SparseEmbedding {
 
@@ -85,7 +70,6 @@ public:
 
     auto t_knn = start_clock();
     auto expected_nnz_per_row = static_cast<int>(embedding_dim*density);
-//    this->preserveHighestK(this->sparse_local->dense_collector.get(),expected_nnz_per_row);
     this->sparse_local = sparse_local_output;
     (this->sparse_local)->initialize_CSR_blocks(false,nullptr,static_cast<VALUE_TYPE>(INT_MIN),false);
     stop_clock_and_add(t, "KNN Time");
@@ -106,14 +90,10 @@ public:
                 batches, tile_width_fraction, hash_spgemm, true));
 
     // Buffer used for receive MPI operations data
-    unique_ptr<std::vector<SpTuple<VALUE_TYPE, sp_tuple_max_dim>>> update_ptr =
-        unique_ptr<std::vector<SpTuple<VALUE_TYPE, sp_tuple_max_dim>>>(
-            new vector<SpTuple<VALUE_TYPE, sp_tuple_max_dim>>());
+    unique_ptr<vector<char>> update_ptr = make_unique<vector<char>>();
 
     // Buffer used for send MPI operations data
-    unique_ptr<vector<SpTuple<VALUE_TYPE, sp_tuple_max_dim>>> sendbuf_ptr =
-        unique_ptr<vector<SpTuple<VALUE_TYPE, sp_tuple_max_dim>>>(
-            new vector<SpTuple<VALUE_TYPE, sp_tuple_max_dim>>());
+    unique_ptr<vector<char>> sendbuf_ptr = make_unique<vector<char>>();
 
 //    this->sparse_local->build_computable_represention();
     main_comm.get()->onboard_data(enable_remote);
@@ -171,14 +151,7 @@ public:
       }
       if (i<iterations-1) {
         auto t_knn = start_clock();
-        this->sparse_local_output->initialize_CSR_blocks(false, nullptr, static_cast<VALUE_TYPE>(INT_MIN), false);
-        size_t size_r =this->sparse_local_output->csr_local_data->handler->rowStart.size();
-        double output_nnz = this->sparse_local_output->csr_local_data->handler->rowStart[size_r - 1];
-        auto output_nnz_per_row = static_cast<int>(output_nnz / this->sp_local_receiver->proc_row_width);
-//        cout << " rank " << grid->rank_in_col << "iteration " << i<< " expected nnz per row " << expected_nnz_per_row<< " output nnz per row" << output_nnz_per_row << endl;
-        if (output_nnz_per_row > expected_nnz_per_row) {
-          this->preserveHighestK(this->sparse_local_output->dense_collector.get(),expected_nnz_per_row, static_cast<VALUE_TYPE>(INT_MIN));
-        }
+        this->preserveHighestK(expected_nnz_per_row, static_cast<VALUE_TYPE>(INT_MIN));
         stop_clock_and_add(t_knn, "KNN Time");
       }else if (i==iterations-1) {
         auto t_knn = start_clock();
@@ -195,8 +168,8 @@ public:
   }
 
   inline void execute_pull_model_computations(
-      std::vector<SpTuple<VALUE_TYPE, sp_tuple_max_dim>> *sendbuf,
-      std::vector<SpTuple<VALUE_TYPE, sp_tuple_max_dim>> *receivebuf,
+      std::vector<char> *sendbuf,
+      std::vector<char> *receivebuf,
       int iteration, int batch,
       TileDataComm<INDEX_TYPE, VALUE_TYPE, embedding_dim> *main_comm,
       CSRLocal<VALUE_TYPE> *csr_block, int batch_size,
@@ -324,7 +297,7 @@ public:
             auto source_end_index = sp_tile.row_end_index;
             auto dst_start_index = sp_tile.col_start_index;
             auto dst_end_index = sp_tile.col_end_index;
-            sp_tile.initialize_output_DS_if(0, symbolic);
+            sp_tile.initialize_output_DS_if(0, symbolic, &main_com->collector_pool);
             calc_embedding_row_major(source_start_index, source_end_index,
                                      dst_start_index, dst_end_index, csr_block,
                                      lr, batch_id, batch_size, block_size,
@@ -365,18 +338,15 @@ public:
             int target_rank =(int)(dst_id / (this->sp_local_receiver)->proc_col_width);
             bool fetch_from_cache = (target_rank == (this->grid)->rank_in_col or mode == 2) ? false: true;
 
-            vector<INDEX_TYPE> remote_cols;
-            vector<VALUE_TYPE> remote_values;
+            SparseRowSpan<VALUE_TYPE> remote_row;
 
             if (fetch_from_cache) {
-              unordered_map<INDEX_TYPE, SparseCacheEntry<VALUE_TYPE>>
-                  &arrayMap = (*this->sparse_local->tempCachePtr)[target_rank];
-              if (arrayMap.find(dst_id)== arrayMap.end()){
+              if (!(*this->sparse_local->tempCachePtr)[target_rank].find(dst_id, remote_row)){
                 cout<<" rank "<<this->grid->rank_in_col<<" trying to access "<<dst_id<<" failed "<<endl;
               }
-              remote_cols = arrayMap[dst_id].cols;
-              remote_values = arrayMap[dst_id].values;
             }
+            const INDEX_TYPE *remote_cols = remote_row.cols;
+            const VALUE_TYPE *remote_values = remote_row.values;
 
             if (!fetch_from_cache) {
               CSRHandle local_handle = this->sparse_local_output->fetch_local_data(index,true,static_cast<VALUE_TYPE>(INT_MIN));
@@ -440,10 +410,10 @@ public:
             } else {
                 CSRHandle local_handle = this->sparse_local_output->fetch_local_data(index,true,static_cast<VALUE_TYPE>(INT_MIN));
                 int local_count = local_handle.col_idx.size();
-                int remote_count = remote_cols.size();
+                int remote_count = remote_row.count;
                 int total_count = local_count + remote_count;
                 int remote_tracker = 0;
-                int remote_tracker_end = remote_cols.size();
+                int remote_tracker_end = remote_row.count;
                 int local_tracker = 0;
                 int local_tracker_end = local_count;
                 int count = 0;
@@ -521,26 +491,23 @@ public:
           fetch_from_cache = true;
         }
 
-        vector<INDEX_TYPE> remote_cols;
-        vector<VALUE_TYPE> remote_values;
+        SparseRowSpan<VALUE_TYPE> remote_row;
 
         if (fetch_from_cache) {
-          unordered_map<INDEX_TYPE, SparseCacheEntry<VALUE_TYPE>>
-              &arrayMap = (*this->sparse_local->tempCachePtr)[owner_rank];
-          if (arrayMap.find(global_col_id)== arrayMap.end()){
+          if (!(*this->sparse_local->tempCachePtr)[owner_rank].find(global_col_id, remote_row)){
             cout<<" rank "<<this->grid->rank_in_col<<" trying to access "<<global_col_id<<" failed "<<endl;
           }
-          remote_cols = arrayMap[global_col_id].cols;
-          remote_values = arrayMap[global_col_id].values;
         }
+        const INDEX_TYPE *remote_cols = remote_row.cols;
+        const VALUE_TYPE *remote_values = remote_row.values;
 
         if (fetch_from_cache) {
           CSRHandle local_handle = ((this->sparse_local_output)->fetch_local_data(row_id,true,static_cast<VALUE_TYPE>(INT_MIN)));
           int local_count =local_handle.col_idx.size();
-          int remote_count = remote_cols.size();
+          int remote_count = remote_row.count;
           int total_count = local_count + remote_count;
           int remote_tracker = 0;
-          int remote_tracker_end = remote_cols.size();
+          int remote_tracker_end = remote_row.count;
           int local_tracker = 0;
           int local_tracker_end = local_count;
           int count = 0;
@@ -674,7 +641,6 @@ public:
 #pragma omp parallel for schedule(static)
     for (auto i = source_start_index; i < source_end_index; i++) {
       INDEX_TYPE index = i - source_start_index;
-      unordered_map<INDEX_TYPE, VALUE_TYPE> value_map;
       for (int ra = 0; ra < this->grid->col_world_size; ra++) {
         for (int j = 0; j < tiles_per_process_row; j++) {
           SparseTile<INDEX_TYPE, VALUE_TYPE> &sp_tile =
@@ -683,52 +649,19 @@ public:
             SparseCacheEntry<VALUE_TYPE> newEntry;
             SparseCacheEntry<VALUE_TYPE> &cache_entry =
                 (*(sp_tile.dataCachePtr))[index];
-            if (cache_entry.cols.size() > 0) {
-              for (int k = 0; k < cache_entry.cols.size(); k++) {
-                value_map[k] += cache_entry.values[k];
-                if (!this->hash_spgemm) {
-                  (*(output->dense_collector))[index][k] +=
-                      cache_entry.values[k];
-                }
+            for (int k = 0; k < cache_entry.cols.size(); k++) {
+              auto d = cache_entry.cols[k];
+              if (this->hash_spgemm) {
+                output->accumulate(index, d, cache_entry.values[k]);
+              } else {
+                (*(output->dense_collector))[index][d] +=
+                    cache_entry.values[k];
               }
             }
             (*(sp_tile.dataCachePtr))[index] = newEntry;
           }
         }
       }
-      if (this->hash_spgemm) {
-        vector<INDEX_TYPE> available_spots;
-        for (auto k = 0; k < (*(output->sparse_data_collector))[index].size();
-             k++) {
-          auto d = (*(output->sparse_data_collector))[index][k].col;
-          if (d > 0 and value_map.find(d) != value_map.end()) {
-            (*(output->sparse_data_collector))[index][k].value +=
-                (*(output->sparse_data_collector))[index][k].value +
-                value_map[d];
-            value_map.erase(d);
-          } else {
-            available_spots.push_back(k);
-          }
-        }
-        if (value_map.size() > 0) {
-          for (int k = 0; k < available_spots.size(); k++) {
-            for (auto it = value_map.begin(); it != value_map.end(); ++it) {
-              (*(output->sparse_data_collector))[index][available_spots[k]]
-                  .col = (*it).first;
-              (*(output->sparse_data_collector))[index][available_spots[k]]
-                  .value = (*it).second;
-              value_map.erase((*it).first);
-              break;
-            }
-          }
-          for (auto it = value_map.begin(); it != value_map.end(); ++it) {
-            Tuple<VALUE_TYPE> tuple;
-            tuple.col = (*it).first;
-            tuple.value = (*it).second;
-            (*(output->sparse_data_collector))[index].push_back(tuple);
-          }
-        }
-      }
     }
   }
 
@@ -742,27 +675,12 @@ public:
   }
 
 
-  void preserveHighestK(vector<vector<VALUE_TYPE>> *matrix,  int k, VALUE_TYPE nullify_value) {
-    // Check if index is within bounds
-
-    #pragma omp parallel for
-    for(auto i=0;i<(*matrix).size();i++) {
-      std::priority_queue<index_value_pair<INDEX_TYPE,VALUE_TYPE>,vector<index_value_pair<INDEX_TYPE,VALUE_TYPE>>,MIN_HEAP_OPERATOR<INDEX_TYPE,VALUE_TYPE>> queue;
-      for(auto j=0;j<(*matrix)[i].size();j++){
-        index_value_pair<INDEX_TYPE,VALUE_TYPE> a;
-        a.index = j;
-        a.value = (*matrix)[i][j];
-        queue.push(a);
-      }
-      auto nullify_count = embedding_dim - k;
-      auto count=0;
-      while(count<nullify_count){
-        index_value_pair<INDEX_TYPE,VALUE_TYPE> a =  queue.top();
-        (*matrix)[i][a.index]=nullify_value;
-        queue.pop();
-        count++;
-      }
-    }
+  // Sparsifies the output embeddings to the k largest entries per row and
+  // rebuilds its CSR from the survivors, absent entries hold nullify_value
+  void preserveHighestK(int k, VALUE_TYPE nullify_value) {
+    this->sparse_local_output->initialize_CSR_from_dense_collector_top_k(
+        this->sparse_local_output->proc_row_width,
+        this->sparse_local_output->proc_col_width, k, nullify_value);
   }
 };
 } // namespace distblas::algo
@@ -77,10 +77,10 @@ public:
     // fetch initial embeddings
 
     // Buffer used for receive MPI operations data
-    unique_ptr<std::vector<SpTuple<VALUE_TYPE,sp_tuple_max_dim>>> update_ptr = unique_ptr<std::vector<SpTuple<VALUE_TYPE,sp_tuple_max_dim>>>(new vector<SpTuple<VALUE_TYPE,sp_tuple_max_dim>>());
+    unique_ptr<vector<char>> update_ptr = make_unique<vector<char>>();
 
     //Buffer used for send MPI operations data
-    unique_ptr<vector<SpTuple<VALUE_TYPE,sp_tuple_max_dim>>> sendbuf_ptr = unique_ptr<vector<SpTuple<VALUE_TYPE,sp_tuple_max_dim>>>(new vector<SpTuple<VALUE_TYPE,sp_tuple_max_dim>>());
+    unique_ptr<vector<char>> sendbuf_ptr = make_unique<vector<char>>();
 
     cout << " rank " << grid->rank_in_col << " starting onboard_data  " << batches << endl;
     for (int i = 0; i < batches; i++) {
@@ -150,8 +150,8 @@ public:
   }
 
   inline void execute_pull_model_computations(
-      std::vector<SpTuple<VALUE_TYPE,sp_tuple_max_dim>> *sendbuf,
-      std::vector<SpTuple<VALUE_TYPE,sp_tuple_max_dim>> *receivebuf, int iteration,
+      std::vector<char> *sendbuf,
+      std::vector<char> *receivebuf, int iteration,
       int batch, DataComm<INDEX_TYPE, VALUE_TYPE, embedding_dim> *data_comm,
       CSRLocal<VALUE_TYPE> *csr_block, int batch_size, int considering_batch_size,
       double lr,  int comm_initial_start, bool local_execution,
@@ -268,15 +268,13 @@ public:
             bool fetch_from_cache =
                 target_rank == (grid)->rank_in_col ? false : true;
 
-            vector<INDEX_TYPE> remote_cols;
-            vector<VALUE_TYPE> remote_values;
+            SparseRowSpan<VALUE_TYPE> remote_row;
 
             if (fetch_from_cache) {
-              unordered_map<INDEX_TYPE, SparseCacheEntry<VALUE_TYPE>>
-                  &arrayMap = (*sparse_local->tempCachePtr)[target_rank];
-              remote_cols = arrayMap[dst_id].cols;
-              remote_values =arrayMap[dst_id].values;
+              (*sparse_local->tempCachePtr)[target_rank].find(dst_id, remote_row);
             }
+            const INDEX_TYPE *remote_cols = remote_row.cols;
+            const VALUE_TYPE *remote_values = remote_row.values;
 
             CSRHandle *handle = ((sparse_local)->csr_local_data)->handler.get();
 
@@ -286,26 +284,8 @@ public:
                 INDEX_TYPE val =(*(sparse_local_output->sparse_data_counter))[index] +count;
                 (*(sparse_local_output->sparse_data_counter))[index] =std::min(val, static_cast<INDEX_TYPE>(embedding_dim));
               }else if (sparse_local_output->hash_spgemm) {
-                INDEX_TYPE ht_size = (*(sparse_local_output->sparse_data_collector))[index].size();
                 for (auto k = handle->rowStart[local_dst]; k < handle->rowStart[local_dst + 1]; k++) {
-                   auto  d = (handle->col_idx[k]);
-                   INDEX_TYPE hash = (d*hash_scale) & (ht_size-1);
-                   auto value =  lr *handle->values[k];
-                   int max_count=10;
-                   int count=0;
-                   while(count<max_count){
-                     if ((*(sparse_local_output->sparse_data_collector))[index][hash].col==d){
-                       (*(sparse_local_output->sparse_data_collector))[index][hash].value = (*(sparse_local_output->sparse_data_collector))[index][hash].value + value;
-                       break;
-                     }else if ((*(sparse_local_output->sparse_data_collector))[index][hash].col==-1){
-                       (*(sparse_local_output->sparse_data_collector))[index][hash].col = d;
-                       (*(sparse_local_output->sparse_data_collector))[index][hash].value =   value;
-                       break;
-                     }else {
-                       hash = (hash+100) & (ht_size-1);
-                       count++;
-                     }
-                   }
+                  sparse_local_output->accumulate(index, handle->col_idx[k], lr * handle->values[k]);
                 }
               }else {
                 for (auto k = handle->rowStart[local_dst]; k < handle->rowStart[local_dst + 1]; k++) {
@@ -314,34 +294,16 @@ public:
                 }
               }
             }else{
-              int count = remote_cols.size();
+              int count = remote_row.count;
               if (symbolic){
                 INDEX_TYPE val  = (*(sparse_local_output->sparse_data_counter))[index]+ count;
                 (*(sparse_local_output->sparse_data_counter))[index] = std::min(val,static_cast<INDEX_TYPE>(embedding_dim));
               }else if (sparse_local_output->hash_spgemm) {
-                INDEX_TYPE ht_size = (*(sparse_local_output->sparse_data_collector))[index].size();
-                for (int m = 0; m < remote_cols.size(); m++) {
-                  auto d = remote_cols[m];
-                  auto value =  lr *remote_values[m];
-                  INDEX_TYPE hash = (d*hash_scale) & (ht_size-1);
-                  int max_count=10;
-                  int count=0;
-                  while (count<max_count) {
-                    if ((*(sparse_local_output->sparse_data_collector))[index][hash].col == d) {
-                      (*(sparse_local_output->sparse_data_collector))[index][hash].value = (*(sparse_local_output->sparse_data_collector))[index][hash].value + value;
-                      break;
-                    } else if ((*(sparse_local_output->sparse_data_collector))[index][hash].col ==-1) {
-                      (*(sparse_local_output->sparse_data_collector))[index][hash].col = d;
-                      (*(sparse_local_output->sparse_data_collector))[index][hash].value = value;
-                      break;
-                    } else {
-                      hash =(hash + 100) &(ht_size -1);
-                      count++;
-                    }
-                  }
+                for (int m = 0; m < remote_row.count; m++) {
+                  sparse_local_output->accumulate(index, remote_cols[m], lr * remote_values[m]);
                 }
               }else{
-                for (int m = 0; m < remote_cols.size(); m++) {
+                for (int m = 0; m < remote_row.count; m++) {
                   auto d = remote_cols[m];
                   (*(sparse_local_output->dense_collector))[index][d] += lr*remote_values[m];
                 }
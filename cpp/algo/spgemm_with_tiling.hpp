@@ -10,7 +10,12 @@ using namespace Eigen;
 using namespace distblas::core;
 
 namespace distblas::algo {
-template <typename INDEX_TYPE, typename VALUE_TYPE, size_t embedding_dim>
+/**
+ * Tiled distributed SpGEMM. Products and sums are taken in SEMIRING, with lr
+ * as the left operand of every product.
+ */
+template <typename INDEX_TYPE, typename VALUE_TYPE, size_t embedding_dim,
+          typename SEMIRING = PlusTimes<VALUE_TYPE>>
 class SpGEMMAlgoWithTiling {
 
 private:
@@ -19,7 +24,8 @@ private:
   distblas::core::SpMat<VALUE_TYPE> *sp_local_receiver;
   distblas::core::SpMat<VALUE_TYPE> *sp_local_sender;
   distblas::core::SpMat<VALUE_TYPE> *sp_local_native;
-  distblas::core::DenseMat<INDEX_TYPE, VALUE_TYPE, embedding_dim> *state_holder;
+  // output entries the product may produce, all when null
+  OutputMask *mask;
   Process3DGrid *grid;
 
   // record temp local output
@@ -43,6 +49,15 @@ private:
 
   bool hash_spgemm = false;
 
+  // multiplications every MKL block takes part in, one per iteration
+  int iterations = 1;
+
+  // average row nnz of B on every process of the column world
+  vector<double> remote_row_nnz;
+
+  // sampled ratio of distinct output columns to products
+  double nnz_compression = 1.0;
+
 public:
   vector<double> timing_info;
   SpGEMMAlgoWithTiling(
@@ -54,12 +69,12 @@ public:
       Process3DGrid *grid, double alpha, double beta, bool col_major,
       bool sync_comm, double tile_width_fraction, bool hash_spgemm,
       TileDataComm<INDEX_TYPE, VALUE_TYPE, embedding_dim>* communicator=nullptr,
-      distblas::core::DenseMat<INDEX_TYPE, VALUE_TYPE, embedding_dim>*state_holder = nullptr)
+      OutputMask *mask = nullptr)
       : sp_local_native(sp_local_native), sp_local_receiver(sp_local_receiver),
         sp_local_sender(sp_local_sender), sparse_local(sparse_local),
         grid(grid), alpha(alpha), beta(beta), col_major(col_major),
         sync(sync_comm), sparse_local_output(sparse_local_output),
-        tile_width_fraction(tile_width_fraction),communicator(communicator),state_holder(state_holder)
+        tile_width_fraction(tile_width_fraction),communicator(communicator),mask(mask)
 
   {
     timing_info = vector<double>(sp_local_receiver->proc_row_width,0);
@@ -67,6 +82,13 @@ public:
   }
 
   void algo_spgemm(int iterations, int batch_size, VALUE_TYPE lr, bool enable_remote=true) {
+    this->iterations = iterations;
+    if constexpr (!dense_accumulable<SEMIRING>) {
+      if (!hash_spgemm) {
+        throw std::runtime_error(
+            "the semiring has a non zero identity and needs hash_spgemm");
+      }
+    }
 
 //    size_t total_memory = 0;
     int batches = 0;
@@ -98,14 +120,10 @@ public:
     }
 
     // Buffer used for receive MPI operations data
-    unique_ptr<std::vector<SpTuple<VALUE_TYPE, sp_tuple_max_dim>>> update_ptr =
-        unique_ptr<std::vector<SpTuple<VALUE_TYPE, sp_tuple_max_dim>>>(
-            new vector<SpTuple<VALUE_TYPE, sp_tuple_max_dim>>());
+    unique_ptr<vector<char>> update_ptr = make_unique<vector<char>>();
 
     // Buffer used for send MPI operations data
-    unique_ptr<vector<SpTuple<VALUE_TYPE, sp_tuple_max_dim>>> sendbuf_ptr =
-        unique_ptr<vector<SpTuple<VALUE_TYPE, sp_tuple_max_dim>>>(
-            new vector<SpTuple<VALUE_TYPE, sp_tuple_max_dim>>());
+    unique_ptr<vector<char>> sendbuf_ptr = make_unique<vector<char>>();
 
     cout << " rank " << grid->rank_in_col << " on board data starting " << endl;
 
@@ -118,8 +136,20 @@ public:
         (col_major) ? (this->sp_local_receiver)->csr_local_data.get()
                     : (this->sp_local_native)->csr_local_data.get();
 
+    if (mask != nullptr) {
+      mask->refresh();
+    }
+    communicator->set_output_mask(mask, (this->sp_local_native)->csr_local_data.get());
+
     int considering_batch_size = batch_size;
 
+    bool estimate_nnz = hash_spgemm and DistributedMat::estimate_nnz;
+    if (estimate_nnz) {
+      auto t = start_clock();
+      prepare_nnz_estimation(csr_block);
+      stop_clock_and_add(t, "SpGEMM NNZ Estimation");
+    }
+
     for (int i = 0; i < iterations; i++) {
 
       for (int j = 0; j < batches; j++) {
@@ -127,13 +157,29 @@ public:
         if (j == batches - 1) {
           considering_batch_size = last_batch_size;
         }
-          if ((this->sparse_local_output)->hash_spgemm) {
+          auto source_start_index = j * batch_size;
+          auto source_end_index = std::min(
+              static_cast<INDEX_TYPE>(j * batch_size + considering_batch_size),
+              this->sp_local_receiver->proc_row_width);
+          if (mask != nullptr) {
+            communicator->exchange_remote_masks(j);
+          }
+          if ((this->sparse_local_output)->hash_spgemm and estimate_nnz) {
+            auto t = start_clock();
+            this->estimate_output_nnz(source_start_index, source_end_index, 0,
+                                      this->sp_local_receiver->gCols,
+                                      csr_block, 0, this->sparse_local_output);
+            (this->sparse_local_output)
+                ->initialize_hashtables(source_start_index, source_end_index);
+            stop_clock_and_add(t, "SpGEMM NNZ Estimation");
+          } else if ((this->sparse_local_output)->hash_spgemm) {
             this->execute_pull_model_computations(
                 sendbuf_ptr.get(), update_ptr.get(), i, j, communicator,
                 csr_block, batch_size, considering_batch_size, lr, 1, 0, true,
                 true, this->sparse_local_output);
 
-            (this->sparse_local_output)->initialize_hashtables();
+            (this->sparse_local_output)
+                ->initialize_hashtables(source_start_index, source_end_index);
 
             // compute remote computations
             this->calc_t_dist_grad_rowptr(
@@ -142,10 +188,12 @@ public:
                 this->grid->col_world_size, true, communicator, nullptr);
           }
 
+          // the exact symbolic pass has already fetched the remote rows
+          bool communication = !(hash_spgemm and !estimate_nnz);
           this->execute_pull_model_computations(
               sendbuf_ptr.get(), update_ptr.get(), i, j, communicator,
-              csr_block, batch_size, considering_batch_size, lr, 1, 0, true,
-              false, this->sparse_local_output);
+              csr_block, batch_size, considering_batch_size, lr, 1, 0,
+              communication, false, this->sparse_local_output);
           if (enable_remote) {
             this->calc_t_dist_grad_rowptr(
                 (this->sp_local_sender)->csr_local_data.get(), lr, i, j,
@@ -166,7 +214,7 @@ public:
       (this->sparse_local)->purge_cache();
     }
     auto t = start_clock();
-    (this->sparse_local_output)->initialize_CSR_blocks(false,state_holder);
+    (this->sparse_local_output)->initialize_CSR_blocks(false);
     stop_clock_and_add(t, "CSR Conversion");
 
 //    total_memory = total_memory / (iterations * batches);
@@ -175,8 +223,8 @@ public:
   }
 
   inline void execute_pull_model_computations(
-      std::vector<SpTuple<VALUE_TYPE, sp_tuple_max_dim>> *sendbuf,
-      std::vector<SpTuple<VALUE_TYPE, sp_tuple_max_dim>> *receivebuf,
+      std::vector<char> *sendbuf,
+      std::vector<char> *receivebuf,
       int iteration, int batch,
       TileDataComm<INDEX_TYPE, VALUE_TYPE, embedding_dim> *main_comm,
       CSRLocal<VALUE_TYPE> *csr_block, int batch_size,
@@ -193,12 +241,20 @@ public:
 
     size_t total_memory = 0;
 
+    if (comm_initial_start >= this->grid->col_world_size) {
+      // a single process has nothing to pull, only the local block
+      this->calc_t_dist_grad_rowptr(
+          csr_block, lr, iteration, batch, batch_size, considering_batch_size,
+          0, first_execution_proc, prev_start, symbolic, main_comm, output);
+      return;
+    }
+
     for (int k = prev_start; k < this->grid->col_world_size; k += proc_length) {
       int end_process = get_end_proc(k, beta, this->grid->col_world_size);
 
       MPI_Request req;
 
-      if (communication and (symbolic or !output->hash_spgemm)) {
+      if (communication) {
         auto t = start_clock();
         main_comm->transfer_sparse_data(sendbuf, receivebuf, iteration, batch,k, end_process, 0, tiles_per_process,false);
         stop_clock_and_add(t, "CombinedComm Time");
@@ -260,12 +316,12 @@ public:
                                output);
     } else if (mode == 1) { // remote pull
       for (int r = start_process; r < end_process; r++) {
-        if (r != grid->rank_in_col) {
-          int computing_rank =
-              (grid->rank_in_col >= r)
-                  ? (grid->rank_in_col - r) % grid->col_world_size
-                  : (grid->col_world_size - r + grid->rank_in_col) %
-                        grid->col_world_size;
+        int computing_rank =
+            (grid->rank_in_col >= r)
+                ? (grid->rank_in_col - r) % grid->col_world_size
+                : (grid->col_world_size - r + grid->rank_in_col) %
+                      grid->col_world_size;
+        if (computing_rank != grid->rank_in_col) {
           int total_tiles =
               SparseTile<INDEX_TYPE, VALUE_TYPE>::get_tiles_per_process_row();
           for (int tile = 0; tile < total_tiles; tile++) {
@@ -299,7 +355,16 @@ public:
             auto source_end_index = sp_tile.row_end_index;
             auto dst_start_index = sp_tile.col_start_index;
             auto dst_end_index = sp_tile.col_end_index;
-            sp_tile.initialize_output_DS_if(0, symbolic);
+            bool estimate = !symbolic and this->hash_spgemm and
+                            DistributedMat::estimate_nnz;
+            sp_tile.initialize_output_DS_if(0, symbolic or estimate,
+                                            &main_com->collector_pool);
+            if (estimate) {
+              estimate_output_nnz(source_start_index, source_end_index,
+                                  dst_start_index, dst_end_index, csr_block,
+                                  mode, &sp_tile);
+              sp_tile.initialize_hashtables();
+            }
 
             calc_embedding_row_major(source_start_index, source_end_index,
                                      dst_start_index, dst_end_index, csr_block,
@@ -324,14 +389,35 @@ public:
                            CSRLocal<VALUE_TYPE> *csr_block, VALUE_TYPE lr,
                            int batch_id, int batch_size, int block_size,
                            bool symbolic, int mode, DistributedMat *output) {
+    // MKL only multiplies in the plus times semiring
+    if constexpr (std::is_same<VALUE_TYPE, double>::value and
+                  std::is_same<SEMIRING, PlusTimes<VALUE_TYPE>>::value) {
+      if (MKLBlockEngine::enabled and !symbolic and mode != 2 and
+          mask == nullptr and csr_block->handler != nullptr) {
+        calc_embedding_mkl(source_start_index, source_end_index,
+                           dst_start_index, dst_end_index, csr_block, lr,
+                           output);
+        return;
+      }
+    }
     if (csr_block->handler != nullptr) {
       CSRHandle *csr_handle = csr_block->handler.get();
+      // remote computations (mode 2) produce a batch of rows of another
+      // process, they are masked with the rows that process sent
+      OutputMask *row_mask = mask;
+      if (mode == 2 and mask != nullptr) {
+        row_mask = communicator->remote_mask(static_cast<int>(
+            source_start_index / this->sp_local_receiver->proc_row_width));
+      }
 
       #pragma omp parallel for schedule(static) // enable for full batch training or
       for (INDEX_TYPE i = source_start_index; i < source_end_index; i++) {
 
         INDEX_TYPE index = (mode == 0 or mode == 1) ? i : i - source_start_index;
         int max_reach = 0;
+        if (row_mask != nullptr and row_mask->row_closed(index)) {
+          continue;
+        }
 
         for (INDEX_TYPE j = static_cast<INDEX_TYPE>(csr_handle->rowStart[i]);
              j < static_cast<INDEX_TYPE>(csr_handle->rowStart[i + 1]); j++) {
@@ -346,18 +432,15 @@ public:
                 (int)(dst_id / (this->sp_local_receiver)->proc_col_width);
             bool fetch_from_cache = !(target_rank == (this->grid)->rank_in_col or mode == 2);
 
-            vector<INDEX_TYPE> remote_cols;
-            vector<VALUE_TYPE> remote_values;
+            SparseRowSpan<VALUE_TYPE> remote_row;
 
             if (fetch_from_cache) {
-              unordered_map<INDEX_TYPE, SparseCacheEntry<VALUE_TYPE>>
-                  &arrayMap = (*this->sparse_local->tempCachePtr)[target_rank];
-              if (arrayMap.find(dst_id)==arrayMap.end()){
+              if (!(*this->sparse_local->tempCachePtr)[target_rank].find(dst_id, remote_row)) {
                 continue; //this key does not contain any data.
               }
-              remote_cols = arrayMap[dst_id].cols;
-              remote_values = arrayMap[dst_id].values;
             }
+            const INDEX_TYPE *remote_cols = remote_row.cols;
+            const VALUE_TYPE *remote_values = remote_row.values;
 
             CSRHandle *handle = ((this->sparse_local)->csr_local_data)->handler.get();
 
@@ -368,29 +451,11 @@ public:
                 (*(output->sparse_data_counter))[index] =std::min(val, static_cast<INDEX_TYPE>(embedding_dim));
               } else if (output->hash_spgemm) {
                 auto t= start_clock();
-                INDEX_TYPE ht_size =(*(output->sparse_data_collector))[index].size();
                 for (auto k = handle->rowStart[local_dst];k < handle->rowStart[local_dst + 1]; k++) {
                   auto d = (handle->col_idx[k]);
-                  if (state_holder == nullptr or (mode==2 and (*(state_holder->state_metadata))[local_dst][d] == 0)) {
-                    INDEX_TYPE hash = (d * hash_scale) & (ht_size - 1);
-                    auto value = lr * handle->values[k];
-                    int max_count = 10;
-                    int count = 0;
-                    while (count < max_count) {
-                      if ((*(output->sparse_data_collector))[index][hash].col ==d) {
-                        (*(output->sparse_data_collector))[index][hash].value = (*(output->sparse_data_collector))[index][hash].value +value;
-                        break;
-                      } else if ((*(output->sparse_data_collector))[index][hash]
-                                     .col == -1) {
-                        (*(output->sparse_data_collector))[index][hash].col = d;
-                        (*(output->sparse_data_collector))[index][hash].value =
-                            value;
-                        break;
-                      } else {
-                        hash = (hash + 100) & (ht_size - 1);
-                        count++;
-                      }
-                    }
+                  if (row_mask == nullptr or row_mask->allows(index, d)) {
+                    output->accumulate<SEMIRING>(
+                        index, d, SEMIRING::multiply(lr, handle->values[k]));
                   }
                 }
                 auto time = stop_clock_get_elapsed(t);
@@ -400,14 +465,20 @@ public:
                 for (auto k = handle->rowStart[local_dst];k < handle->rowStart[local_dst + 1]; k++) {
                   auto t= start_clock();
                   auto d = (handle->col_idx[k]);
-                  (*(output->dense_collector))[index][d] += lr * (handle->values[k]);
+                  if (row_mask != nullptr and !row_mask->allows(index, d)) {
+                    continue;
+                  }
+                  if constexpr (dense_accumulable<SEMIRING>) {
+                    output->accumulate_dense<SEMIRING>(
+                        index, d, SEMIRING::multiply(lr, handle->values[k]));
+                  }
                   auto time = stop_clock_get_elapsed(t);
                   timing_info[index]+=time;
                 }
 
               }
             } else {
-              int count = remote_cols.size();
+              int count = remote_row.count;
               if (symbolic) {
                 INDEX_TYPE val =
                     (*(output->sparse_data_counter))[index] + count;
@@ -415,44 +486,28 @@ public:
                     std::min(val, static_cast<INDEX_TYPE>(embedding_dim));
               } else if (output->hash_spgemm) {
                 auto t= start_clock();
-                INDEX_TYPE ht_size =
-                    (*(output->sparse_data_collector))[index].size();
-//                auto t = start_clock();
-                for (int m = 0; m < remote_cols.size(); m++) {
-                  auto d = remote_cols[m];
-                  auto value = lr * remote_values[m];
-                  INDEX_TYPE hash = (d * hash_scale) & (ht_size - 1);
-                  int max_count = 10;
-                  int count = 0;
-                  while (count < max_count) {
-                    if ((*(output->sparse_data_collector))[index][hash].col ==
-                        d) {
-                      (*(output->sparse_data_collector))[index][hash].value =
-                          (*(output->sparse_data_collector))[index][hash]
-                              .value +
-                          value;
-                      break;
-                    } else if ((*(output->sparse_data_collector))[index][hash]
-                                   .col == -1) {
-                      (*(output->sparse_data_collector))[index][hash].col = d;
-                      (*(output->sparse_data_collector))[index][hash].value =
-                          value;
-                      break;
-                    } else {
-                      hash = (hash + 100) & (ht_size - 1);
-                      count++;
-                    }
+                for (int m = 0; m < remote_row.count; m++) {
+                  if (row_mask != nullptr and !row_mask->allows(index, remote_cols[m])) {
+                    continue;
                   }
+                  output->accumulate<SEMIRING>(
+                      index, remote_cols[m], SEMIRING::multiply(lr, remote_values[m]));
                 }
                 auto time = stop_clock_get_elapsed(t);
                 timing_info[index]+=time;
 //                stop_clock_and_add(t, "Local SpGEMM");
               } else {
 
-                for (int m = 0; m < remote_cols.size(); m++) {
+                for (int m = 0; m < remote_row.count; m++) {
                   auto t= start_clock();
                   auto d = remote_cols[m];
-                  (*(output->dense_collector))[index][d] +=lr * remote_values[m];
+                  if (row_mask != nullptr and !row_mask->allows(index, d)) {
+                    continue;
+                  }
+                  if constexpr (dense_accumulable<SEMIRING>) {
+                    output->accumulate_dense<SEMIRING>(
+                        index, d, SEMIRING::multiply(lr, remote_values[m]));
+                  }
                   auto time = stop_clock_get_elapsed(t);
                   timing_info[index]+=time;
                 }
@@ -465,6 +520,152 @@ public:
     }
   }
 
+  /**
+   * Numeric phase of a local (mode 0) or remote pull (mode 1) block through
+   * the MKL engine. Rows of B come from the local input or the ghost store and
+   * the product is added to the output accumulators.
+   */
+  inline void calc_embedding_mkl(INDEX_TYPE source_start_index,
+                                 INDEX_TYPE source_end_index,
+                                 INDEX_TYPE dst_start_index,
+                                 INDEX_TYPE dst_end_index,
+                                 CSRLocal<VALUE_TYPE> *csr_block, VALUE_TYPE lr,
+                                 DistributedMat *output) {
+    auto t = start_clock();
+    MKLBlockEngine *engine = csr_block->get_block_engine();
+    MKLBlock *block = engine->block(source_start_index, source_end_index,
+                                    dst_start_index, dst_end_index, 0,
+                                    iterations);
+    CSRHandle *handle = ((this->sparse_local)->csr_local_data)->handler.get();
+    auto t_block = start_clock();
+    engine->spgemm(
+        block, embedding_dim,
+        [&](INDEX_TYPE dst_id) {
+          MKLBlockRow row;
+          int target_rank =
+              (int)(dst_id / (this->sp_local_receiver)->proc_col_width);
+          if (target_rank == this->grid->rank_in_col) {
+            INDEX_TYPE local_dst =
+                dst_id - this->grid->rank_in_col *
+                             (this->sp_local_receiver)->proc_col_width;
+            auto start = handle->rowStart[local_dst];
+            row.csr_cols = handle->col_idx.data() + start;
+            row.values = handle->values.data() + start;
+            row.count = handle->rowStart[local_dst + 1] - start;
+          } else {
+            SparseRowSpan<VALUE_TYPE> remote_row;
+            (*this->sparse_local->tempCachePtr)[target_rank].find(dst_id, remote_row);
+            row.cols = remote_row.cols;
+            row.values = remote_row.values;
+            row.count = remote_row.count;
+          }
+          return row;
+        },
+        [&](INDEX_TYPE r, INDEX_TYPE d, double value) {
+          INDEX_TYPE index = source_start_index + r;
+          if (output->hash_spgemm) {
+            output->accumulate(index, d, lr * value);
+          } else {
+            (*(output->dense_collector))[index][d] += lr * value;
+          }
+        });
+    // sp2m multiplies the whole block at once, its time is shared evenly by
+    // the rows of the block
+    if (source_end_index > source_start_index) {
+      auto time = stop_clock_get_elapsed(t_block) /
+                  (source_end_index - source_start_index);
+      for (INDEX_TYPE i = source_start_index; i < source_end_index; i++) {
+        timing_info[i] += time;
+      }
+    }
+    stop_clock_and_add(t, "Computation Time");
+  }
+
+  /**
+   * Collects what estimate_output_nnz needs: the average row nnz of B on every
+   * process (one allgather) and the ratio of distinct output columns to
+   * products, measured on a sample of local rows against the local part of B.
+   */
+  inline void prepare_nnz_estimation(CSRLocal<VALUE_TYPE> *csr_block) {
+    CSRHandle *b_handle = ((this->sparse_local)->csr_local_data)->handler.get();
+    INDEX_TYPE b_rows = b_handle->rowStart.size() - 1;
+    double local_row_nnz =
+        b_rows > 0 ? static_cast<double>(b_handle->rowStart[b_rows]) / b_rows
+                   : 0;
+    remote_row_nnz.assign(this->grid->col_world_size, 0);
+    MPI_Allgather(&local_row_nnz, 1, MPI_DOUBLE, remote_row_nnz.data(), 1,
+                  MPI_DOUBLE, this->grid->col_world);
+
+    CSRHandle *a_handle = csr_block->handler.get();
+    INDEX_TYPE a_rows = a_handle->rowStart.size() - 1;
+    INDEX_TYPE samples = std::min(a_rows, DistributedMat::estimate_sample_rows);
+    double products = 0;
+    double distinct = 0;
+    vector<INDEX_TYPE> cols;
+    for (INDEX_TYPE s = 0; s < samples; s++) {
+      INDEX_TYPE i = s * a_rows / samples;
+      cols.clear();
+      for (auto j = a_handle->rowStart[i]; j < a_handle->rowStart[i + 1]; j++) {
+        INDEX_TYPE dst_id = a_handle->col_idx[j];
+        int target_rank =
+            (int)(dst_id / (this->sp_local_receiver)->proc_col_width);
+        if (target_rank == this->grid->rank_in_col) {
+          INDEX_TYPE local_dst =
+              dst_id - this->grid->rank_in_col *
+                           (this->sp_local_receiver)->proc_col_width;
+          cols.insert(cols.end(),
+                      b_handle->col_idx.begin() + b_handle->rowStart[local_dst],
+                      b_handle->col_idx.begin() + b_handle->rowStart[local_dst + 1]);
+        }
+      }
+      products += cols.size();
+      sort(cols.begin(), cols.end());
+      distinct += unique(cols.begin(), cols.end()) - cols.begin();
+    }
+    nnz_compression = products > 0 ? distinct / products : 1.0;
+  }
+
+  /**
+   * Writes an output nnz estimate for rows [source_start_index,
+   * source_end_index) into output->sparse_data_counter, indexed the same way
+   * as calc_embedding_row_major. Local rows of B count with their length and
+   * remote rows with the average of their owner; the sum is scaled by the
+   * sampled compression. Rows that turn out larger grow while accumulating.
+   */
+  inline void estimate_output_nnz(INDEX_TYPE source_start_index,
+                                  INDEX_TYPE source_end_index,
+                                  INDEX_TYPE dst_start_index,
+                                  INDEX_TYPE dst_end_index,
+                                  CSRLocal<VALUE_TYPE> *csr_block, int mode,
+                                  DistributedMat *output) {
+    CSRHandle *csr_handle = csr_block->handler.get();
+    CSRHandle *handle = ((this->sparse_local)->csr_local_data)->handler.get();
+#pragma omp parallel for schedule(static)
+    for (INDEX_TYPE i = source_start_index; i < source_end_index; i++) {
+      INDEX_TYPE index = (mode == 0 or mode == 1) ? i : i - source_start_index;
+      double products = 0;
+      for (auto j = csr_handle->rowStart[i]; j < csr_handle->rowStart[i + 1]; j++) {
+        INDEX_TYPE dst_id = csr_handle->col_idx[j];
+        if (dst_id >= dst_start_index and dst_id < dst_end_index) {
+          int target_rank =
+              (int)(dst_id / (this->sp_local_receiver)->proc_col_width);
+          if (target_rank == this->grid->rank_in_col or mode == 2) {
+            INDEX_TYPE local_dst =
+                (mode == 2) ? dst_id
+                            : dst_id - this->grid->rank_in_col *
+                                           (this->sp_local_receiver)->proc_col_width;
+            products += handle->rowStart[local_dst + 1] - handle->rowStart[local_dst];
+          } else {
+            products += remote_row_nnz[target_rank];
+          }
+        }
+      }
+      (*(output->sparse_data_counter))[index] = std::min(
+          static_cast<INDEX_TYPE>(ceil(products * nnz_compression)),
+          static_cast<INDEX_TYPE>(embedding_dim));
+    }
+  }
+
   inline void merge_remote_computations(
       int batch_id, INDEX_TYPE batch_size, DistributedMat *output,
       TileDataComm<INDEX_TYPE, VALUE_TYPE, embedding_dim> *main_comm) {
@@ -479,7 +680,6 @@ public:
     #pragma omp parallel for schedule(static)
     for (auto i = source_start_index; i < source_end_index; i++) {
       INDEX_TYPE index = i - source_start_index;
-      unordered_map<INDEX_TYPE, VALUE_TYPE> value_map;
       for (int ra = 0; ra < this->grid->col_world_size; ra++) {
         if (ra!=this->grid->rank_in_col) {
           for (int j = 0; j < tiles_per_process_row; j++) {
@@ -487,14 +687,15 @@ public:
             if (sp_tile.mode == 1) {
               SparseCacheEntry<VALUE_TYPE> newEntry;
               SparseCacheEntry<VALUE_TYPE> &cache_entry =(*(sp_tile.dataCachePtr))[index];
-              if (cache_entry.cols.size() > 0) {
-                for (int k = 0; k < cache_entry.cols.size(); k++) {
-                  auto d = cache_entry.cols[k];
-                  if (!this->hash_spgemm) {
-                    (*(output->dense_collector))[index][d] += cache_entry.values[k];
-                    continue;
-                  }
-                  value_map[d] += cache_entry.values[k];
+              for (int k = 0; k < cache_entry.cols.size(); k++) {
+                auto d = cache_entry.cols[k];
+                if (mask != nullptr and !mask->allows(i, d)) {
+                  continue;
+                }
+                if (this->hash_spgemm) {
+                  output->accumulate<SEMIRING>(i, d, cache_entry.values[k]);
+                } else if constexpr (dense_accumulable<SEMIRING>) {
+                  output->accumulate_dense<SEMIRING>(i, d, cache_entry.values[k]);
                 }
               }
               (*(sp_tile.dataCachePtr))[index] = newEntry;
@@ -502,36 +703,6 @@ public:
           }
         }
       }
-      if (this->hash_spgemm) {
-        vector<INDEX_TYPE> available_spots;
-        for (auto k = 0; k < (*(output->sparse_data_collector))[index].size();k++) {
-          auto d = (*(output->sparse_data_collector))[index][k].col;
-          if (d > 0 and value_map.find(d) != value_map.end()) {
-            (*(output->sparse_data_collector))[index][k].value +=
-                (*(output->sparse_data_collector))[index][k].value +
-                value_map[d];
-            value_map.erase(d);
-          } else {
-            available_spots.push_back(k);
-          }
-        }
-        if (value_map.size() > 0) {
-          for (int k = 0; k < available_spots.size(); k++) {
-            for (auto it = value_map.begin(); it != value_map.end(); ++it) {
-              (*(output->sparse_data_collector))[index][available_spots[k]].col = (*it).first;
-              (*(output->sparse_data_collector))[index][available_spots[k]].value = (*it).second;
-              value_map.erase((*it).first);
-              break;
-            }
-          }
-          for (auto it = value_map.begin(); it != value_map.end(); ++it) {
-            Tuple<VALUE_TYPE> tuple;
-            tuple.col = (*it).first;
-            tuple.value = (*it).second;
-            (*(output->sparse_data_collector))[index].push_back(tuple);
-          }
-        }
-      }
     }
   }
 };
@@ -35,6 +35,9 @@ private:
   //hyper parameter controls the col major or row major  data access
   bool col_major = false;
 
+  // multiplications every MKL block takes part in, one per iteration
+  int iterations = 1;
+
 public:
   vector<double> timing_info;
   SpMMAlgo(distblas::core::SpMat<VALUE_TYPE> *sp_local_native,
@@ -53,6 +56,7 @@ public:
 
   void algo_spmm(int iterations, int batch_size, VALUE_TYPE lr) {
     auto t = start_clock();
+    this->iterations = iterations;
 
     int batches = 0;
     int last_batch_size = batch_size;
@@ -343,6 +347,15 @@ public:
                            INDEX_TYPE dst_end_index, CSRLocal<VALUE_TYPE> *csr_block,
                            VALUE_TYPE *prevCoordinates, VALUE_TYPE lr, int batch_id,
                            int batch_size, int block_size, bool temp_cache) {
+    if constexpr (std::is_same<VALUE_TYPE, double>::value) {
+      if (MKLBlockEngine::enabled and csr_block->handler != nullptr) {
+        calc_embedding_mkl(source_start_index, source_end_index,
+                           dst_start_index, dst_end_index, csr_block,
+                           prevCoordinates, lr, batch_id, batch_size,
+                           temp_cache);
+        return;
+      }
+    }
     if (csr_block->handler != nullptr) {
       CSRHandle *csr_handle = csr_block->handler.get();
 
@@ -355,7 +368,7 @@ public:
         for (INDEX_TYPE j = static_cast<INDEX_TYPE>(csr_handle->rowStart[i]);
              j < static_cast<INDEX_TYPE>(csr_handle->rowStart[i + 1]); j++) {
           auto dst_id = csr_handle->col_idx[j];
-          if (dst_id >= dst_start_index and dst_id < dst_end_index) {
+          if (dst_id >= dst_start_index and dst_id <= dst_end_index) {
             INDEX_TYPE local_dst =
                 dst_id - (grid)->rank_in_col *
                              (this->sp_local_receiver)->proc_col_width;
@@ -394,6 +407,55 @@ public:
   }
 
 
+  /**
+   * Row major block product through the MKL engine. The source and
+   * destination ranges are inclusive, as in calc_embedding_row_major; rows of
+   * the dense operand are gathered from the local embedding or the cache.
+   */
+  inline void calc_embedding_mkl(INDEX_TYPE source_start_index,
+                                 INDEX_TYPE source_end_index,
+                                 INDEX_TYPE dst_start_index,
+                                 INDEX_TYPE dst_end_index,
+                                 CSRLocal<VALUE_TYPE> *csr_block,
+                                 VALUE_TYPE *prevCoordinates, VALUE_TYPE lr,
+                                 int batch_id, int batch_size, bool temp_cache) {
+    auto t = start_clock();
+    MKLBlockEngine *engine = csr_block->get_block_engine();
+    MKLBlock *block = engine->block(source_start_index, source_end_index + 1,
+                                    dst_start_index, dst_end_index + 1,
+                                    embedding_dim, iterations);
+    auto t_block = start_clock();
+    engine->spmm(
+        block, lr, embedding_dim,
+        [&](INDEX_TYPE dst_id) -> const VALUE_TYPE * {
+          int target_rank =
+              (int)(dst_id / (this->sp_local_receiver)->proc_col_width);
+          if (target_rank == (grid)->rank_in_col) {
+            INDEX_TYPE local_dst =
+                dst_id - (grid)->rank_in_col *
+                             (this->sp_local_receiver)->proc_col_width;
+            return (this->dense_local)->nCoordinates +
+                   local_dst * embedding_dim;
+          }
+          unordered_map<INDEX_TYPE, CacheEntry<VALUE_TYPE, embedding_dim>>
+              &arrayMap =
+                  (temp_cache)
+                      ? (*this->dense_local->tempCachePtr)[target_rank]
+                      : (*this->dense_local->cachePtr)[target_rank];
+          auto it = arrayMap.find(dst_id);
+          return it == arrayMap.end() ? nullptr : it->second.value.data();
+        },
+        prevCoordinates +
+            (source_start_index - batch_id * batch_size) * embedding_dim);
+    // the block is one call, its time is shared evenly by its rows
+    auto time = stop_clock_get_elapsed(t_block) /
+                (source_end_index - source_start_index + 1);
+    for (INDEX_TYPE i = source_start_index; i <= source_end_index; i++) {
+      timing_info[i - batch_id * batch_size] += time;
+    }
+    stop_clock_and_add(t, "Computation Time");
+  }
+
   inline void update_data_matrix_rowptr(VALUE_TYPE *prevCoordinates, int batch_id,
                                         int batch_size) {
 
@@ -7,13 +7,12 @@ using namespace std;
 using namespace std::chrono;
 MPI_Datatype distblas::core::SPTUPLE;
 MPI_Datatype distblas::core::DENSETUPLE;
-MPI_Datatype distblas::core::SPARSETUPLE;
 
 MPI_Datatype distblas::core::TILETUPLE;
 
 vector<string> distblas::core::perf_counter_keys = {
     "Computation Time","CombinedComm Time", "Communication Time", "Memory usage", "Data transfers","Total Time","Total Tiles", "Locally Computed Tiles","Remote Computed Tiles","Output NNZ",
-    "BFS Frontier","Local SpGEMM","Local SpMM","Remote Merge Time","Remote SpGEMM","Sparsity","Communicated Data Store","Communication Data Loading","CSR Conversion","KNN Time"};
+    "BFS Frontier","Local SpGEMM","Local SpMM","Remote Merge Time","Remote SpGEMM","Sparsity","Communicated Data Store","Communication Data Loading","CSR Conversion","KNN Time","SpGEMM NNZ Estimation","BFS Edge Inspections","BFS Bottom Up"};
 
 map<string, int> distblas::core::call_count;
 map<string, double> distblas::core::total_time;
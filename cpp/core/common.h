@@ -23,9 +23,6 @@ using namespace std;
 using namespace std::chrono;
 using json = nlohmann::json;
 
-const int row_max = 22;
-const int sp_tuple_max_dim= 512;
-
 const int hash_scale = 107;
 
 const int spa_threshold=1024;
@@ -77,6 +74,23 @@ std::unordered_set<INDEX_TYPE> random_select(const std::unordered_set<INDEX_TYPE
 
 
 
+/**
+ * Counter based random number generator (splitmix64 finalizer). The value
+ * only depends on (seed, counter), so generators using it produce the same
+ * data for any number of threads and processes.
+ */
+inline uint64_t counter_random(uint64_t seed, uint64_t counter) {
+  uint64_t z = seed * 0x9E3779B97F4A7C15ULL + counter + 0x632BE59BD9B4E019ULL;
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+// uniform double in [0, 1)
+inline double counter_uniform(uint64_t seed, uint64_t counter) {
+  return (counter_random(seed, counter) >> 11) * (1.0 / 9007199254740992.0);
+}
+
 template <typename VALUE_TYPE> struct Tuple {
   int64_t row;
   int64_t col;
@@ -97,12 +111,6 @@ template <typename VALUE_TYPE> struct CSR {
   VALUE_TYPE value;
 };
 
-template <typename VALUE_TYPE, size_t size> struct SpTuple {
-  std::array<INDEX_TYPE, row_max> rows;
-  std::array<INDEX_TYPE, size> cols;
-  std::array<VALUE_TYPE, size> values;
-};
-
 template <typename VALUE_TYPE, size_t size> struct DataTuple {
   INDEX_TYPE col;
   std::array<VALUE_TYPE, size> value;
@@ -169,8 +177,6 @@ extern MPI_Datatype SPTUPLE;
 
 extern MPI_Datatype DENSETUPLE;
 
-extern MPI_Datatype SPARSETUPLE;
-
 extern MPI_Datatype TILETUPLE;
 
 extern vector<string> perf_counter_keys;
@@ -209,12 +215,6 @@ void initialize_mpi_datatype_DENSETUPLE() {
   DENSETUPLE = CreateCustomMpiType(p, p.col, p.value);
 }
 
-template <typename VALUE_TYPE,size_t embedding_dim>
-void initialize_mpi_datatype_SPARSETUPLE() {
-  SpTuple<VALUE_TYPE,embedding_dim> p;
-  SPARSETUPLE = CreateCustomMpiType(p,p.rows, p.cols, p.values);
-}
-
 template <typename INDEX_TYPE>
 void initialize_mpi_datatype_TILETUPLE() {
    TileTuple<INDEX_TYPE> p;
@@ -225,7 +225,6 @@ template <typename VALUE_TYPE, size_t embedding_dim>
 void initialize_mpi_datatypes() {
   initialize_mpi_datatype_SPTUPLE<VALUE_TYPE>();
   initialize_mpi_datatype_DENSETUPLE<VALUE_TYPE,embedding_dim>();
-  initialize_mpi_datatype_SPARSETUPLE<VALUE_TYPE,embedding_dim>();
   initialize_mpi_datatype_TILETUPLE<INDEX_TYPE>();
 }
 
@@ -4,6 +4,7 @@
  */
 #pragma once
 #include "common.h"
+#include "mkl_block_engine.hpp"
 #include <algorithm>
 #include <cassert>
 #include <fstream>
@@ -32,6 +33,9 @@ public:
 
   unique_ptr<CSRHandle> handler = unique_ptr<CSRHandle>(new CSRHandle());
 
+  // analysed blocks of this matrix, created on first use
+  unique_ptr<MKLBlockEngine> block_engine;
+
   CSRLocal() {}
 
   CSRLocal(MKL_INT rows, MKL_INT cols, MKL_INT max_nnz, Tuple<VALUE_TYPE> *coords,
@@ -124,40 +128,89 @@ public:
     }
   }
 
-  CSRLocal(vector<vector<Tuple<VALUE_TYPE>>> *sparse_data_collector) {
-     handler = unique_ptr<CSRHandle>(new CSRHandle());
-     handler->rowStart.resize(sparse_data_collector->size() + 1, 0);
-    for (auto i = 0; i < sparse_data_collector->size(); i++) {
-
-      std::vector<MKL_INT> firstValues;
-      std::vector<double> Values;
-      vector<Tuple<VALUE_TYPE>> filtered;
-      std::copy_if((*sparse_data_collector)[i].begin(), (*sparse_data_collector)[i].end(),
-                     std::back_inserter(filtered),
-                     [](const Tuple<VALUE_TYPE> &tuple) {
-                         return tuple.col>=0;
-                     });
-
-      std::transform(filtered.begin(), filtered.end(),
-                     std::back_inserter(firstValues),
-                     [](const Tuple<VALUE_TYPE> &tuple) {
-                       return tuple.col;
-                     });
-
-      std::transform(filtered.begin(), filtered.end(),
-                     std::back_inserter(Values),
-                     [](const Tuple<VALUE_TYPE> &tuple) {
-                       return tuple.value;
-                     });
-
-      // Insert the first values into ((handler.get())->col_idx)
-       handler->col_idx.insert((handler->col_idx).end(), firstValues.begin(), firstValues.end());
-       handler->values.insert((handler->values).end(), Values.begin(), Values.end());
-       handler->rowStart[i+1]=filtered.size()+handler->rowStart[i];
+  /**
+   * Builds the CSR directly from already assembled CSR arrays (e.g. loaded
+   * from a partition cache), avoiding the COO round trip through MKL.
+   */
+  CSRLocal(MKL_INT rows, MKL_INT cols, vector<MKL_INT> &&rowStart,
+           vector<MKL_INT> &&col_idx, vector<double> &&values, bool transpose) {
+    this->rows = rows;
+    this->cols = cols;
+    this->transpose = transpose;
+    this->num_coords = values.size();
+    this->max_nnz = values.size();
+    handler->rowStart = std::move(rowStart);
+    handler->col_idx = std::move(col_idx);
+    handler->values = std::move(values);
+    if (this->num_coords > 0) {
+      mkl_sparse_d_create_csr(
+          &((handler.get())->mkl_handle), SPARSE_INDEX_BASE_ZERO, this->rows,
+          this->cols, (handler.get())->rowStart.data(),
+          (handler.get())->rowStart.data() + 1, (handler.get())->col_idx.data(),
+          (handler.get())->values.data());
+    }
+  }
+
+  /**
+   * Builds the CSR from row accumulators, skipping empty (col < 0) slots.
+   * Rows are counted, prefix summed into rowStart and then filled in place in
+   * parallel. With sorted set the columns of every row are emitted in
+   * ascending order. cols is the width of the rows.
+   */
+  CSRLocal(vector<vector<Tuple<VALUE_TYPE>>> *sparse_data_collector, MKL_INT cols,
+           bool sorted = true) {
+    MKL_INT rows = sparse_data_collector->size();
+    this->rows = rows;
+    this->cols = cols;
+    this->transpose = false;
+    handler = unique_ptr<CSRHandle>(new CSRHandle());
+    handler->rowStart.resize(rows + 1, 0);
+
+#pragma omp parallel for schedule(static)
+    for (MKL_INT i = 0; i < rows; i++) {
+      MKL_INT count = 0;
+      for (const Tuple<VALUE_TYPE> &tuple : (*sparse_data_collector)[i]) {
+        count += tuple.col >= 0;
+      }
+      handler->rowStart[i + 1] = count;
+    }
+    partial_sum(handler->rowStart.begin(), handler->rowStart.end(),
+                handler->rowStart.begin());
+    this->num_coords = handler->rowStart[rows];
+    this->max_nnz = handler->rowStart[rows];
+    handler->col_idx.resize(handler->rowStart[rows]);
+    handler->values.resize(handler->rowStart[rows]);
+
+#pragma omp parallel for schedule(dynamic, 64)
+    for (MKL_INT i = 0; i < rows; i++) {
+      MKL_INT begin = handler->rowStart[i];
+      MKL_INT pos = begin;
+      for (const Tuple<VALUE_TYPE> &tuple : (*sparse_data_collector)[i]) {
+        if (tuple.col >= 0) {
+          handler->col_idx[pos] = tuple.col;
+          handler->values[pos] = tuple.value;
+          pos++;
+        }
+      }
+      if (sorted and !is_sorted(handler->col_idx.begin() + begin,
+                                handler->col_idx.begin() + pos)) {
+        vector<pair<MKL_INT, double>> entries(pos - begin);
+        for (MKL_INT k = begin; k < pos; k++) {
+          entries[k - begin] = {handler->col_idx[k], handler->values[k]};
+        }
+        sort(entries.begin(), entries.end(),
+             [](const pair<MKL_INT, double> &a, const pair<MKL_INT, double> &b) {
+               return a.first < b.first;
+             });
+        for (MKL_INT k = begin; k < pos; k++) {
+          handler->col_idx[k] = entries[k - begin].first;
+          handler->values[k] = entries[k - begin].second;
+        }
+      }
     }
   }
 
-  CSRLocal<VALUE_TYPE>& CSRLocal<VALUE_TYPE>::operator=(const CSRLocal<VALUE_TYPE>& other) {
+  CSRLocal<VALUE_TYPE>& operator=(const CSRLocal<VALUE_TYPE>& other) {
     if (this != &other) {
       // Copy all necessary data members
       rows = other.rows;
@@ -168,10 +221,18 @@ public:
 
       // Copy the CSRHandle using its copy assignment operator or copy constructor
       handler = make_unique<CSRHandle>(*other.handler);
+      block_engine.reset();
     }
     return *this;
   }
 
+  MKLBlockEngine *get_block_engine() {
+    if (block_engine == nullptr) {
+      block_engine = make_unique<MKLBlockEngine>(handler.get());
+    }
+    return block_engine.get();
+  }
+
   ~CSRLocal() {
     //    mkl_sparse_destroy((handler.get())->mkl_handle);
   }
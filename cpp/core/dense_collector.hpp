@@ -0,0 +1,176 @@
+/**
+ * Row major dense matrix held in a single 64 byte aligned allocation. It backs
+ * the dense output collectors; rows are handed out as spans so (*m)[i][j]
+ * reads the same as with the nested vectors it replaces.
+ */
+#pragma once
+#include <algorithm>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+namespace distblas::core {
+
+template <typename T> class DenseRowSpan {
+
+private:
+  T *ptr;
+  size_t cols;
+
+public:
+  DenseRowSpan(T *ptr, size_t cols) : ptr(ptr), cols(cols) {}
+
+  T &operator[](size_t j) const { return ptr[j]; }
+
+  size_t size() const { return cols; }
+
+  T *data() const { return ptr; }
+
+  T *begin() const { return ptr; }
+
+  T *end() const { return ptr + cols; }
+};
+
+template <typename T> class DenseCollector {
+
+private:
+  static constexpr size_t ALIGNMENT = 64;
+
+  T *buffer = nullptr;
+  size_t rows = 0;
+  size_t cols = 0;
+  // elements between the starts of two rows, every row starts aligned
+  size_t stride = 0;
+  size_t capacity = 0;
+
+  static size_t padded_width(size_t cols) {
+    if (ALIGNMENT % sizeof(T) != 0) {
+      return cols;
+    }
+    size_t per_line = ALIGNMENT / sizeof(T);
+    return (cols + per_line - 1) / per_line * per_line;
+  }
+
+  void release() {
+    free(buffer);
+    buffer = nullptr;
+    capacity = 0;
+  }
+
+public:
+  DenseCollector() = default;
+
+  DenseCollector(size_t rows, size_t cols, T value = T()) {
+    assign(rows, cols, value);
+  }
+
+  DenseCollector(const DenseCollector &other) {
+    assign(other.rows, other.cols, T());
+    copy(other.buffer, other.buffer + rows * stride, buffer);
+  }
+
+  DenseCollector &operator=(const DenseCollector &other) {
+    if (this != &other) {
+      assign(other.rows, other.cols, T());
+      copy(other.buffer, other.buffer + rows * stride, buffer);
+    }
+    return *this;
+  }
+
+  DenseCollector(DenseCollector &&other) noexcept
+      : buffer(other.buffer), rows(other.rows), cols(other.cols),
+        stride(other.stride), capacity(other.capacity) {
+    other.buffer = nullptr;
+    other.rows = other.cols = other.stride = other.capacity = 0;
+  }
+
+  DenseCollector &operator=(DenseCollector &&other) noexcept {
+    if (this != &other) {
+      release();
+      swap(buffer, other.buffer);
+      swap(capacity, other.capacity);
+      rows = other.rows;
+      cols = other.cols;
+      stride = other.stride;
+    }
+    return *this;
+  }
+
+  ~DenseCollector() { release(); }
+
+  /**
+   * Reshapes the matrix and sets every entry to value. The allocation is
+   * kept when it is large enough, so collectors that are refilled every batch
+   * (e.g. the outputs of remote tiles) are not reallocated. Rows are filled
+   * in parallel, which also places their pages near the threads using them.
+   */
+  void assign(size_t rows, size_t cols, T value = T()) {
+    this->rows = rows;
+    this->cols = cols;
+    this->stride = padded_width(cols);
+    size_t elements = rows * stride;
+    if (elements > capacity) {
+      release();
+      size_t bytes = (elements * sizeof(T) + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+      buffer = static_cast<T *>(aligned_alloc(ALIGNMENT, bytes));
+      if (buffer == nullptr) {
+        throw bad_alloc();
+      }
+      capacity = elements;
+    }
+#pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < rows; i++) {
+      fill(buffer + i * stride, buffer + (i + 1) * stride, value);
+    }
+  }
+
+  DenseRowSpan<T> operator[](size_t i) { return {buffer + i * stride, cols}; }
+
+  DenseRowSpan<const T> operator[](size_t i) const {
+    return {buffer + i * stride, cols};
+  }
+
+  size_t size() const { return rows; }
+
+  size_t width() const { return cols; }
+
+  T *data() { return buffer; }
+};
+
+/**
+ * Free collectors kept by shape, so outputs that are rebuilt for every
+ * multiplication (e.g. the remote tiles of a SpGEMM) reuse their allocations
+ * instead of allocating new ones. Not thread safe.
+ */
+template <typename T> class DenseCollectorPool {
+
+private:
+  map<pair<size_t, size_t>, vector<unique_ptr<DenseCollector<T>>>> free_collectors;
+
+public:
+  // a rows x cols collector with every entry set to value
+  unique_ptr<DenseCollector<T>> acquire(size_t rows, size_t cols, T value = T()) {
+    auto &free = free_collectors[{rows, cols}];
+    if (free.empty()) {
+      return make_unique<DenseCollector<T>>(rows, cols, value);
+    }
+    unique_ptr<DenseCollector<T>> collector = std::move(free.back());
+    free.pop_back();
+    collector->assign(rows, cols, value);
+    return collector;
+  }
+
+  void release(unique_ptr<DenseCollector<T>> collector) {
+    if (collector != nullptr) {
+      pair<size_t, size_t> shape = {collector->size(), collector->width()};
+      free_collectors[shape].push_back(std::move(collector));
+    }
+  }
+};
+
+} // namespace distblas::core
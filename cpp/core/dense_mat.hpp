@@ -63,7 +63,7 @@ public:
       }
     }
     this->nnz_count = make_unique<vector<INDEX_TYPE>>(rows,0);
-    this->state_metadata = make_unique<vector<vector<VALUE_TYPE>>>(rows,vector<VALUE_TYPE>(embedding_dim,0));
+    this->state_metadata = make_unique<DenseCollector<VALUE_TYPE>>(rows, embedding_dim);
 
   }
 
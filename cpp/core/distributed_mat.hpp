@@ -1,6 +1,9 @@
 #pragma once
 #include "common.h"
 #include "csr_local.hpp"
+#include "dense_collector.hpp"
+#include "semiring.hpp"
+#include <limits>
 namespace distblas::core {
 
 class DistributedMat {
@@ -10,9 +13,9 @@ public:
 
   unique_ptr<vector<INDEX_TYPE>> sparse_data_counter;
 
-  unique_ptr<vector<vector<VALUE_TYPE>>> dense_collector;
+  unique_ptr<DenseCollector<VALUE_TYPE>> dense_collector;
 
-  unique_ptr<vector<vector<VALUE_TYPE>>> batch_collector;
+  unique_ptr<DenseCollector<VALUE_TYPE>> batch_collector;
 
   unique_ptr<CSRLocal<VALUE_TYPE>> csr_local_data;
 
@@ -20,17 +23,27 @@ public:
 
   unique_ptr<vector<INDEX_TYPE>> nnz_count;
 
-  unique_ptr<vector<vector<VALUE_TYPE>>> state_metadata;
+  unique_ptr<DenseCollector<VALUE_TYPE>> state_metadata;
 
   bool  hash_spgemm;
 
+  // number of columns of an output row, rows of a dense accumulator are this wide
+  INDEX_TYPE accumulator_width = 0;
+
+  // size hash accumulators from an estimate instead of a symbolic SpGEMM pass
+  inline static bool estimate_nnz = true;
+
+  // rows sampled to measure how much the products of a row overlap
+  inline static INDEX_TYPE estimate_sample_rows = 64;
+
   DistributedMat() = default;
 
   DistributedMat(const DistributedMat& other)
       : sparse_data_collector(nullptr),
         sparse_data_counter(nullptr),
         dense_collector(nullptr),
-        hash_spgemm(other.hash_spgemm) {
+        hash_spgemm(other.hash_spgemm),
+        accumulator_width(other.accumulator_width) {
     // Perform deep copy or other necessary operations
     if (other.sparse_data_collector) {
       sparse_data_collector = make_unique<vector<vector<Tuple<VALUE_TYPE>>>>(
@@ -43,7 +56,7 @@ public:
     }
 
     if (other.dense_collector) {
-      dense_collector = make_unique<vector<vector<VALUE_TYPE>>>(
+      dense_collector = make_unique<DenseCollector<VALUE_TYPE>>(
           *(other.dense_collector));
     }
 
@@ -56,44 +69,253 @@ public:
     }
 
     if (other.state_metadata) {
-      state_metadata = make_unique<vector<vector<VALUE_TYPE>>>(*(other.state_metadata));
+      state_metadata = make_unique<DenseCollector<VALUE_TYPE>>(*(other.state_metadata));
+    }
+  }
+
+  /**
+   * Sizes the row accumulators of sparse_data_collector from the symbolic nnz
+   * estimates in sparse_data_counter. A row gets a linear probing hash table
+   * of a power of two size with room for twice its estimate, or a dense
+   * accumulator indexed by column once such a table would be as wide as the
+   * row. Afterwards sparse_data_counter holds the occupied slots of each row.
+   * Only rows in [row_start, row_end) are reset.
+   */
+  void initialize_accumulators(INDEX_TYPE width, INDEX_TYPE row_start = 0,
+                               INDEX_TYPE row_end = numeric_limits<INDEX_TYPE>::max()) {
+    accumulator_width = width;
+    row_end = min(row_end, static_cast<INDEX_TYPE>(sparse_data_collector->size()));
+#pragma omp parallel for
+    for (INDEX_TYPE i = row_start; i < row_end; i++) {
+      Tuple<VALUE_TYPE> t;
+      t.row = i;
+      t.col = -1;
+      t.value = 0;
+      (*sparse_data_collector)[i].assign(accumulator_size((*sparse_data_counter)[i]), t);
+      (*sparse_data_counter)[i] = 0;
+    }
+  }
+
+  INDEX_TYPE accumulator_size(INDEX_TYPE estimate) {
+    INDEX_TYPE size = 8;
+    while (size < 2 * estimate) {
+      size <<= 1;
+    }
+    return (accumulator_width > 0 and size >= accumulator_width) ? accumulator_width : size;
+  }
+
+  /**
+   * Adds value to (row, col) with the add of SEMIRING. Hash tables that
+   * exceed a load factor of 3/4 are doubled (up to a dense row), so no product
+   * is ever dropped. A row is only ever touched by one thread.
+   */
+  template <typename SEMIRING = PlusTimes<VALUE_TYPE>>
+  inline void accumulate(INDEX_TYPE row, INDEX_TYPE col, VALUE_TYPE value) {
+    vector<Tuple<VALUE_TYPE>> &table = (*sparse_data_collector)[row];
+    if (table.empty()) {
+      grow_accumulator(row);
+    }
+    if (accumulator_width > 0 and table.size() >= accumulator_width) {
+      if (table[col].col == -1) {
+        table[col].col = col;
+        table[col].value = value;
+      } else {
+        table[col].value = SEMIRING::add(table[col].value, value);
+      }
+      return;
+    }
+    INDEX_TYPE mask = table.size() - 1;
+    INDEX_TYPE slot = (col * hash_scale) & mask;
+    while (table[slot].col != -1) {
+      if (static_cast<INDEX_TYPE>(table[slot].col) == col) {
+        table[slot].value = SEMIRING::add(table[slot].value, value);
+        return;
+      }
+      slot = (slot + 1) & mask;
     }
+    INDEX_TYPE &occupied = (*sparse_data_counter)[row];
+    if (4 * (occupied + 1) > 3 * table.size()) {
+      grow_accumulator(row);
+      accumulate<SEMIRING>(row, col, value);
+      return;
+    }
+    table[slot].col = col;
+    table[slot].value = value;
+    occupied++;
+  }
+
+  /**
+   * Adds value to (row, col) of the dense collector with the add of SEMIRING.
+   */
+  template <typename SEMIRING = PlusTimes<VALUE_TYPE>>
+  inline void accumulate_dense(INDEX_TYPE row, INDEX_TYPE col, VALUE_TYPE value) {
+    static_assert(dense_accumulable<SEMIRING>,
+                  "dense accumulators need a semiring whose identity is 0");
+    semiring_add_to<SEMIRING>((*dense_collector)[row][col], value);
   }
 
+  void grow_accumulator(INDEX_TYPE row) {
+    vector<Tuple<VALUE_TYPE>> previous;
+    previous.swap((*sparse_data_collector)[row]);
+    INDEX_TYPE size = accumulator_size(previous.size());
+    Tuple<VALUE_TYPE> t;
+    t.row = row;
+    t.col = -1;
+    t.value = 0;
+    (*sparse_data_collector)[row].assign(size, t);
+    (*sparse_data_counter)[row] = 0;
+    // the columns are distinct, so re-inserting them never adds
+    for (auto &entry : previous) {
+      if (entry.col >= 0) {
+        accumulate(row, entry.col, entry.value);
+      }
+    }
+  }
+
+  /**
+   * Builds the CSR straight from the dense accumulators in two passes: the
+   * kept entries of every row are counted, the counts are prefix summed into
+   * rowStart and every row then writes its columns in place. Entries equal
+   * to comparator (or already set in state_holder) are skipped, and reset to
+   * 0 when clear_dense_collector is set.
+   */
+  template <typename SEMIRING = PlusTimes<VALUE_TYPE>>
   void initialize_CSR_from_dense_collector(INDEX_TYPE proc_row_width,INDEX_TYPE gCols,distblas::core::DistributedMat* state_holder=nullptr,VALUE_TYPE comparator=0, bool clear_dense_collector=true){
-    unique_ptr<vector<Tuple<VALUE_TYPE>>> coords_ptr= make_unique<vector<Tuple<VALUE_TYPE>>>(vector<Tuple<VALUE_TYPE>>());
+    static_assert(dense_accumulable<SEMIRING>,
+                  "dense accumulators need a semiring whose identity is 0");
+    INDEX_TYPE rows = dense_collector->size();
+    vector<MKL_INT> rowStart(proc_row_width + 1, 0);
 
-#pragma omp parallel for
-    for(auto i=0;i<dense_collector->size();i++) {
-      vector<Tuple<VALUE_TYPE>> coords_local;
-      for (auto j = 0; j < (*dense_collector)[i].size(); j++) {
-
-        if (state_holder==nullptr and (*dense_collector)[i][j] != comparator) {
-          Tuple<VALUE_TYPE> t;
-          t.col = j;
-          t.row = i;
-          t.value = (*dense_collector)[i][j];
-          coords_local.push_back(t);
-        } else if (state_holder != nullptr and (*dense_collector)[i][j] != comparator and (*(state_holder->state_metadata))[i][j]==comparator) {
-            Tuple<VALUE_TYPE> t;
-            t.col = j;
-            t.row = i;
-            t.value = (*dense_collector)[i][j];
-            coords_local.push_back(t);
-        }else if ((*dense_collector)[i][j] == comparator and clear_dense_collector){
-          (*dense_collector)[i][j]=0;
+    auto keep = [&](INDEX_TYPE i, INDEX_TYPE j, VALUE_TYPE value) {
+      return value != comparator and
+             (state_holder == nullptr or
+              (*(state_holder->state_metadata))[i][j] == comparator);
+    };
+
+#pragma omp parallel for schedule(static)
+    for (INDEX_TYPE i = 0; i < rows; i++) {
+      auto row = (*dense_collector)[i];
+      MKL_INT count = 0;
+      for (INDEX_TYPE j = 0; j < row.size(); j++) {
+        count += keep(i, j, row[j]);
+      }
+      rowStart[i + 1] = count;
+    }
+    partial_sum(rowStart.begin(), rowStart.end(), rowStart.begin());
+
+    vector<MKL_INT> col_idx(rowStart[proc_row_width]);
+    vector<double> values(rowStart[proc_row_width]);
+#pragma omp parallel for schedule(static)
+    for (INDEX_TYPE i = 0; i < rows; i++) {
+      auto row = (*dense_collector)[i];
+      MKL_INT pos = rowStart[i];
+      for (INDEX_TYPE j = 0; j < row.size(); j++) {
+        if (keep(i, j, row[j])) {
+          col_idx[pos] = j;
+          values[pos] = row[j];
+          pos++;
+        } else if (row[j] == comparator and clear_dense_collector) {
+          row[j] = 0;
+        }
+      }
+    }
+    csr_local_data = make_unique<CSRLocal<VALUE_TYPE>>(
+        proc_row_width, gCols, std::move(rowStart), std::move(col_idx),
+        std::move(values), false);
+  }
+
+  /**
+   * Builds the CSR from the dense collector keeping at most the k largest
+   * entries of every row, where entries equal to comparator are absent. k is
+   * an average budget: rows are kept whole while they fit in it on average.
+   * Each thread selects the survivors of a row with nth_element on its own
+   * scratch buffer and writes them straight into the CSR in column order. The
+   * dense rows stay the live embeddings, so only the dropped slots are reset
+   * to comparator.
+   */
+  template <typename SEMIRING = PlusTimes<VALUE_TYPE>>
+  void initialize_CSR_from_dense_collector_top_k(INDEX_TYPE proc_row_width, INDEX_TYPE gCols,
+                                                 INDEX_TYPE k, VALUE_TYPE comparator) {
+    static_assert(dense_accumulable<SEMIRING>,
+                  "dense accumulators need a semiring whose identity is 0");
+    INDEX_TYPE rows = dense_collector->size();
+    vector<MKL_INT> present(rows, 0);
+    MKL_INT total = 0;
+
+#pragma omp parallel for schedule(static) reduction(+ : total)
+    for (INDEX_TYPE i = 0; i < rows; i++) {
+      auto row = (*dense_collector)[i];
+      MKL_INT count = 0;
+      for (INDEX_TYPE j = 0; j < row.size(); j++) {
+        count += row[j] != comparator;
+      }
+      present[i] = count;
+      total += count;
+    }
+    MKL_INT budget = (total / static_cast<MKL_INT>(proc_row_width) > static_cast<MKL_INT>(k))
+                         ? static_cast<MKL_INT>(k)
+                         : numeric_limits<MKL_INT>::max();
+
+    vector<MKL_INT> rowStart(proc_row_width + 1, 0);
+    for (INDEX_TYPE i = 0; i < rows; i++) {
+      rowStart[i + 1] = min(present[i], budget);
+    }
+    partial_sum(rowStart.begin(), rowStart.end(), rowStart.begin());
+
+    vector<MKL_INT> col_idx(rowStart[proc_row_width]);
+    vector<double> values(rowStart[proc_row_width]);
+#pragma omp parallel
+    {
+      vector<pair<VALUE_TYPE, MKL_INT>> scratch;
+#pragma omp for schedule(dynamic, 64)
+      for (INDEX_TYPE i = 0; i < rows; i++) {
+        auto row = (*dense_collector)[i];
+        MKL_INT pos = rowStart[i];
+        if (present[i] <= budget) {
+          for (INDEX_TYPE j = 0; j < row.size(); j++) {
+            if (row[j] != comparator) {
+              col_idx[pos] = j;
+              values[pos] = row[j];
+              pos++;
+            }
+          }
+          continue;
+        }
+        scratch.clear();
+        for (INDEX_TYPE j = 0; j < row.size(); j++) {
+          if (row[j] != comparator) {
+            scratch.emplace_back(row[j], j);
+          }
+        }
+        auto greater_value = [](const pair<VALUE_TYPE, MKL_INT> &a,
+                                const pair<VALUE_TYPE, MKL_INT> &b) {
+          return a.first > b.first;
+        };
+        nth_element(scratch.begin(), scratch.begin() + budget, scratch.end(),
+                    greater_value);
+        for (auto it = scratch.begin() + budget; it != scratch.end(); ++it) {
+          row[it->second] = comparator;
+        }
+        sort(scratch.begin(), scratch.begin() + budget,
+             [](const pair<VALUE_TYPE, MKL_INT> &a,
+                const pair<VALUE_TYPE, MKL_INT> &b) {
+               return a.second < b.second;
+             });
+        for (MKL_INT s = 0; s < budget; s++) {
+          col_idx[pos + s] = scratch[s].second;
+          values[pos + s] = scratch[s].first;
         }
       }
-#pragma omp critical
-      (*coords_ptr).insert((*coords_ptr).end(), coords_local.begin(), coords_local.end());
     }
-    csr_local_data = make_unique<CSRLocal<VALUE_TYPE>>(proc_row_width, gCols, (*coords_ptr).size(),coords_ptr->data(), (*coords_ptr).size(), false);
+    csr_local_data = make_unique<CSRLocal<VALUE_TYPE>>(
+        proc_row_width, gCols, std::move(rowStart), std::move(col_idx),
+        std::move(values), false);
   }
 
 
 
-  void initialize_CSR_from_sparse_collector() {
-    csr_local_data = make_unique<CSRLocal<VALUE_TYPE>>(sparse_data_collector.get());
+  void initialize_CSR_from_sparse_collector(INDEX_TYPE cols, bool sorted = true) {
+    csr_local_data = make_unique<CSRLocal<VALUE_TYPE>>(sparse_data_collector.get(), cols, sorted);
   }
 
 
@@ -0,0 +1,218 @@
+/**
+ * Local compute engine that runs SpMM and SpGEMM blocks through the MKL
+ * inspector-executor API instead of the hand written kernels. A block is a
+ * row range of a CSR matrix restricted to a column range; it is analysed once
+ * and reused for every later multiplication over the same ranges.
+ */
+#pragma once
+#include "common.h"
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <mkl.h>
+#include <mkl_spblas.h>
+#include <tuple>
+#include <vector>
+
+using namespace std;
+
+namespace distblas::core {
+
+/**
+ * Rows [row_start, row_end) of a CSR restricted to columns [col_start,
+ * col_end). The columns are renumbered to the distinct ids that occur in the
+ * block, col_ids maps them back to global ids, so the operand of a product
+ * only needs the rows of those ids. Every value is 1: the hand written
+ * kernels treat the graph as a pattern, and its stored values (e.g. the
+ * column ids kept by copy_col_to_value) are not edge weights.
+ */
+struct MKLBlock {
+  INDEX_TYPE row_start = 0;
+  MKL_INT rows = 0;
+  vector<MKL_INT> rowStart;
+  vector<MKL_INT> col_idx;
+  vector<double> values;
+  vector<INDEX_TYPE> col_ids;
+  sparse_matrix_t handle = nullptr;
+
+  ~MKLBlock() {
+    if (handle != nullptr) {
+      mkl_sparse_destroy(handle);
+    }
+  }
+};
+
+// a sparse operand row, either a row of a local CSR or a received row
+struct MKLBlockRow {
+  const MKL_INT *csr_cols = nullptr;
+  const INDEX_TYPE *cols = nullptr;
+  const double *values = nullptr;
+  INDEX_TYPE count = 0;
+
+  INDEX_TYPE col(INDEX_TYPE m) const {
+    return csr_cols != nullptr ? csr_cols[m] : cols[m];
+  }
+};
+
+class MKLBlockEngine {
+
+private:
+  CSRHandle *csr;
+
+  map<tuple<INDEX_TYPE, INDEX_TYPE, INDEX_TYPE, INDEX_TYPE>, unique_ptr<MKLBlock>> blocks;
+
+  static matrix_descr general_descr() {
+    matrix_descr descr;
+    descr.type = SPARSE_MATRIX_TYPE_GENERAL;
+    return descr;
+  }
+
+public:
+  // selects the MKL engine for the local SpMM and SpGEMM blocks
+  inline static bool enabled = false;
+
+  explicit MKLBlockEngine(CSRHandle *csr) : csr(csr) {}
+
+  /**
+   * Returns the analysed block, building it on first use. dense_cols is the
+   * width of the dense operand the block will multiply (0 for SpGEMM) and
+   * expected_calls the number of multiplications it is expected to take part
+   * in, both are passed to MKL as a hint. Blocks without entries have no
+   * handle.
+   */
+  MKLBlock *block(INDEX_TYPE row_start, INDEX_TYPE row_end,
+                  INDEX_TYPE col_start, INDEX_TYPE col_end,
+                  MKL_INT dense_cols, MKL_INT expected_calls) {
+    auto key = make_tuple(row_start, row_end, col_start, col_end);
+    auto it = blocks.find(key);
+    if (it != blocks.end()) {
+      return it->second.get();
+    }
+    auto block = make_unique<MKLBlock>();
+    block->row_start = row_start;
+    block->rows = row_end > row_start ? row_end - row_start : 0;
+    block->rowStart.resize(block->rows + 1, 0);
+
+    for (INDEX_TYPE i = row_start; i < row_end; i++) {
+      for (auto j = csr->rowStart[i]; j < csr->rowStart[i + 1]; j++) {
+        INDEX_TYPE col = csr->col_idx[j];
+        if (col >= col_start and col < col_end) {
+          block->col_ids.push_back(col);
+        }
+      }
+    }
+    sort(block->col_ids.begin(), block->col_ids.end());
+    block->col_ids.erase(unique(block->col_ids.begin(), block->col_ids.end()),
+                         block->col_ids.end());
+
+    for (INDEX_TYPE i = row_start; i < row_end; i++) {
+      for (auto j = csr->rowStart[i]; j < csr->rowStart[i + 1]; j++) {
+        INDEX_TYPE col = csr->col_idx[j];
+        if (col >= col_start and col < col_end) {
+          block->col_idx.push_back(lower_bound(block->col_ids.begin(),
+                                               block->col_ids.end(), col) -
+                                   block->col_ids.begin());
+          block->values.push_back(1.0);
+        }
+      }
+      block->rowStart[i - row_start + 1] = block->col_idx.size();
+    }
+
+    if (!block->values.empty()) {
+      mkl_sparse_d_create_csr(&block->handle, SPARSE_INDEX_BASE_ZERO,
+                              block->rows, block->col_ids.size(),
+                              block->rowStart.data(), block->rowStart.data() + 1,
+                              block->col_idx.data(), block->values.data());
+      if (dense_cols > 0) {
+        mkl_sparse_set_mm_hint(block->handle, SPARSE_OPERATION_NON_TRANSPOSE,
+                               general_descr(), SPARSE_LAYOUT_ROW_MAJOR,
+                               dense_cols, expected_calls);
+      }
+      mkl_sparse_optimize(block->handle);
+    }
+    MKLBlock *result = block.get();
+    blocks[key] = std::move(block);
+    return result;
+  }
+
+  /**
+   * C += alpha * block * B where C holds block->rows row major rows of width
+   * dim and row k of B is fetch_row(block->col_ids[k]). fetch_row returns
+   * nullptr for rows that are not available, those are treated as zero.
+   */
+  template <typename FETCH>
+  void spmm(MKLBlock *block, double alpha, MKL_INT dim, FETCH fetch_row,
+            double *C) {
+    if (block->handle == nullptr) {
+      return;
+    }
+    vector<double> B(block->col_ids.size() * dim, 0);
+#pragma omp parallel for
+    for (INDEX_TYPE k = 0; k < block->col_ids.size(); k++) {
+      const double *row = fetch_row(block->col_ids[k]);
+      if (row != nullptr) {
+        copy(row, row + dim, B.begin() + k * dim);
+      }
+    }
+    mkl_sparse_d_mm(SPARSE_OPERATION_NON_TRANSPOSE, alpha, block->handle,
+                    general_descr(), SPARSE_LAYOUT_ROW_MAJOR, B.data(), dim,
+                    dim, 1.0, C, dim);
+  }
+
+  /**
+   * Computes block * B where row k of B is the MKLBlockRow returned by
+   * fetch_row(block->col_ids[k]) and B has b_cols columns. visit(row, col,
+   * value) is called for every entry of the product, with row relative to the
+   * block; each row is visited by one thread.
+   */
+  template <typename FETCH, typename VISIT>
+  void spgemm(MKLBlock *block, MKL_INT b_cols, FETCH fetch_row, VISIT visit) {
+    if (block->handle == nullptr) {
+      return;
+    }
+    INDEX_TYPE b_rows = block->col_ids.size();
+    vector<MKL_INT> b_row_start(b_rows + 1, 0);
+    for (INDEX_TYPE k = 0; k < b_rows; k++) {
+      b_row_start[k + 1] = b_row_start[k] + fetch_row(block->col_ids[k]).count;
+    }
+    vector<MKL_INT> b_col_idx(max<MKL_INT>(b_row_start[b_rows], 1));
+    vector<double> b_values(max<MKL_INT>(b_row_start[b_rows], 1));
+#pragma omp parallel for
+    for (INDEX_TYPE k = 0; k < b_rows; k++) {
+      auto row = fetch_row(block->col_ids[k]);
+      for (INDEX_TYPE m = 0; m < row.count; m++) {
+        b_col_idx[b_row_start[k] + m] = row.col(m);
+        b_values[b_row_start[k] + m] = row.values[m];
+      }
+    }
+    if (b_row_start[b_rows] == 0) {
+      return;
+    }
+
+    sparse_matrix_t B, C;
+    mkl_sparse_d_create_csr(&B, SPARSE_INDEX_BASE_ZERO, b_rows, b_cols,
+                            b_row_start.data(), b_row_start.data() + 1,
+                            b_col_idx.data(), b_values.data());
+    mkl_sparse_sp2m(SPARSE_OPERATION_NON_TRANSPOSE, general_descr(),
+                    block->handle, SPARSE_OPERATION_NON_TRANSPOSE,
+                    general_descr(), B, SPARSE_STAGE_FULL_MULT, &C);
+
+    sparse_index_base_t indexing;
+    MKL_INT rows, cols;
+    MKL_INT *rows_start, *rows_end, *col_idx;
+    double *values;
+    mkl_sparse_d_export_csr(C, &indexing, &rows, &cols, &rows_start, &rows_end,
+                            &col_idx, &values);
+#pragma omp parallel for schedule(dynamic, 64)
+    for (MKL_INT r = 0; r < rows; r++) {
+      for (MKL_INT j = rows_start[r]; j < rows_end[r]; j++) {
+        visit(static_cast<INDEX_TYPE>(r), static_cast<INDEX_TYPE>(col_idx[j]),
+              values[j]);
+      }
+    }
+    mkl_sparse_destroy(C);
+    mkl_sparse_destroy(B);
+  }
+};
+
+} // namespace distblas::core
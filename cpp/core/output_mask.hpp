@@ -0,0 +1,95 @@
+/**
+ * Structural mask of a SpGEMM output, one bit per local output row and column.
+ * A plain mask only lets the set entries through, a complemented mask (e.g.
+ * the visited set of a BFS) only the unset ones. Rows that let nothing
+ * through are closed: kernels skip them and their operand rows are never
+ * requested.
+ */
+#pragma once
+#include "common.h"
+#include <vector>
+
+using namespace std;
+
+namespace distblas::core {
+
+class OutputMask {
+
+private:
+  INDEX_TYPE rows;
+  INDEX_TYPE cols;
+  INDEX_TYPE row_words;
+  bool complement;
+  vector<uint64_t> bits;
+  vector<char> closed;
+
+public:
+  OutputMask(INDEX_TYPE rows, INDEX_TYPE cols, bool complement)
+      : rows(rows), cols(cols), row_words((cols + 63) / 64),
+        complement(complement), bits(rows * ((cols + 63) / 64), 0),
+        closed(rows, !complement) {}
+
+  INDEX_TYPE words() const { return row_words; }
+
+  INDEX_TYPE width() const { return cols; }
+
+  bool is_complemented() const { return complement; }
+
+  bool allows(INDEX_TYPE row, INDEX_TYPE col) const {
+    bool set = (bits[row * row_words + col / 64] >> (col % 64)) & 1;
+    return set != complement;
+  }
+
+  // a row is only ever updated by one thread
+  void set(INDEX_TYPE row, INDEX_TYPE col) {
+    bits[row * row_words + col / 64] |= uint64_t(1) << (col % 64);
+  }
+
+  bool row_closed(INDEX_TYPE row) const { return closed[row]; }
+
+  // stored words of a row, before the complement is applied
+  uint64_t *row_data(INDEX_TYPE row) { return bits.data() + row * row_words; }
+
+  const uint64_t *row_data(INDEX_TYPE row) const {
+    return bits.data() + row * row_words;
+  }
+
+  /**
+   * Recomputes the closed rows, to be called once the bits of a round of
+   * updates are set.
+   */
+  void refresh() {
+#pragma omp parallel for schedule(static)
+    for (INDEX_TYPE i = 0; i < rows; i++) {
+      bool none = true;
+      for (INDEX_TYPE w = 0; w < row_words and none; w++) {
+        none = open_word(i, w) == 0;
+      }
+      closed[i] = none;
+    }
+  }
+
+  // word w of the columns the row lets through
+  uint64_t open_word(INDEX_TYPE row, INDEX_TYPE w) const {
+    uint64_t word = bits[row * row_words + w];
+    if (complement) {
+      word = ~word;
+      INDEX_TYPE valid = min<INDEX_TYPE>(64, cols - w * 64);
+      if (valid < 64) {
+        word &= (uint64_t(1) << valid) - 1;
+      }
+    }
+    return word;
+  }
+
+  INDEX_TYPE count() const {
+    INDEX_TYPE total = 0;
+#pragma omp parallel for schedule(static) reduction(+ : total)
+    for (INDEX_TYPE k = 0; k < bits.size(); k++) {
+      total += __builtin_popcountll(bits[k]);
+    }
+    return total;
+  }
+};
+
+} // namespace distblas::core
@@ -0,0 +1,70 @@
+/**
+ * Compile time semirings for the SpGEMM kernels. A semiring supplies add and
+ * multiply together with their identity and annihilator; kernels are
+ * instantiated per semiring, so every one of them compiles to its own loop.
+ */
+#pragma once
+#include <algorithm>
+#include <limits>
+#include <type_traits>
+
+using namespace std;
+
+namespace distblas::core {
+
+template <typename T> struct PlusTimes {
+  static constexpr T identity() { return 0; }
+  static constexpr T annihilator() { return 0; }
+  static inline T add(T a, T b) { return a + b; }
+  static inline T multiply(T a, T b) { return a * b; }
+};
+
+// reachability, every nonzero is true and results are 0 or 1
+template <typename T> struct OrAnd {
+  static constexpr T identity() { return 0; }
+  static constexpr T annihilator() { return 0; }
+  static inline T add(T a, T b) { return (a != 0 or b != 0) ? 1 : 0; }
+  static inline T multiply(T a, T b) { return (a != 0 and b != 0) ? 1 : 0; }
+};
+
+// shortest paths, with lr as the edge weight a kernel computes hop distances
+template <typename T> struct MinPlus {
+  static constexpr T identity() {
+    return numeric_limits<T>::has_infinity ? numeric_limits<T>::infinity()
+                                           : numeric_limits<T>::max();
+  }
+  static constexpr T annihilator() { return identity(); }
+  static inline T add(T a, T b) { return min(a, b); }
+  static inline T multiply(T a, T b) { return a + b; }
+};
+
+// most reliable paths over non negative weights
+template <typename T> struct MaxTimes {
+  static constexpr T identity() { return 0; }
+  static constexpr T annihilator() { return 0; }
+  static inline T add(T a, T b) { return max(a, b); }
+  static inline T multiply(T a, T b) { return a * b; }
+};
+
+/**
+ * Dense accumulators are zero filled and the CSR conversion drops zeros, so
+ * they only hold semirings whose identity is 0. The others (MinPlus) need the
+ * hash accumulators, which mark empty slots by column.
+ */
+template <typename SEMIRING>
+inline constexpr bool dense_accumulable = SEMIRING::identity() == 0;
+
+/**
+ * Adds value to an accumulator slot, a slot equal to the identity is empty
+ * and takes the value as is.
+ */
+template <typename SEMIRING, typename T>
+inline void semiring_add_to(T &slot, T value) {
+  if constexpr (is_same<SEMIRING, PlusTimes<T>>::value) {
+    slot += value;
+  } else {
+    slot = slot == SEMIRING::identity() ? value : SEMIRING::add(slot, value);
+  }
+}
+
+} // namespace distblas::core
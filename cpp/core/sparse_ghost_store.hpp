@@ -0,0 +1,98 @@
+/**
+ * Contiguous store for sparse rows received from one remote process. Rows are
+ * kept in CSR like arrays and looked up through a row map, so kernels read
+ * them in place instead of copying per access.
+ */
+#pragma once
+#include "common.h"
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+namespace distblas::core {
+
+template <typename VALUE_TYPE> struct SparseRowSpan {
+  const INDEX_TYPE *cols = nullptr;
+  const VALUE_TYPE *values = nullptr;
+  INDEX_TYPE count = 0;
+};
+
+template <typename VALUE_TYPE> class SparseGhostStore {
+
+private:
+  struct RowSlot {
+    INDEX_TYPE offset;
+    INDEX_TYPE count;
+    int inserted_batch_id;
+    int inserted_itr;
+    bool force_delete;
+  };
+
+  unordered_map<INDEX_TYPE, RowSlot> row_map;
+  vector<INDEX_TYPE> cols;
+  vector<VALUE_TYPE> values;
+
+public:
+  /**
+   * Appends entries to a row. A row inserted in an earlier iteration or batch
+   * (or marked for deletion) is started over; its old entries stay in the
+   * arrays until the store is cleared. A row that is extended but is not the
+   * last one written is moved to the end.
+   */
+  void append(INDEX_TYPE key, const INDEX_TYPE *row_cols,
+              const VALUE_TYPE *row_values, INDEX_TYPE count, int iteration,
+              int batch_id, bool force_delete) {
+    auto it = row_map.find(key);
+    if (force_delete or it == row_map.end() or
+        it->second.inserted_itr != iteration or
+        it->second.inserted_batch_id != batch_id or it->second.force_delete) {
+      row_map[key] = {static_cast<INDEX_TYPE>(cols.size()), 0, batch_id,
+                      iteration, force_delete};
+      it = row_map.find(key);
+    }
+    RowSlot &slot = it->second;
+    if (slot.offset + slot.count != cols.size()) {
+      INDEX_TYPE offset = cols.size();
+      cols.resize(offset + slot.count);
+      values.resize(offset + slot.count);
+      copy(cols.begin() + slot.offset, cols.begin() + slot.offset + slot.count,
+           cols.begin() + offset);
+      copy(values.begin() + slot.offset,
+           values.begin() + slot.offset + slot.count, values.begin() + offset);
+      slot.offset = offset;
+    }
+    cols.insert(cols.end(), row_cols, row_cols + count);
+    values.insert(values.end(), row_values, row_values + count);
+    slot.count += count;
+  }
+
+  void reserve(INDEX_TYPE rows, INDEX_TYPE nnz) {
+    row_map.reserve(row_map.size() + rows);
+    cols.reserve(cols.size() + nnz);
+    values.reserve(values.size() + nnz);
+  }
+
+  /**
+   * Returns false if the row was never received. The span stays valid until
+   * the next append or clear.
+   */
+  bool find(INDEX_TYPE key, SparseRowSpan<VALUE_TYPE> &row) const {
+    auto it = row_map.find(key);
+    if (it == row_map.end()) {
+      return false;
+    }
+    row.cols = cols.data() + it->second.offset;
+    row.values = values.data() + it->second.offset;
+    row.count = it->second.count;
+    return true;
+  }
+
+  void clear() {
+    unordered_map<INDEX_TYPE, RowSlot>().swap(row_map);
+    vector<INDEX_TYPE>().swap(cols);
+    vector<VALUE_TYPE>().swap(values);
+  }
+};
+
+} // namespace distblas::core
@@ -6,6 +6,7 @@
 #include "common.h"
 #include "csr_local.hpp"
 #include "distributed_mat.hpp"
+#include "sparse_ghost_store.hpp"
 #include "sparse_mat_tile.hpp"
 #include <algorithm>
 #include <chrono>
@@ -13,6 +14,7 @@
 #include <math.h>
 #include <memory>
 #include <mpi.h>
+#include <numeric>
 #include <parallel/algorithm>
 #include <set>
 #include <unordered_set>
@@ -61,8 +63,7 @@ private:
 
   void find_col_ids_for_pulling_with_tiling(int batch_id, int starting_proc, int end_proc,
       vector<vector<unordered_map<INDEX_TYPE, unordered_map<int, bool>>>>*id_to_proc_mapping,
-      vector<vector<vector<SparseTile<INDEX_TYPE, VALUE_TYPE>>>> *tile_map,
-      string semring = "+", SpMat<VALUE_TYPE> *input_data = nullptr) {
+      vector<vector<vector<SparseTile<INDEX_TYPE, VALUE_TYPE>>>> *tile_map) {
     int rank = grid->rank_in_col;
     int world_size = grid->col_world_size;
 
@@ -83,25 +84,13 @@ private:
 
         for (int i = starting_index; i < end_index; i++) {
           if (rank != procs[r] and (handle->rowStart[i + 1] - handle->rowStart[i]) > 0) {
-            vector<unordered_set<INDEX_TYPE>> unique_per_row(SparseTile<INDEX_TYPE,VALUE_TYPE>::get_tiles_per_process_row());
             for (auto j = handle->rowStart[i]; j < handle->rowStart[i + 1];j++) {
               auto col_val = handle->col_idx[j];
               int tile_id = SparseTile<INDEX_TYPE, VALUE_TYPE>::get_tile_id(
                     batch_id, col_val, proc_col_width, procs[r]);
-                if (semring == "+" and input_data != nullptr) {
-                  CSRHandle *input_handle = input_data->csr_local_data->handler.get();
-                  if (input_handle->rowStart[col_val + 1] -input_handle->rowStart[col_val] >0) {
-                    for (auto h = input_handle->rowStart[col_val];h < input_handle->rowStart[col_val + 1]; h++) {
-                        unique_per_row[tile_id].insert(input_handle->col_idx[h]);
-                    }
-                  }
-                }
                 (*tile_map)[batch_id][procs[r]][tile_id].insert(col_val);
                 (*id_to_proc_mapping)[batch_id][tile_id][col_val][procs[r]] =true;
             }
-            for (int tile = 0;tile < SparseTile<INDEX_TYPE,VALUE_TYPE>::get_tiles_per_process_row();tile++) {
-              (*tile_map)[batch_id][procs[r]][tile].total_receivable_datacount += unique_per_row[tile].size();
-            }
           }
         }
       }
@@ -140,13 +129,53 @@ private:
   //
   //  }
 
+  /*
+   * Visits the rows [begin, end) in parallel, marking ids in a bitset that
+   * covers [id_base, id_base + id_space), and returns the marked ids sorted
+   * and unique. visit(i, mark) calls mark(id) for every id row i contributes.
+   */
+  template <typename VISIT>
+  vector<INDEX_TYPE> collect_unique_ids(INDEX_TYPE begin, INDEX_TYPE end,
+                                        INDEX_TYPE id_base,
+                                        INDEX_TYPE id_space, VISIT visit) {
+    vector<uint64_t> bits((id_space + 63) / 64, 0);
+    auto mark = [&bits, id_base](INDEX_TYPE id) {
+      INDEX_TYPE offset = id - id_base;
+#pragma omp atomic update
+      bits[offset >> 6] |= uint64_t(1) << (offset & 63);
+    };
+
+#pragma omp parallel for schedule(guided)
+    for (INDEX_TYPE i = begin; i < end; i++) {
+      visit(i, mark);
+    }
+
+    vector<INDEX_TYPE> word_offsets(bits.size() + 1, 0);
+#pragma omp parallel for
+    for (size_t w = 0; w < bits.size(); w++) {
+      word_offsets[w + 1] = __builtin_popcountll(bits[w]);
+    }
+    std::partial_sum(word_offsets.begin(), word_offsets.end(),
+                     word_offsets.begin());
+
+    vector<INDEX_TYPE> ids(word_offsets.back());
+#pragma omp parallel for
+    for (size_t w = 0; w < bits.size(); w++) {
+      uint64_t word = bits[w];
+      INDEX_TYPE pos = word_offsets[w];
+      while (word) {
+        ids[pos++] = id_base + w * 64 + __builtin_ctzll(word);
+        word &= word - 1;
+      }
+    }
+    return ids;
+  }
+
   /*
    * This method computes all indicies for pull based approach
    */
-  void find_col_ids_for_pulling(
-      int batch_id, int starting_proc, int end_proc,
-      vector<unordered_set<INDEX_TYPE>> &proc_to_id_mapping,
-      unordered_map<INDEX_TYPE, unordered_map<int, bool>> &id_to_proc_mapping) {
+  void find_col_ids_for_pulling(int batch_id, int starting_proc, int end_proc,
+                                vector<vector<INDEX_TYPE>> &proc_to_id_mapping) {
 
     int rank = grid->rank_in_col;
     int world_size = grid->col_world_size;
@@ -162,8 +191,15 @@ private:
       procs.push_back(target);
     }
 
+    for (int r = 0; r < procs.size(); r++) {
+      proc_to_id_mapping[procs[r]].clear();
+    }
+
     if (col_partitioned) {
       for (int r = 0; r < procs.size(); r++) {
+        if (rank == procs[r]) {
+          continue;
+        }
         INDEX_TYPE starting_index =
             batch_id * batch_size + proc_row_width * procs[r];
         auto end_index = std::min(
@@ -171,40 +207,40 @@ private:
                      static_cast<INDEX_TYPE>((procs[r] + 1) * proc_row_width)),
             gRows);
 
-        for (int i = starting_index; i < end_index; i++) {
-          if (rank != procs[r] and
-              (handle->rowStart[i + 1] - handle->rowStart[i]) > 0) {
-            for (auto j = handle->rowStart[i]; j < handle->rowStart[i + 1];
-                 j++) {
-              auto col_val = handle->col_idx[j];
-              {
-                proc_to_id_mapping[procs[r]].insert(col_val);
-                id_to_proc_mapping[col_val][procs[r]] = true;
+        proc_to_id_mapping[procs[r]] = collect_unique_ids(
+            starting_index, end_index, 0, proc_col_width,
+            [handle](INDEX_TYPE i, auto &mark) {
+              for (auto j = handle->rowStart[i]; j < handle->rowStart[i + 1];
+                   j++) {
+                mark(handle->col_idx[j]);
               }
-            }
-          }
-        }
+            });
       }
     } else if (transpose) {
+      INDEX_TYPE dst_start = batch_id * batch_size;
+      INDEX_TYPE dst_end_index =
+          std::min((batch_id + 1) * batch_size, proc_row_width);
       for (int r = 0; r < procs.size(); r++) {
+        if (rank == procs[r]) {
+          continue;
+        }
         INDEX_TYPE starting_index = proc_col_width * procs[r];
         auto end_index = std::min(
             static_cast<INDEX_TYPE>((procs[r] + 1) * proc_col_width), gCols);
-        for (int i = starting_index; i < end_index; i++) {
-          if (rank != procs[r] and
-              (handle->rowStart[i + 1] - handle->rowStart[i]) > 0) {
-            for (auto j = handle->rowStart[i]; j < handle->rowStart[i + 1];
-                 j++) {
-              auto col_val = handle->col_idx[j];
-              INDEX_TYPE dst_start = batch_id * batch_size;
-              INDEX_TYPE dst_end_index =
-                  std::min((batch_id + 1) * batch_size, proc_row_width);
-              if (col_val >= dst_start and col_val < dst_end_index) {
-                { proc_to_id_mapping[procs[r]].insert(i); }
+
+        proc_to_id_mapping[procs[r]] = collect_unique_ids(
+            starting_index, end_index, starting_index,
+            end_index - starting_index,
+            [handle, dst_start, dst_end_index](INDEX_TYPE i, auto &mark) {
+              for (auto j = handle->rowStart[i]; j < handle->rowStart[i + 1];
+                   j++) {
+                auto col_val = handle->col_idx[j];
+                if (col_val >= dst_start and col_val < dst_end_index) {
+                  mark(i);
+                  break;
+                }
               }
-            }
-          }
-        }
+            });
       }
     }
   }
@@ -212,22 +248,14 @@ private:
   /*
    * This method computes all indicies for push based approach
    */
-  void find_col_ids_for_pushing(
-      int batch_id, int starting_proc, int end_proc,
-      vector<unordered_set<INDEX_TYPE>> &proc_to_id_mapping,
-      unordered_map<INDEX_TYPE, unordered_map<int, bool>> &id_to_proc_mapping) {
+  void find_col_ids_for_pushing(int batch_id, int starting_proc, int end_proc,
+                                vector<vector<INDEX_TYPE>> &proc_to_id_mapping) {
     int rank = grid->rank_in_col;
     int world_size = grid->col_world_size;
 
     distblas::core::CSRHandle *handle =
         (this->csr_local_data.get())->handler.get();
 
-    auto batches = (proc_row_width / batch_size);
-
-    if (!(proc_row_width % batch_size == 0)) {
-      batches = (proc_row_width / batch_size) + 1;
-    }
-
     vector<int> procs;
     for (int i = starting_proc; i < end_proc; i++) {
       int target = (col_partitioned) ? (rank + i) % world_size
@@ -236,65 +264,66 @@ private:
       procs.push_back(target);
     }
 
+    for (int r = 0; r < procs.size(); r++) {
+      proc_to_id_mapping[procs[r]].clear();
+    }
+
     if (col_partitioned) {
       // calculation of sender col_ids
+      INDEX_TYPE eligible_col_id_start =
+          (batch_id >= 0) ? batch_id * batch_size : 0;
+      INDEX_TYPE eligible_col_id_end =
+          (batch_id >= 0)
+              ? std::min(static_cast<INDEX_TYPE>((batch_id + 1) * batch_size),
+                         static_cast<INDEX_TYPE>(proc_col_width))
+              : proc_col_width;
       for (int r = 0; r < procs.size(); r++) {
+        if (rank == procs[r]) {
+          continue;
+        }
         INDEX_TYPE starting_index = proc_row_width * procs[r];
-        auto end_index =
-            std::min(static_cast<INDEX_TYPE>((procs[r] + 1) * proc_row_width),
-                     gRows) -
-            1;
-
-        auto eligible_col_id_start =
-            (batch_id >= 0) ? batch_id * batch_size : 0;
-        auto eligible_col_id_end =
-            (batch_id >= 0)
-                ? std::min(static_cast<INDEX_TYPE>((batch_id + 1) * batch_size),
-                           static_cast<INDEX_TYPE>(proc_col_width))
-                : proc_col_width;
-
-        for (auto i = starting_index; i <= (end_index); i++) {
-
-          if (rank != procs[r] and
-              (handle->rowStart[i + 1] - handle->rowStart[i]) > 0) {
-            for (auto j = handle->rowStart[i]; j < handle->rowStart[i + 1];
-                 j++) {
-              auto col_val = handle->col_idx[j];
-              if (col_val >= eligible_col_id_start and
-                  col_val < eligible_col_id_end) {
-                // calculation of sender col_ids
-                {
-                  proc_to_id_mapping[procs[r]].insert(col_val);
-                  id_to_proc_mapping[col_val][procs[r]] = true;
+        auto end_index = std::min(
+            static_cast<INDEX_TYPE>((procs[r] + 1) * proc_row_width), gRows);
+
+        proc_to_id_mapping[procs[r]] = collect_unique_ids(
+            starting_index, end_index, 0, proc_col_width,
+            [handle, eligible_col_id_start,
+             eligible_col_id_end](INDEX_TYPE i, auto &mark) {
+              for (auto j = handle->rowStart[i]; j < handle->rowStart[i + 1];
+                   j++) {
+                auto col_val = handle->col_idx[j];
+                if (col_val >= eligible_col_id_start and
+                    col_val < eligible_col_id_end) {
+                  mark(col_val);
                 }
               }
-            }
-          }
-        }
+            });
       }
     } else if (transpose) {
       // calculation of receiver col_ids
       for (int r = 0; r < procs.size(); r++) {
+        if (rank == procs[r]) {
+          continue;
+        }
         INDEX_TYPE starting_index =
             (batch_id >= 0) ? batch_id * batch_size + proc_col_width * procs[r]
                             : proc_col_width * procs[r];
-        auto end_index =
-            (batch_id >= 0)
-                ? std::min(starting_index + batch_size,
-                           std::min(static_cast<INDEX_TYPE>((procs[r] + 1) *
-                                                            proc_col_width),
-                                    gCols)) -
-                      1
-                : std::min(
-                      static_cast<INDEX_TYPE>((procs[r] + 1) * proc_col_width),
-                      gCols) -
-                      1;
-        for (auto i = starting_index; i <= (end_index); i++) {
-          if (rank != procs[r] and
-              (handle->rowStart[i + 1] - handle->rowStart[i]) > 0) {
-            proc_to_id_mapping[procs[r]].insert(i);
-          }
+        auto block_end = std::min(
+            static_cast<INDEX_TYPE>((procs[r] + 1) * proc_col_width), gCols);
+        auto end_index = (batch_id >= 0)
+                             ? std::min(starting_index + batch_size, block_end)
+                             : block_end;
+        if (starting_index >= end_index) {
+          continue;
         }
+
+        proc_to_id_mapping[procs[r]] = collect_unique_ids(
+            starting_index, end_index, starting_index,
+            end_index - starting_index, [handle](INDEX_TYPE i, auto &mark) {
+              if (handle->rowStart[i + 1] - handle->rowStart[i] > 0) {
+                mark(i);
+              }
+            });
       }
     }
   }
@@ -308,8 +337,8 @@ public:
   bool col_partitioned = false;
   Process3DGrid *grid;
 
-  unique_ptr<vector<unordered_map<INDEX_TYPE, SparseCacheEntry<VALUE_TYPE>>>>
-      tempCachePtr;
+  // rows received from each process of the column world
+  unique_ptr<vector<SparseGhostStore<VALUE_TYPE>>> tempCachePtr;
 
   /**
    * Constructor for Sparse Matrix representation of  Adj matrix
@@ -333,15 +362,13 @@ public:
     this->transpose = transpose;
     this->col_partitioned = col_partitioned;
     this->grid = grid;
-    this->tempCachePtr = std::make_unique<std::vector<
-        std::unordered_map<INDEX_TYPE, SparseCacheEntry<VALUE_TYPE>>>>(
+    this->tempCachePtr = std::make_unique<std::vector<SparseGhostStore<VALUE_TYPE>>>(
         grid->col_world_size);
   }
 
   SpMat(Process3DGrid *grid) : DistributedMat() {
     this->grid = grid;
-    this->tempCachePtr = std::make_unique<std::vector<
-        std::unordered_map<INDEX_TYPE, SparseCacheEntry<VALUE_TYPE>>>>(
+    this->tempCachePtr = std::make_unique<std::vector<SparseGhostStore<VALUE_TYPE>>>(
         grid->col_world_size);
   }
 
@@ -349,8 +376,7 @@ public:
         bool hash_spgemm, bool random_initialize=false)
       : DistributedMat() {
     this->grid = grid;
-    this->tempCachePtr = std::make_unique<std::vector<
-        std::unordered_map<INDEX_TYPE, SparseCacheEntry<VALUE_TYPE>>>>(
+    this->tempCachePtr = std::make_unique<std::vector<SparseGhostStore<VALUE_TYPE>>>(
         grid->col_world_size);
     this->proc_col_width = proc_col_width;
     this->proc_row_width = proc_row_width;
@@ -363,9 +389,10 @@ public:
       this->sparse_data_counter =
           make_unique<vector<INDEX_TYPE>>(proc_row_width, 0);
       this->hash_spgemm = true;
+      this->accumulator_width = proc_col_width;
     } else {
-      this->dense_collector = make_unique<vector<vector<VALUE_TYPE>>>(
-          proc_row_width, vector<VALUE_TYPE>(proc_col_width, 0));
+      this->dense_collector = make_unique<DenseCollector<VALUE_TYPE>>(
+          proc_row_width, proc_col_width);
       if (random_initialize){
         for (int i = 0; i < proc_row_width; i++) {
           for (int j = 0; j < proc_col_width; j++) {
@@ -378,8 +405,8 @@ public:
   }
 
   void initialize_batch_collector(INDEX_TYPE batch_size) {
-    this->batch_collector = make_unique<vector<vector<VALUE_TYPE>>>(
-        batch_size, vector<VALUE_TYPE>(proc_col_width, 0));
+    this->batch_collector = make_unique<DenseCollector<VALUE_TYPE>>(
+        batch_size, proc_col_width);
   }
 
   void merge_batch_collector(int batch_id,INDEX_TYPE batch_size) {
@@ -387,14 +414,15 @@ public:
     auto end_index = min(starting_index+batch_size, proc_row_width);
    #pragma omp parallel for
     for(auto i=starting_index;i<end_index;i++){
+      auto row = (*this->dense_collector)[i];
+      auto batch_row = (*this->batch_collector)[i-starting_index];
       for(auto j=0;j<proc_col_width;j++){
-        if ((*this->dense_collector)[i][j]!=static_cast<VALUE_TYPE>(INT_MIN)){
-          (*this->dense_collector)[i][j] += (*this->batch_collector)[i-starting_index][j];
-          (*this->batch_collector)[i-starting_index][j]=0;
+        if (row[j]!=static_cast<VALUE_TYPE>(INT_MIN)){
+          row[j] += batch_row[j];
         }else {
-          (*this->dense_collector)[i][j]=(*this->batch_collector)[i-starting_index][j];
-          (*this->batch_collector)[i-starting_index][j]=0;
+          row[j]=batch_row[j];
         }
+        batch_row[j]=0;
       }
     }
   }
@@ -407,7 +435,7 @@ public:
     if (enforce_empty_csr or coords.size()>0) {
       initialize_CSR_from_tuples();
     } else if (hash_spgemm and sparse_data_collector->size() > 0) {
-      this->initialize_CSR_from_sparse_collector();
+      this->initialize_CSR_from_sparse_collector(this->proc_col_width);
     } else if (dense_collector->size() > 0) {
       this->initialize_CSR_from_dense_collector(this->proc_row_width,
                                                 this->proc_col_width,state_holder,comparator,clear_dense_collector);
@@ -423,8 +451,8 @@ public:
       } else {
         auto rows = handle->rowStart.size() - 1;
         auto cols = this->proc_col_width;
-        this->dense_collector = make_unique<vector<vector<VALUE_TYPE>>>(
-            rows, vector<VALUE_TYPE>(cols, 0));
+        this->dense_collector = make_unique<DenseCollector<VALUE_TYPE>>(
+            rows, cols);
 #pragma omp parallel for
         for (auto i = 0; i < handle->rowStart.size() - 1; i++) {
           for (auto j = handle->rowStart[i]; j < handle->rowStart[i + 1]; j++) {
@@ -439,34 +467,23 @@ public:
     }
   }
 
-  void initialize_hashtables() {
-#pragma omp parallel for
-    for (auto i = 0; i < proc_row_width; i++) {
-      auto count = (*sparse_data_counter)[i];
-      auto resize_count = pow(2, log2(count) + 1);
-      (*sparse_data_collector)[i].clear();
-      Tuple<VALUE_TYPE> t;
-      t.row = i;
-      t.col = -1;
-      t.value = 0;
-      (*sparse_data_collector)[i].resize(resize_count, t);
-      (*sparse_data_counter)[i] = 0;
-    }
+  void initialize_hashtables(INDEX_TYPE row_start = 0,
+                             INDEX_TYPE row_end = numeric_limits<INDEX_TYPE>::max()) {
+    this->initialize_accumulators(proc_col_width, row_start, row_end);
   }
 
-  // if batch_id<0 it will fetch all the batches
+  // if batch_id<0 it will fetch all the batches. Ids for each destination are
+  // returned sorted and unique.
   void find_col_ids(
       int batch_id, int starting_proc, int end_proc,
-      vector<unordered_set<INDEX_TYPE>> &proc_to_id_mapping,
-      unordered_map<INDEX_TYPE, unordered_map<int, bool>> &id_to_proc_mapping,
-      bool mode) {
+      vector<vector<INDEX_TYPE>> &proc_to_id_mapping, bool mode) {
 
     if (mode == 0) {
       find_col_ids_for_pulling(batch_id, starting_proc, end_proc,
-                               proc_to_id_mapping, id_to_proc_mapping);
+                               proc_to_id_mapping);
     } else {
       find_col_ids_for_pushing(batch_id, starting_proc, end_proc,
-                               proc_to_id_mapping, id_to_proc_mapping);
+                               proc_to_id_mapping);
     }
   }
 
@@ -476,13 +493,12 @@ public:
           *proc_to_id_mapping,
       vector<vector<unordered_map<INDEX_TYPE, unordered_map<int, bool>>>>
           *id_to_proc_mapping,
-      bool mode, string semring = "+",
-      SpMat<VALUE_TYPE> *input_data = nullptr) {
+      bool mode) {
 
     if (mode == 0) {
       find_col_ids_for_pulling_with_tiling(
           batch_id, starting_proc, end_proc, id_to_proc_mapping,
-          proc_to_id_mapping, semring, input_data);
+          proc_to_id_mapping);
     } else {
       //      find_col_ids_for_pushing_with_tiling(batch_id,
       //      starting_proc,end_proc,proc_to_id_mapping,id_to_proc_mapping);
@@ -511,15 +527,72 @@ public:
       if (handle->rowStart[local_key + 1] - handle->rowStart[local_key] > 0) {
           new_handler.col_idx.resize(count);
           new_handler.values.resize(count);
-          copy(handle->col_idx.begin(), handle->col_idx.begin() + count,
+          copy(handle->col_idx.begin() + handle->rowStart[local_key],
+               handle->col_idx.begin() + handle->rowStart[local_key + 1],
                new_handler.col_idx.begin());
-          copy(handle->values.begin(), handle->values.begin() + count,
+          copy(handle->values.begin() + handle->rowStart[local_key],
+               handle->values.begin() + handle->rowStart[local_key + 1],
                new_handler.values.begin());
       }
     }
     return new_handler;
   }
 
+  /**
+   * Counts, for every sender tile, the distinct output entries the tile would
+   * produce if it were multiplied with input_data on this process. Only the
+   * sender (col_partitioned) view carries the rows needed for this. The count
+   * depends on input_data, so it is recomputed whenever the input changes
+   * while the tile index sets stay the same. The count only depends on the
+   * sparsity patterns, so it holds for every semiring.
+   */
+  void get_receivable_datacount(
+      vector<vector<vector<SparseTile<INDEX_TYPE, VALUE_TYPE>>>> *tile_map,
+      int total_batches, SpMat<VALUE_TYPE> *input_data) {
+    int rank = grid->rank_in_col;
+    int tiles_per_process =
+        SparseTile<INDEX_TYPE, VALUE_TYPE>::get_tiles_per_process_row();
+    CSRHandle *handle = (this->csr_local_data.get())->handler.get();
+    bool counting = input_data != nullptr;
+
+    auto itr = total_batches * grid->col_world_size;
+#pragma omp parallel for schedule(dynamic)
+    for (auto in = 0; in < itr; in++) {
+      int batch_id = in / grid->col_world_size;
+      int proc = in % grid->col_world_size;
+      vector<uint64_t> counts(tiles_per_process, 0);
+      if (counting and proc != rank) {
+        CSRHandle *input_handle = input_data->csr_local_data->handler.get();
+        INDEX_TYPE starting_index =
+            batch_id * batch_size + proc_row_width * proc;
+        auto end_index = std::min(
+            std::min((starting_index + batch_size),
+                     static_cast<INDEX_TYPE>((proc + 1) * proc_row_width)),
+            gRows);
+        vector<unordered_set<INDEX_TYPE>> unique_per_row(tiles_per_process);
+        for (auto i = starting_index; i < end_index; i++) {
+          for (auto j = handle->rowStart[i]; j < handle->rowStart[i + 1]; j++) {
+            auto col_val = handle->col_idx[j];
+            int tile_id = SparseTile<INDEX_TYPE, VALUE_TYPE>::get_tile_id(
+                batch_id, col_val, proc_col_width, proc);
+            for (auto h = input_handle->rowStart[col_val];
+                 h < input_handle->rowStart[col_val + 1]; h++) {
+              unique_per_row[tile_id].insert(input_handle->col_idx[h]);
+            }
+          }
+          for (int tile = 0; tile < tiles_per_process; tile++) {
+            counts[tile] += unique_per_row[tile].size();
+            unique_per_row[tile].clear();
+          }
+        }
+      }
+      for (int tile = 0; tile < tiles_per_process; tile++) {
+        (*tile_map)[batch_id][proc][tile].total_receivable_datacount =
+            counts[tile];
+      }
+    }
+  }
+
   void get_transferrable_datacount(
       vector<vector<vector<SparseTile<INDEX_TYPE, VALUE_TYPE>>>> *tile_map,
       int total_batches, bool col_id_set, bool indices_only) {
@@ -558,29 +631,23 @@ public:
   void purge_cache() {
     for (int i = 0; i < grid->col_world_size; i++) {
       (*this->tempCachePtr)[i].clear();
-      //      std::unordered_map<INDEX_TYPE,
-      //      distblas::core::SparseCacheEntry<VALUE_TYPE>>().swap(
-      //          (*this->tempCachePtr)[i]);
     }
-    this->tempCachePtr = std::make_unique<std::vector<
-        std::unordered_map<INDEX_TYPE, SparseCacheEntry<VALUE_TYPE>>>>(
-        grid->col_world_size);
   }
 
   auto fetch_data_vector_from_cache(vector<Tuple<VALUE_TYPE>> &entries,
                                     int rank, INDEX_TYPE key) {
 
     // Access the array using the provided rank and key
-
-    auto arrayMap = (*tempCachePtr)[rank];
-    auto it = arrayMap.find(key);
-
-    if (it != arrayMap.end()) {
-      auto temp = it->second;
-      entries = temp.value;
-    } else {
+    SparseRowSpan<VALUE_TYPE> row;
+    if (!(*tempCachePtr)[rank].find(key, row)) {
       throw std::runtime_error("cannot find the given key");
     }
+    entries.resize(row.count);
+    for (INDEX_TYPE k = 0; k < row.count; k++) {
+      entries[k].row = key;
+      entries[k].col = row.cols[k];
+      entries[k].value = row.values[k];
+    }
   }
 
   void print_coords(bool trans) {
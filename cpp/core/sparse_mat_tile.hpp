@@ -48,7 +48,7 @@ public:
     this->hash_spgemm =hash_spgemm;
   }
 
-  SparseTile<INDEX_TYPE, VALUE_TYPE>::SparseTile(const SparseTile& other)
+  SparseTile(const SparseTile& other)
       : DistributedMat(other), id(other.id),
         row_starting_index(other.row_starting_index),
         row_end_index(other.row_end_index),
@@ -69,39 +69,35 @@ public:
 
 
 
-  void initialize_output_DS_if(int comparing_mode, bool symbolic){
+  // dense outputs are taken from pool when one is given
+  void initialize_output_DS_if(int comparing_mode, bool symbolic,
+                               DenseCollectorPool<VALUE_TYPE> *pool = nullptr){
     if (mode==comparing_mode){
       auto len = row_end_index- row_starting_index;
       if (this->hash_spgemm and symbolic) {
         this->sparse_data_counter = make_unique<vector<INDEX_TYPE>>(len,0);
         this->sparse_data_collector = make_unique<vector<vector<Tuple<VALUE_TYPE>>>>(len, vector<Tuple<VALUE_TYPE>>());
       }else {
-        this->dense_collector = make_unique<vector<vector<VALUE_TYPE>>>(len,vector<VALUE_TYPE>(dimension,0));
+        if (this->dense_collector != nullptr) {
+          this->dense_collector->assign(len, dimension);
+        } else if (pool != nullptr) {
+          this->dense_collector = pool->acquire(len, dimension);
+        } else {
+          this->dense_collector = make_unique<DenseCollector<VALUE_TYPE>>(len, dimension);
+        }
       }
     }
   }
   void initialize_hashtables() {
-    auto len = row_end_index - row_starting_index;
     if (this->hash_spgemm) {
-#pragma omp parallel for
-      for (auto i = 0; i < len; i++) {
-        auto count = (*this->sparse_data_counter)[i];
-        auto resize_count = pow(2, log2(count) + 1);
-        (*this->sparse_data_collector)[i].clear();
-        Tuple<VALUE_TYPE> t;
-        t.row = i;
-        t.col = -1;
-        t.value = 0;
-        (*this->sparse_data_collector)[i].resize(resize_count, t);
-        (*this->sparse_data_counter)[i] = 0;
-      }
+      this->initialize_accumulators(dimension);
     }
   }
 
 
   void initialize_CSR_blocks() {
     if (this->hash_spgemm) {
-      this->initialize_CSR_from_sparse_collector();
+      this->initialize_CSR_from_sparse_collector(dimension);
     }else {
       auto len = row_end_index - row_starting_index;
       this->initialize_CSR_from_dense_collector(len,dimension);
@@ -123,8 +119,8 @@ public:
     if(count>0){
       new_handler.col_idx.resize(count);
       new_handler.values.resize(count);
-      copy(handle->col_idx.begin(),handle->col_idx.begin()+ count, new_handler.col_idx.begin());
-      copy(handle->values.begin(),handle->values.begin()+ count,new_handler.values.begin());
+      copy(handle->col_idx.begin()+handle->rowStart[local_key],handle->col_idx.begin()+handle->rowStart[local_key]+ count, new_handler.col_idx.begin());
+      copy(handle->values.begin()+handle->rowStart[local_key],handle->values.begin()+handle->rowStart[local_key]+ count,new_handler.values.begin());
     }
 
     return new_handler;
@@ -7,6 +7,7 @@
 #include "core/sparse_mat.hpp"
 #include "io/parrallel_IO.hpp"
 #include "net/data_comm.hpp"
+#include "net/plan_cache.hpp"
 #include "partition/partitioner.hpp"
 #include "core/json.hpp"
 #include <chrono>
@@ -21,6 +22,7 @@
 #include "algo/spgemm_with_tiling.hpp"
 #include "algo/sparse_embedding.hpp"
 #include "algo/multi_source_bfs.hpp"
+#include "algo/bitset_msbfs.hpp"
 #include "algo/baseline.hpp"
 #include "algo/baseline_spmm.hpp"
 
@@ -75,6 +77,27 @@ int main(int argc, char **argv) {
 
    bool msbfs=false;
 
+   string msbfs_engine = "bitset";
+
+   distblas::algo::BFSDirection bfs_direction = distblas::algo::BFSDirection::OPTIMIZING;
+
+   string msbfs_sources = "";
+
+   bool msbfs_parents = false;
+
+   string partition_cache = "";
+   string plan_cache = "";
+   bool write_partition_cache = false;
+
+   bool binary_output = false;
+
+   bool write_output = false;
+
+   string input_distribution = "fixed";
+
+   int rmat_scale = 0;
+   int edge_factor = 16;
+
   for (int p = 0; p < argc; p++) {
     if (strcmp(argv[p], "-input") == 0) {
       input_file = argv[p + 1];
@@ -115,6 +138,21 @@ int main(int argc, char **argv) {
     }else if (strcmp(argv[p], "-msbfs") == 0) {
       int res = atof(argv[p + 1]);
       msbfs = res == 1 ? true : false;
+    }else if (strcmp(argv[p], "-msbfs_engine") == 0) {
+      msbfs_engine = argv[p + 1];
+    }else if (strcmp(argv[p], "-msbfs_direction") == 0) {
+      if (strcmp(argv[p + 1], "top_down") == 0) {
+        bfs_direction = distblas::algo::BFSDirection::TOP_DOWN;
+      } else if (strcmp(argv[p + 1], "bottom_up") == 0) {
+        bfs_direction = distblas::algo::BFSDirection::BOTTOM_UP;
+      } else {
+        bfs_direction = distblas::algo::BFSDirection::OPTIMIZING;
+      }
+    }else if (strcmp(argv[p], "-msbfs_sources") == 0) {
+      msbfs_sources = argv[p + 1];
+    }else if (strcmp(argv[p], "-msbfs_parents") == 0) {
+      int res = atoi(argv[p + 1]);
+      msbfs_parents = res == 1 ? true : false;
     }else if (strcmp(argv[p], "-density") == 0) {
       density = atof(argv[p + 1]);
     }else if (strcmp(argv[p], "-save_results") == 0) {
@@ -129,6 +167,35 @@ int main(int argc, char **argv) {
     }else if (strcmp(argv[p], "-enable_remote") == 0) {
       int res = atof(argv[p + 1]);
       enable_remote = res == 1 ? true : false;
+    }else if (strcmp(argv[p], "-partition_cache") == 0) {
+      partition_cache = argv[p + 1];
+    }else if (strcmp(argv[p], "-plan_cache") == 0) {
+      plan_cache = argv[p + 1];
+    }else if (strcmp(argv[p], "-write_partition_cache") == 0) {
+      int res = atoi(argv[p + 1]);
+      write_partition_cache = res == 1 ? true : false;
+    }else if (strcmp(argv[p], "-binary_output") == 0) {
+      int res = atoi(argv[p + 1]);
+      binary_output = res == 1 ? true : false;
+    }else if (strcmp(argv[p], "-rmat_scale") == 0) {
+      rmat_scale = atoi(argv[p + 1]);
+    }else if (strcmp(argv[p], "-edge_factor") == 0) {
+      edge_factor = atoi(argv[p + 1]);
+    }else if (strcmp(argv[p], "-input_distribution") == 0) {
+      input_distribution = argv[p + 1];
+    }else if (strcmp(argv[p], "-write_output") == 0) {
+      int res = atoi(argv[p + 1]);
+      write_output = res == 1 ? true : false;
+    }else if (strcmp(argv[p], "-varint_cols") == 0) {
+      int res = atoi(argv[p + 1]);
+      distblas::net::SparseMessageEncoding::varint_cols = res == 1 ? true : false;
+    }else if (strcmp(argv[p], "-float_values") == 0) {
+      int res = atoi(argv[p + 1]);
+      distblas::net::SparseMessageEncoding::float_values = res == 1 ? true : false;
+    }else if (strcmp(argv[p], "-local_engine") == 0) {
+      distblas::core::MKLBlockEngine::enabled = strcmp(argv[p + 1], "mkl") == 0;
+    }else if (strcmp(argv[p], "-spgemm_nnz") == 0) {
+      distblas::core::DistributedMat::estimate_nnz = strcmp(argv[p + 1], "symbolic") != 0;
     }
   }
 
@@ -145,11 +212,7 @@ int main(int argc, char **argv) {
 
 
   // Initialize MPI DataTypes
-  if (!(spgemm or sparse_embedding)) {
-    initialize_mpi_datatypes<VALUE_TYPE, dimension>();
-  }else{
-    initialize_mpi_datatypes<VALUE_TYPE, sp_tuple_max_dim>();
-  }
+  initialize_mpi_datatypes<VALUE_TYPE, dimension>();
 
 
 //  // Creating reader
@@ -161,14 +224,25 @@ int main(int argc, char **argv) {
   auto shared_sparseMat =
       shared_ptr<distblas::core::SpMat<VALUE_TYPE>>(new distblas::core::SpMat<VALUE_TYPE>(grid.get()));
 
-  cout << " rank " << rank << " reading data from file path:  " << input_file<< endl;
+  // A partition cache holds the partitioned CSR blocks of a previous run
+  // with the same number of processes.
+  bool load_partition_cache = !partition_cache.empty() and !write_partition_cache;
 
   auto start_io = std::chrono::high_resolution_clock::now();
 
-  reader.get()->parallel_read_MM<int64_t,int,VALUE_TYPE>(input_file, shared_sparseMat.get(),true);
+  if (load_partition_cache) {
+    cout << " rank " << rank << " loading partition cache:  " << partition_cache<< endl;
+    reader.get()->parallel_read_partition_cache<VALUE_TYPE>(partition_cache + "_native.bin", shared_sparseMat.get(), grid.get());
+  } else if (rmat_scale > 0) {
+    cout << " rank " << rank << " generating R-MAT graph of scale " << rmat_scale<< endl;
+    reader.get()->generate_rmat_graph<VALUE_TYPE>(rmat_scale, edge_factor, 1, shared_sparseMat.get(), true);
+  } else {
+    cout << " rank " << rank << " reading data from file path:  " << input_file<< endl;
+    reader.get()->parallel_read_MM<int64_t,int,VALUE_TYPE>(input_file, shared_sparseMat.get(),true);
+    cout << " rank " << rank << " reading data from file path:  " << input_file<< " completed " << endl;
+  }
 
   cout << " rank " << rank << " gROWs  " << shared_sparseMat.get()->gRows<< "gCols" << shared_sparseMat.get()->gCols << endl;
-  cout << " rank " << rank << " reading data from file path:  " << input_file<< " completed " << endl;
 
 
 
@@ -184,6 +258,13 @@ int main(int argc, char **argv) {
       batch_size = localARows*tile_height_fraction;
     }
 
+  if (!plan_cache.empty()) {
+    string input_source = load_partition_cache ? partition_cache + "_native.bin"
+                          : rmat_scale > 0 ? "rmat_" + to_string(rmat_scale) + "_" + to_string(edge_factor)
+                                           : input_file;
+    PlanCache::configure(plan_cache, input_source, batch_size, alpha, tile_width_fraction, world_size);
+  }
+
   shared_sparseMat.get()->batch_size = batch_size;
   shared_sparseMat.get()->proc_row_width = localARows;
   shared_sparseMat.get()->proc_col_width = localBRows;
@@ -199,6 +280,12 @@ int main(int argc, char **argv) {
                                                                                   shared_sparseMat.get()->gCols, shared_sparseMat.get()->gNNz, batch_size,
                                                                                   localARows, localBRows, true, false);
 
+  if (load_partition_cache) {
+    reader.get()->parallel_read_partition_cache<VALUE_TYPE>(partition_cache + "_sender.bin", shared_sparseMat_sender.get(), grid.get());
+    reader.get()->parallel_read_partition_cache<VALUE_TYPE>(partition_cache + "_receiver.bin", shared_sparseMat_receiver.get(), grid.get());
+    cout << " rank " << rank << " loading partition cache:  " << partition_cache<< " completed " << endl;
+  }
+
 
 
   cout << " rank " << rank << " localBRows  " << localBRows << " localARows "<< localARows << endl;
@@ -211,6 +298,12 @@ int main(int argc, char **argv) {
                                        local_cols,static_cast<int>(dimension), density, 0,sparse_coo,
                                        output_file+"/sparse_local.txt",grid.get(),false);
     cout<<" rank "<<grid->rank_in_col<<" nnz "<<sparse_coo.size()<<endl;
+  } else if (spgemm and sparse_data_file.empty()) {
+    // second operand is generated in memory, its CSR block is ready to use
+    reader->build_sparse_random_csr<VALUE_TYPE>(sparse_input.get(), localARows, shared_sparseMat.get()->gRows,
+                                                static_cast<INDEX_TYPE>(dimension), density, 0,
+                                                input_distribution, grid.get());
+    sparse_input.get()->batch_size = batch_size;
   } else if (spgemm) {
     reader.get()->parallel_read_MM<int64_t,VALUE_TYPE,VALUE_TYPE>(sparse_data_file, sparse_input.get(),false,true);
     sparse_input.get()->batch_size = batch_size;
@@ -218,7 +311,7 @@ int main(int argc, char **argv) {
     sparse_input.get()->proc_col_width = static_cast<int>(dimension);
   }
 
-  if (!save_results) {
+  if (!save_results and !load_partition_cache) {
     auto end_io = std::chrono::high_resolution_clock::now();
 
     auto partitioner = unique_ptr<GlobalAdjacency1DPartitioner>(
@@ -226,19 +319,28 @@ int main(int argc, char **argv) {
 
     cout << " rank " << rank << " partitioning data started  " << endl;
 
+    // the reader and the R-MAT generator already put every tuple on the
+    // process owning its row, only the column partitioned sender moves
     partitioner.get()->partition_data<VALUE_TYPE>(
         shared_sparseMat_sender.get());
-    partitioner.get()->partition_data<VALUE_TYPE>(
-        shared_sparseMat_receiver.get());
-    partitioner.get()->partition_data<VALUE_TYPE>(shared_sparseMat.get());
 
     cout << " rank " << rank << " partitioning data completed  " << endl;
 
     shared_sparseMat.get()->initialize_CSR_blocks(true);
     shared_sparseMat_sender.get()->initialize_CSR_blocks(true);
     shared_sparseMat_receiver.get()->initialize_CSR_blocks(true);
+
+    if (write_partition_cache) {
+      cout << " rank " << rank << " writing partition cache:  " << partition_cache<< endl;
+      reader.get()->parallel_write_partition_cache<VALUE_TYPE>(partition_cache + "_native.bin", shared_sparseMat.get(), grid.get());
+      reader.get()->parallel_write_partition_cache<VALUE_TYPE>(partition_cache + "_sender.bin", shared_sparseMat_sender.get(), grid.get());
+      reader.get()->parallel_write_partition_cache<VALUE_TYPE>(partition_cache + "_receiver.bin", shared_sparseMat_receiver.get(), grid.get());
+      cout << " rank " << rank << " writing partition cache:  " << partition_cache<< " completed " << endl;
+      MPI_Finalize();
+      return 0;
+    }
   }
-  if (spgemm and !save_results){
+  if (spgemm and !save_results and !sparse_data_file.empty()){
     cout << " rank " << rank << " input gROWs  " << sparse_input.get()->gRows<< "input gCols" << sparse_input.get()->gCols << endl;
     cout << " rank " << rank << " input partitioning started   " << endl;
 //    partitioner.get()->partition_data<VALUE_TYPE>(sparse_input.get());
@@ -297,9 +399,35 @@ int main(int argc, char **argv) {
     cout << " rank " << rank << " spgemm baseline algo started  " << endl;
     perf_stats =  spgemm_algo.get()->execute(iterations, batch_size,lr,enable_remote);
     cout << " rank " << rank << " spgemm baseline algo completed  " << endl;
-//    output_sparsity = (sparse_out->csr_local_data)->handler->rowStart[(sparse_out->csr_local_data)->handler->rowStart.size()-1];
-//    output_sparsity = 100*(output_sparsity/(((sparse_out->csr_local_data)->handler->rowStart.size()-1)*dimension));
-//    reader->parallel_write_csr<double>(output_file+"/sparse_embedding.txt",(sparse_out->csr_local_data)->handler.get(),grid.get(), localARows,shared_sparseMat.get()->gRows,dimension);
+    if (write_output and spgemm_algo->output != nullptr) {
+      auto sparse_out = spgemm_algo->output;
+      if (binary_output) {
+        reader->parallel_write_csr_binary<VALUE_TYPE>(output_file+"/spgemm_output.csr",(sparse_out->csr_local_data)->handler.get(),grid.get(), localARows,shared_sparseMat.get()->gRows,dimension);
+      } else {
+        reader->parallel_write_csr<VALUE_TYPE>(output_file+"/spgemm_output.mtx",(sparse_out->csr_local_data)->handler.get(),grid.get(), localARows,shared_sparseMat.get()->gRows,dimension);
+      }
+    }
+
+  }else if (msbfs and !save_results and msbfs_engine == "bitset"){
+    vector<INDEX_TYPE> sources;
+    if (!msbfs_sources.empty()) {
+      sources = reader->read_vertex_list(msbfs_sources, shared_sparseMat.get()->gRows, grid.get());
+    }
+    auto bfs_algo = make_unique<distblas::algo::BitsetMSBFS<INDEX_TYPE, VALUE_TYPE, dimension>>(
+        shared_sparseMat.get(), shared_sparseMat_receiver.get(), sparse_input.get(), grid.get(), bfs_direction,
+        14, 24, write_output, write_output and msbfs_parents, sources);
+    MPI_Barrier(MPI_COMM_WORLD);
+    cout << " rank " << rank << " msbfs algo started  " << endl;
+    perf_stats = bfs_algo->execute(iterations);
+    cout << " rank " << rank << " msbfs algo completed  " << endl;
+    if (write_output) {
+      reader->parallel_write_npy(output_file + "/bfs_levels.npy", bfs_algo->levels.data(),
+                                 bfs_algo->local_rows(), bfs_algo->sources(), shared_sparseMat.get()->gRows, grid.get());
+      if (msbfs_parents) {
+        reader->parallel_write_npy(output_file + "/bfs_parents.npy", bfs_algo->parents.data(),
+                                   bfs_algo->local_rows(), bfs_algo->sources(), shared_sparseMat.get()->gRows, grid.get());
+      }
+    }
 
   }else if (msbfs and !save_results){
     bool has_spgemm =dimension>spa_threshold?true:false;
@@ -325,8 +453,20 @@ int main(int argc, char **argv) {
                 alpha, beta,col_major,sync_comm, tile_width_fraction,has_spgemm));
     spgemm_algo.get()->algo_sparse_embedding(iterations, batch_size,ns,lr,density,enable_remote);
     perf_stats = json_perf_statistics();
-    reader->parallel_write(output_file+"/embedding.txt",sparse_out.get()->dense_collector.get(),
-                           localARows, dimension, grid.get(),shared_sparseMat.get());
+    if (binary_output) {
+      reader->parallel_write_npy(output_file+"/embedding.npy",sparse_out.get()->dense_collector.get(),
+                                 localARows, dimension, grid.get(),shared_sparseMat.get());
+    } else {
+      reader->parallel_write(output_file+"/embedding.txt",sparse_out.get()->dense_collector.get(),
+                             localARows, dimension, grid.get(),shared_sparseMat.get());
+    }
+    if (write_output) {
+      if (binary_output) {
+        reader->parallel_write_csr_binary<VALUE_TYPE>(output_file+"/sparse_embedding.csr",(sparse_out->csr_local_data)->handler.get(),grid.get(), localARows,shared_sparseMat.get()->gRows,dimension);
+      } else {
+        reader->parallel_write_csr<VALUE_TYPE>(output_file+"/sparse_embedding.mtx",(sparse_out->csr_local_data)->handler.get(),grid.get(), localARows,shared_sparseMat.get()->gRows,dimension);
+      }
+    }
   } else if (!save_results) {
     auto dense_mat = shared_ptr<DenseMat<INDEX_TYPE, VALUE_TYPE, dimension>>(
         new DenseMat<INDEX_TYPE, VALUE_TYPE, dimension>(grid.get(), localARows));
@@ -343,7 +483,11 @@ int main(int argc, char **argv) {
     cout << " rank " << rank << " embedding algo started  " << endl;
     embedding_algo.get()->algo_force2_vec_ns(iterations, batch_size, ns, lr);
     perf_stats = json_perf_statistics();
-    reader->parallel_write(output_file+"/embedding.txt",dense_mat.get()->nCoordinates,localARows, dimension, grid.get(),shared_sparseMat.get());
+    if (binary_output) {
+      reader->parallel_write_npy(output_file+"/embedding.npy",dense_mat.get()->nCoordinates,localARows, dimension, grid.get(),shared_sparseMat.get());
+    } else {
+      reader->parallel_write(output_file+"/embedding.txt",dense_mat.get()->nCoordinates,localARows, dimension, grid.get(),shared_sparseMat.get());
+    }
   }
   cout << " rank " << rank << " algo completed  " << endl;
 //
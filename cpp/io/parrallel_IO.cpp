@@ -1,9 +1,8 @@
 /**
- * This implementation contains the CombBLAS based parallel IO Implementation.
+ * This implementation contains the MPI-IO based parallel IO Implementation.
  */
 
 #include "parrallel_IO.hpp"
-using namespace combblas;
 using namespace distblas::io;
 
 
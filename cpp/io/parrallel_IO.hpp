@@ -2,30 +2,537 @@
 #include "../core/dense_mat.hpp"
 #include "../core/sparse_mat.hpp"
 #include "../net/process_3D_grid.hpp"
-#include "CombBLAS/CombBLAS.h"
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
 #include <mpi.h>
+#include <numeric>
+#include <omp.h>
+#include <parallel/algorithm>
+#include <sstream>
+#include <stdexcept>
 #include <string>
+#include <type_traits>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <vector>
 
 using namespace std;
 using namespace distblas::core;
-using namespace combblas;
 namespace distblas::io {
 
 // typedef SpParMat<int64_t , double , SpDCCols<int64_t, double>>
 // PSpMat_s32p64_Int;
 
+const uint64_t PARTITION_CACHE_MAGIC = 0x4853434d42454444; // "DDEBMCSH"
+const uint64_t PARTITION_CACHE_VERSION = 1;
+
+// Graph500 R-MAT quadrant probabilities
+const double RMAT_A = 0.57;
+const double RMAT_B = 0.19;
+const double RMAT_C = 0.19;
+const double RMAT_D = 0.05;
+
+const uint64_t CSR_FILE_MAGIC = 0x3152534354534944; // "DISTCSR1"
+
+/**
+ * Header of a binary CSR output file written by parallel_write_csr_binary.
+ */
+struct CSRFileHeader {
+  uint64_t magic;
+  uint64_t rows, cols, nnz;
+  uint64_t index_bytes, value_bytes;
+};
+
+/**
+ * Global header of a partition cache file. It is followed by one
+ * PartitionCacheBlock per process and then by the CSR blocks themselves.
+ */
+struct PartitionCacheHeader {
+  uint64_t magic;
+  uint64_t version;
+  uint64_t world_size;
+  uint64_t gRows, gCols, gNNz;
+  uint64_t proc_row_width, proc_col_width;
+  uint64_t transpose, col_partitioned;
+  uint64_t index_bytes, value_bytes;
+};
+
+/**
+ * Location and shape of the CSR block owned by a single process.
+ * The block is laid out as rowStart[rows+1], col_idx[nnz], values[nnz].
+ */
+struct PartitionCacheBlock {
+  uint64_t offset;
+  uint64_t rows, cols, nnz;
+};
+
 /**
  * This class implements IO operations of DistBlas library.
  */
 class ParallelIO {
 private:
+  // Opens file_path for collective writing, truncating an existing file.
+  void open_for_write(string file_path, Process3DGrid *grid, MPI_File *fh) {
+    if (grid->rank_in_col == 0) {
+      MPI_File_delete(file_path.c_str(), MPI_INFO_NULL);
+    }
+    MPI_Barrier(grid->col_world);
+    MPI_File_open(grid->col_world, file_path.c_str(),
+                  MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, fh);
+  }
+
+  // Number of rows actually owned by this process, the last processes may
+  // hold less than proc_row_width rows.
+  template <typename VALUE_TYPE>
+  INDEX_TYPE get_expected_rows(INDEX_TYPE rows, Process3DGrid *grid,
+                               distblas::core::SpMat<VALUE_TYPE> *sp_mat) {
+    return get_expected_rows_from_global(rows, sp_mat->gRows, grid);
+  }
+
+  // Local CSR blocks are proc_row_width tall, rows past global_rows on the
+  // last processes are padding and are not written.
+  INDEX_TYPE get_expected_csr_rows(CSRHandle *handle, Process3DGrid *grid,
+                                   INDEX_TYPE local_rows,
+                                   INDEX_TYPE global_rows) {
+    int64_t remaining = static_cast<int64_t>(global_rows) -
+                        static_cast<int64_t>(local_rows) * grid->rank_in_col;
+    int64_t available = static_cast<int64_t>(handle->rowStart.size()) - 1;
+    return static_cast<INDEX_TYPE>(max(
+        static_cast<int64_t>(0), min(available, remaining)));
+  }
+
+  INDEX_TYPE get_expected_rows_from_global(INDEX_TYPE rows,
+                                          INDEX_TYPE global_rows,
+                                          Process3DGrid *grid) {
+    int64_t remaining = static_cast<int64_t>(global_rows) -
+                        static_cast<int64_t>(rows) * grid->rank_in_col;
+    return static_cast<INDEX_TYPE>(max(
+        static_cast<int64_t>(0), min(static_cast<int64_t>(rows), remaining)));
+  }
+
+  // Bijection on [0, 2^scale) (odd multiply and xorshift rounds) that breaks
+  // the locality of high degree R-MAT vertices.
+  INDEX_TYPE scramble_vertex(INDEX_TYPE v, int scale, uint64_t seed) {
+    if (scale == 0) {
+      return v;
+    }
+    INDEX_TYPE mask = (static_cast<INDEX_TYPE>(1) << scale) - 1;
+    uint64_t salt = counter_random(seed, 0x5CA7);
+    for (int round = 0; round < 2; round++) {
+      v = (v * 0x9E3779B97F4A7C15ULL + salt) & mask;
+      v ^= v >> (scale / 2 + 1);
+    }
+    return v & mask;
+  }
+
+  int ceil_log2(INDEX_TYPE value) {
+    int bits = 0;
+    while ((static_cast<INDEX_TYPE>(1) << bits) < value) {
+      bits++;
+    }
+    return bits;
+  }
+
+  /**
+   * Builds CSR arrays from a row generator. Threads generate contiguous row
+   * blocks into their own buffers, which are stitched together after a
+   * prefix sum over the row counts. The generator receives a zeroed scratch
+   * array of scratch_size bytes and must leave it zeroed.
+   */
+  template <typename ROW_GENERATOR>
+  void build_csr_from_rows(INDEX_TYPE rows, vector<MKL_INT> &rowStart,
+                           vector<MKL_INT> &col_idx, vector<double> &values,
+                           ROW_GENERATOR generate_row,
+                           INDEX_TYPE scratch_size) {
+    rowStart.assign(rows + 1, 0);
+    int max_threads = omp_get_max_threads();
+    vector<vector<MKL_INT>> thread_cols(max_threads);
+    vector<vector<double>> thread_values(max_threads);
+    vector<INDEX_TYPE> thread_first_row(max_threads + 1, rows);
+#pragma omp parallel
+    {
+      int tid = omp_get_thread_num();
+      int threads = omp_get_num_threads();
+      INDEX_TYPE begin = rows * tid / threads;
+      INDEX_TYPE end = rows * (tid + 1) / threads;
+      thread_first_row[tid] = begin;
+      vector<char> scratch(scratch_size, 0);
+      vector<MKL_INT> row_cols;
+      vector<double> row_values;
+      for (INDEX_TYPE i = begin; i < end; i++) {
+        row_cols.clear();
+        row_values.clear();
+        generate_row(i, row_cols, row_values, scratch);
+        rowStart[i + 1] = row_cols.size();
+        thread_cols[tid].insert(thread_cols[tid].end(), row_cols.begin(),
+                                row_cols.end());
+        thread_values[tid].insert(thread_values[tid].end(), row_values.begin(),
+                                  row_values.end());
+      }
+    }
+    for (INDEX_TYPE i = 0; i < rows; i++) {
+      rowStart[i + 1] += rowStart[i];
+    }
+    col_idx.resize(rowStart[rows]);
+    values.resize(rowStart[rows]);
+#pragma omp parallel for
+    for (int t = 0; t < max_threads; t++) {
+      if (!thread_cols[t].empty()) {
+        auto offset = rowStart[thread_first_row[t]];
+        std::copy(thread_cols[t].begin(), thread_cols[t].end(),
+                  col_idx.begin() + offset);
+        std::copy(thread_values[t].begin(), thread_values[t].end(),
+                  values.begin() + offset);
+      }
+    }
+  }
+
+  void append_integer(vector<char> &out, uint64_t value) {
+    char buf[24];
+    auto res = std::to_chars(buf, buf + sizeof(buf), value);
+    out.insert(out.end(), buf, res.ptr);
+  }
+
+  // Same representation as "%.5f".
+  template <typename VALUE_TYPE>
+  void append_fixed(vector<char> &out, VALUE_TYPE value) {
+    char buf[400];
+    auto res = std::to_chars(buf, buf + sizeof(buf), value,
+                             std::chars_format::fixed, 5);
+    out.insert(out.end(), buf, res.ptr);
+  }
+
+  /**
+   * Formats local rows in parallel, every thread appending a contiguous
+   * block of rows to its own buffer. Offsets of processes are computed with
+   * a single MPI_Exscan and the rank's bytes are written with one collective
+   * call. The header is written by the first process only.
+   */
+  template <typename ROW_FORMATTER>
+  void parallel_write_text(string file_path, INDEX_TYPE rows, string header,
+                           Process3DGrid *grid, ROW_FORMATTER format_row) {
+    int max_threads = omp_get_max_threads();
+    vector<vector<char>> chunks(max_threads);
+#pragma omp parallel
+    {
+      int tid = omp_get_thread_num();
+      int threads = omp_get_num_threads();
+      INDEX_TYPE begin = rows * tid / threads;
+      INDEX_TYPE end = rows * (tid + 1) / threads;
+      for (INDEX_TYPE i = begin; i < end; i++) {
+        format_row(i, chunks[tid]);
+      }
+    }
+
+    vector<uint64_t> chunk_offsets(max_threads + 1, 0);
+    chunk_offsets[0] = (grid->rank_in_col == 0) ? header.size() : 0;
+    for (int t = 0; t < max_threads; t++) {
+      chunk_offsets[t + 1] = chunk_offsets[t] + chunks[t].size();
+    }
+    uint64_t local_bytes = chunk_offsets[max_threads];
+    vector<char> buffer(local_bytes);
+    if (grid->rank_in_col == 0) {
+      std::copy(header.begin(), header.end(), buffer.begin());
+    }
+#pragma omp parallel for
+    for (int t = 0; t < max_threads; t++) {
+      std::copy(chunks[t].begin(), chunks[t].end(),
+                buffer.begin() + chunk_offsets[t]);
+      vector<char>().swap(chunks[t]);
+    }
+
+    uint64_t offset = 0;
+    MPI_Exscan(&local_bytes, &offset, 1, MPI_UINT64_T, MPI_SUM,
+               grid->col_world);
+    if (grid->rank_in_col == 0) {
+      offset = 0;
+    }
+
+    MPI_File fh;
+    open_for_write(file_path, grid, &fh);
+    write_at_all_chunked(fh, offset, buffer.data(), local_bytes,
+                         grid->col_world);
+    MPI_File_close(&fh);
+  }
+
+  template <typename T> string npy_descr() {
+    char kind = std::is_floating_point<T>::value ? 'f'
+                : std::is_signed<T>::value       ? 'i'
+                                                 : 'u';
+    return string("<") + kind + to_string(sizeof(T));
+  }
+
+  // Version 1.0 .npy header, padded so that the data starts 64 byte aligned.
+  template <typename T>
+  string npy_header(uint64_t rows, uint64_t cols) {
+    string dict = "{'descr': '" + npy_descr<T>() +
+                  "', 'fortran_order': False, 'shape': (" + to_string(rows) +
+                  ", " + to_string(cols) + "), }";
+    uint64_t unpadded = 10 + dict.size() + 1;
+    dict.append((64 - unpadded % 64) % 64, ' ');
+    dict.push_back('\n');
+    uint16_t dict_len = dict.size();
+    string header = "\x93NUMPY";
+    header.push_back(1);
+    header.push_back(0);
+    header.push_back(static_cast<char>(dict_len & 0xff));
+    header.push_back(static_cast<char>(dict_len >> 8));
+    return header + dict;
+  }
+
+  /**
+   * Writes local rows of a row-major matrix into a shared .npy file. Every
+   * process writes its rows with one collective call at an offset obtained
+   * with MPI_Exscan.
+   */
+  template <typename T, typename ROW_ACCESSOR>
+  void parallel_write_binary_rows(string file_path, INDEX_TYPE rows,
+                                  uint64_t cols, Process3DGrid *grid,
+                                  ROW_ACCESSOR row_at) {
+    uint64_t local_rows = rows;
+    uint64_t preceding_rows = 0, total_rows = 0;
+    MPI_Exscan(&local_rows, &preceding_rows, 1, MPI_UINT64_T, MPI_SUM,
+               grid->col_world);
+    MPI_Allreduce(&local_rows, &total_rows, 1, MPI_UINT64_T, MPI_SUM,
+                  grid->col_world);
+    if (grid->rank_in_col == 0) {
+      preceding_rows = 0;
+    }
+
+    vector<T> buffer(local_rows * cols);
+#pragma omp parallel for
+    for (INDEX_TYPE i = 0; i < rows; i++) {
+      const T *row = row_at(i);
+      std::copy(row, row + cols, buffer.begin() + i * cols);
+    }
+
+    string header = npy_header<T>(total_rows, cols);
+    MPI_File fh;
+    open_for_write(file_path, grid, &fh);
+    if (grid->rank_in_col == 0) {
+      MPI_File_write_at(fh, 0, header.data(), header.size(), MPI_BYTE,
+                        MPI_STATUS_IGNORE);
+    }
+    write_at_all_chunked(fh, header.size() + preceding_rows * cols * sizeof(T),
+                         buffer.data(), buffer.size() * sizeof(T),
+                         grid->col_world);
+    MPI_File_close(&fh);
+  }
+
+  // MPI counts are int, so large buffers are written in bounded chunks. Every
+  // process issues the same number of collective calls.
+  void write_at_all_chunked(MPI_File fh, MPI_Offset offset, const void *data,
+                            uint64_t bytes, MPI_Comm comm) {
+    const uint64_t max_chunk = 1 << 30;
+    uint64_t local_chunks = (bytes + max_chunk - 1) / max_chunk;
+    uint64_t chunks;
+    MPI_Allreduce(&local_chunks, &chunks, 1, MPI_UINT64_T, MPI_MAX, comm);
+    const char *ptr = static_cast<const char *>(data);
+    for (uint64_t c = 0; c < chunks; c++) {
+      uint64_t begin = min(c * max_chunk, bytes);
+      uint64_t count = min(max_chunk, bytes - begin);
+      MPI_File_write_at_all(fh, offset + begin, ptr + begin,
+                            static_cast<int>(count), MPI_BYTE,
+                            MPI_STATUS_IGNORE);
+    }
+  }
+
+  struct MatrixFileHeader {
+    uint64_t data_offset = 0;
+    uint64_t rows = 0, cols = 0, nnz = 0;
+    int is_matrix_market = 0;
+    int pattern = 0;
+    int symmetric = 0;
+    int skew_symmetric = 0;
+  };
+
+  // Returns the first line start at or after pos. pos itself is a line start
+  // if it is the beginning of the data or follows a newline.
+  uint64_t align_to_line(const vector<char> &buffer, uint64_t pos,
+                         bool is_data_start) {
+    if (is_data_start or pos == 0) {
+      return pos;
+    }
+    const char *found = static_cast<const char *>(
+        memchr(buffer.data() + pos - 1, '\n', buffer.size() - pos + 1));
+    return (found == nullptr) ? buffer.size() : (found - buffer.data()) + 1;
+  }
+
+  // Parses "row col [value]" ignoring blank and comment lines.
+  template <typename WEIGHT_VALUE>
+  bool parse_line(const char *ptr, const char *end, int64_t &row, int64_t &col,
+                  WEIGHT_VALUE &value, bool has_value) {
+    auto skip_space = [&]() {
+      while (ptr < end and (*ptr == ' ' or *ptr == '\t' or *ptr == '\r' or *ptr == ',')) {
+        ptr++;
+      }
+    };
+    skip_space();
+    if (ptr == end or *ptr == '%' or *ptr == '#') {
+      return false;
+    }
+    auto res = std::from_chars(ptr, end, row);
+    if (res.ec != std::errc()) {
+      return false;
+    }
+    ptr = res.ptr;
+    skip_space();
+    res = std::from_chars(ptr, end, col);
+    if (res.ec != std::errc()) {
+      return false;
+    }
+    ptr = res.ptr;
+    skip_space();
+    value = 1;
+    if (has_value and ptr < end) {
+      if (*ptr == '+') {
+        ptr++;
+      }
+      std::from_chars(ptr, end, value);
+    }
+    return true;
+  }
+
+  // Reads the Matrix Market banner and size line. Files without a banner are
+  // treated as edge lists.
+  MatrixFileHeader read_header(ifstream &in, uint64_t file_size) {
+    MatrixFileHeader header;
+    string banner = "%%MatrixMarket";
+    string line;
+    in.seekg(0);
+    if (!getline(in, line) or line.compare(0, banner.size(), banner) != 0) {
+      return header;
+    }
+    header.is_matrix_market = 1;
+    std::transform(line.begin(), line.end(), line.begin(), ::tolower);
+    header.pattern = line.find("pattern") != string::npos;
+    header.skew_symmetric = line.find("skew-symmetric") != string::npos;
+    header.symmetric = header.skew_symmetric or
+                       line.find("symmetric") != string::npos or
+                       line.find("hermitian") != string::npos;
+    uint64_t pos = line.size() + 1;
+    bool size_line_found = false;
+    while (!size_line_found and getline(in, line)) {
+      pos += line.size() + 1;
+      if (!line.empty() and line[0] != '%' and
+          line.find_first_not_of(" \t\r") != string::npos) {
+        std::istringstream size_line(line);
+        size_line >> header.rows >> header.cols >> header.nnz;
+        size_line_found = true;
+      }
+    }
+    if (!size_line_found) {
+      throw std::runtime_error("invalid Matrix Market header");
+    }
+    header.data_offset = min(pos, file_size);
+    return header;
+  }
+
+  /**
+   * Returns the lines whose first character lies in [begin, end), each
+   * terminated by a newline. The line running into begin belongs to the
+   * previous range and is skipped unless begin is the start of the data.
+   * Lines are read with getline, so they may be of any length.
+   */
+  vector<char> read_line_range(ifstream &in, uint64_t begin, uint64_t end,
+                               bool is_data_start) {
+    vector<char> buffer;
+    string line;
+    in.clear();
+    uint64_t pos = begin;
+    if (is_data_start) {
+      in.seekg(begin);
+    } else {
+      in.seekg(begin - 1);
+      getline(in, line);
+      pos = begin + line.size();
+    }
+    while (pos < end and getline(in, line)) {
+      pos += line.size() + 1;
+      buffer.insert(buffer.end(), line.begin(), line.end());
+      buffer.push_back('\n');
+    }
+    return buffer;
+  }
+
+  /**
+   * Ships tuples to the process owning their row under the 1D row
+   * partitioning (proc_row_width = ceil(rows / processes)), then sorts and
+   * removes duplicates keeping the maximum value.
+   */
+  template <typename VALUE_TYPE>
+  void redistribute_by_row(vector<Tuple<VALUE_TYPE>> &coords, INDEX_TYPE rows,
+                           MPI_Comm comm) {
+    int world_size;
+    MPI_Comm_size(comm, &world_size);
+    INDEX_TYPE proc_row_width = divide_and_round_up(rows, world_size);
+
+    if (world_size > 1) {
+      vector<int> sendcounts(world_size, 0);
+      vector<int> recvcounts(world_size, 0);
+      vector<int> offsets, recvoffsets;
+#pragma omp parallel
+      {
+        vector<int> local_counts(world_size, 0);
+#pragma omp for nowait
+        for (INDEX_TYPE i = 0; i < coords.size(); i++) {
+          local_counts[coords[i].row / proc_row_width]++;
+        }
+        for (int p = 0; p < world_size; p++) {
+#pragma omp atomic update
+          sendcounts[p] += local_counts[p];
+        }
+      }
+      prefix_sum(sendcounts, offsets);
+      vector<int> bufindices = offsets;
+      vector<Tuple<VALUE_TYPE>> sendbuf(coords.size());
+#pragma omp parallel for
+      for (INDEX_TYPE i = 0; i < coords.size(); i++) {
+        int owner = coords[i].row / proc_row_width;
+        int idx;
+#pragma omp atomic capture
+        idx = bufindices[owner]++;
+        sendbuf[idx] = coords[i];
+      }
+      vector<Tuple<VALUE_TYPE>>().swap(coords);
+
+      MPI_Alltoall(sendcounts.data(), 1, MPI_INT, recvcounts.data(), 1,
+                   MPI_INT, comm);
+      prefix_sum(recvcounts, recvoffsets);
+      coords.resize(std::accumulate(recvcounts.begin(), recvcounts.end(), 0));
+      MPI_Alltoallv(sendbuf.data(), sendcounts.data(), offsets.data(), SPTUPLE,
+                    coords.data(), recvcounts.data(), recvoffsets.data(),
+                    SPTUPLE, comm);
+    }
+
+    __gnu_parallel::sort(coords.begin(), coords.end(), row_major<VALUE_TYPE>);
+    INDEX_TYPE unique_count = 0;
+    for (INDEX_TYPE i = 0; i < coords.size(); i++) {
+      if (unique_count > 0 and coords[unique_count - 1].row == coords[i].row and
+          coords[unique_count - 1].col == coords[i].col) {
+        coords[unique_count - 1].value =
+            max(coords[unique_count - 1].value, coords[i].value);
+      } else {
+        coords[unique_count++] = coords[i];
+      }
+    }
+    coords.resize(unique_count);
+  }
+
 public:
   ParallelIO();
   ~ParallelIO();
 
   /**
-   * Interface for parallel reading of Matrix Market formatted files
+   * Interface for parallel reading of Matrix Market formatted files and
+   * plain whitespace separated edge lists. Every process reads the lines
+   * starting in its byte range of the file, threads parse line aligned sub
+   * ranges with from_chars and the tuples are shipped to the process owning
+   * their row.
    * @param file_path
    */
   template <typename INDEX_TYPE, typename WEIGHT_VALUE, typename VALUE_TYPE>
@@ -39,169 +546,604 @@ public:
     MPI_Comm_rank(WORLD, &proc_rank);
     MPI_Comm_size(WORLD, &num_procs);
 
-    shared_ptr<CommGrid> simpleGrid;
-    simpleGrid.reset(new CommGrid(WORLD, num_procs, 1));
+    ifstream in(file_path, std::ios::binary);
+    if (!in) {
+      MPI_Comm_free(&WORLD);
+      throw std::runtime_error("cannot open input file " + file_path);
+    }
+    in.seekg(0, std::ios::end);
+    uint64_t file_size = in.tellg();
 
-    SpParMat<INDEX_TYPE, WEIGHT_VALUE, SpDCCols<INDEX_TYPE, WEIGHT_VALUE>> G(
-        simpleGrid);
-    //    unique_ptr<PSpMat_s32p64_Int> G =
-    //        unique_ptr<PSpMat_s32p64_Int>(new PSpMat_s32p64_Int(simpleGrid));
+    MatrixFileHeader header;
+    if (proc_rank == 0) {
+      header = read_header(in, file_size);
+    }
+    MPI_Bcast(&header, sizeof(MatrixFileHeader), MPI_BYTE, 0, WORLD);
 
-    INDEX_TYPE nnz;
+    // Lines are owned by the process whose byte range contains their first
+    // character, so every process finds its lines without communication.
+    uint64_t data_bytes = file_size - header.data_offset;
+    uint64_t begin = header.data_offset + data_bytes * proc_rank / num_procs;
+    uint64_t end = header.data_offset + data_bytes * (proc_rank + 1) / num_procs;
 
-    G.ParallelReadMM(file_path, true, maximum<WEIGHT_VALUE>());
+    vector<char> buffer =
+        read_line_range(in, begin, end, begin == header.data_offset);
+    in.close();
 
-    nnz = G.getnnz();
-    if (proc_rank == 0) {
-      cout << "File reader read " << nnz << " nonzeros." << endl;
+    uint64_t parse_begin = 0;
+    uint64_t parse_end = buffer.size();
+
+    int threads = 1;
+#pragma omp parallel
+    {
+#pragma omp single
+      threads = omp_get_num_threads();
+    }
+    vector<vector<Tuple<VALUE_TYPE>>> thread_coords(threads);
+    vector<int64_t> thread_max_id(threads, -1);
+
+#pragma omp parallel num_threads(threads)
+    {
+      int tid = omp_get_thread_num();
+      uint64_t span = parse_end - parse_begin;
+      uint64_t t_begin = align_to_line(buffer, parse_begin + span * tid / threads,
+                                       tid == 0);
+      uint64_t t_end = (tid == threads - 1)
+                           ? parse_end
+                           : align_to_line(buffer,
+                                           parse_begin + span * (tid + 1) / threads,
+                                           false);
+      vector<Tuple<VALUE_TYPE>> &local = thread_coords[tid];
+      int64_t max_id = -1;
+      const char *ptr = buffer.data() + t_begin;
+      const char *stop = buffer.data() + min(t_end, parse_end);
+      while (ptr < stop) {
+        const char *line_end =
+            static_cast<const char *>(memchr(ptr, '\n', stop - ptr));
+        if (line_end == nullptr) {
+          line_end = stop;
+        }
+        int64_t row, col;
+        WEIGHT_VALUE weight = 1;
+        if (parse_line(ptr, line_end, row, col, weight, header.pattern == 0)) {
+          if (header.is_matrix_market) {
+            row--;
+            col--;
+          }
+          Tuple<VALUE_TYPE> t;
+          t.row = row;
+          t.col = col;
+          t.value = static_cast<VALUE_TYPE>(weight);
+          local.push_back(t);
+          if (header.symmetric and row != col) {
+            t.row = col;
+            t.col = row;
+            t.value = static_cast<VALUE_TYPE>(
+                header.skew_symmetric ? -weight : weight);
+            local.push_back(t);
+          }
+          max_id = max(max_id, max(row, col));
+        }
+        ptr = line_end + 1;
+      }
+      thread_max_id[tid] = max_id;
     }
-    SpTuples<int64_t, WEIGHT_VALUE> tups(G.seq());
-    tuple<int64_t, int64_t, WEIGHT_VALUE> *values = tups.tuples;
+    vector<char>().swap(buffer);
 
-    vector<Tuple<VALUE_TYPE>> coords;
-    coords.resize(tups.getnnz());
+    vector<uint64_t> thread_offsets(threads + 1, 0);
+    for (int t = 0; t < threads; t++) {
+      thread_offsets[t + 1] = thread_offsets[t] + thread_coords[t].size();
+    }
+    vector<Tuple<VALUE_TYPE>> coords(thread_offsets[threads]);
+#pragma omp parallel num_threads(threads)
+    {
+      int tid = omp_get_thread_num();
+      std::copy(thread_coords[tid].begin(), thread_coords[tid].end(),
+                coords.begin() + thread_offsets[tid]);
+      vector<Tuple<VALUE_TYPE>>().swap(thread_coords[tid]);
+    }
+
+    if (!header.is_matrix_market) {
+      // Edge lists carry no dimensions, the largest vertex id defines them.
+      int64_t local_max = *std::max_element(thread_max_id.begin(), thread_max_id.end());
+      int64_t global_max;
+      MPI_Allreduce(&local_max, &global_max, 1, MPI_INT64_T, MPI_MAX, WORLD);
+      header.rows = global_max + 1;
+      header.cols = global_max + 1;
+    }
 
 #pragma omp parallel for
-    for (int i = 0; i < tups.getnnz(); i++) {
-      coords[i].row = get<0>(values[i]);
-      coords[i].col = get<1>(values[i]);
+    for (INDEX_TYPE i = 0; i < coords.size(); i++) {
       if (copy_col_to_value) {
-        coords[i].value = get<1>(values[i]);
-      }else if (boolean_input){
-        coords[i].value= 1;
-      }else {
-        coords[i].value = get<2>(values[i]);
+        coords[i].value = coords[i].col;
+      } else if (boolean_input) {
+        coords[i].value = 1;
       }
     }
 
-    int rowIncrement = G.getnrow() / num_procs;
+    redistribute_by_row(coords, header.rows, WORLD);
 
-#pragma omp parallel for
-    for (int i = 0; i < coords.size(); i++) {
-      coords[i].row += rowIncrement * proc_rank;
+    uint64_t local_nnz = coords.size();
+    uint64_t global_nnz;
+    MPI_Allreduce(&local_nnz, &global_nnz, 1, MPI_UINT64_T, MPI_SUM, WORLD);
+    if (proc_rank == 0) {
+      cout << "File reader read " << global_nnz << " nonzeros." << endl;
     }
 
-    sp_mat->coords = coords;
-    sp_mat->gRows = G.getnrow();
-    sp_mat->gCols = G.getncol();
-    sp_mat->gNNz = G.getnnz();
+    sp_mat->coords = std::move(coords);
+    sp_mat->gRows = header.rows;
+    sp_mat->gCols = header.cols;
+    sp_mat->gNNz = global_nnz;
+    MPI_Comm_free(&WORLD);
   }
 
+  /**
+   * Generates an undirected Graph500 style R-MAT (Kronecker) graph with
+   * 2^scale vertices and edge_factor * 2^scale edges. Every process
+   * generates an equal share of the edges in parallel with a counter based
+   * RNG, vertex ids are scrambled with a bijection and the tuples are
+   * shipped to the process owning their row, exactly like parallel_read_MM.
+   * Self loops are dropped and duplicate edges are merged.
+   */
   template <typename VALUE_TYPE>
-  void parallel_write(string file_path, VALUE_TYPE *nCoordinates,
-                      INDEX_TYPE rows, uint64_t cols, Process3DGrid *grid,
-                      distblas::core::SpMat<VALUE_TYPE> *sp_mat) {
-    MPI_File fh;
-    MPI_File_open(grid->col_world, file_path.c_str(),
-                  MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &fh);
+  void generate_rmat_graph(int scale, int edge_factor, uint64_t seed,
+                           distblas::core::SpMat<VALUE_TYPE> *sp_mat,
+                           bool copy_col_to_value) {
+    int proc_rank, num_procs;
+    MPI_Comm_rank(MPI_COMM_WORLD, &proc_rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &num_procs);
 
-    uint64_t expected_rows = rows;
-    if (grid->rank_in_col == grid->col_world_size - 1) {
-      auto expected_last_rows = sp_mat->gRows - rows * grid->rank_in_col;
-      cout << " expected rows " << expected_last_rows << endl;
-      expected_rows = min(expected_last_rows, rows);
-    }
+    INDEX_TYPE vertices = static_cast<INDEX_TYPE>(1) << scale;
+    INDEX_TYPE edges = vertices * edge_factor;
+    INDEX_TYPE begin = edges * proc_rank / num_procs;
+    INDEX_TYPE end = edges * (proc_rank + 1) / num_procs;
 
-    //    int offset= rows-expected_rows;
-    cout << " rank :" << grid->rank_in_col << " expected rows " << expected_rows
-         << endl;
-    size_t total_size = 0;
-    for (INDEX_TYPE i = 0; i < expected_rows; ++i) {
-      total_size +=
-          snprintf(nullptr, 0, "%lu", i + 1 + grid->rank_in_col * rows);
-      for (int j = 0; j < cols; ++j) {
-        total_size += snprintf(nullptr, 0, " %.5f", nCoordinates[i * cols + j]);
+    int max_threads = omp_get_max_threads();
+    vector<vector<Tuple<VALUE_TYPE>>> thread_coords(max_threads);
+#pragma omp parallel
+    {
+      int tid = omp_get_thread_num();
+      vector<Tuple<VALUE_TYPE>> &local = thread_coords[tid];
+#pragma omp for schedule(static)
+      for (INDEX_TYPE e = begin; e < end; e++) {
+        uint64_t edge_seed = counter_random(seed, e);
+        INDEX_TYPE u = 0, v = 0;
+        for (int l = 0; l < scale; l++) {
+          double r = counter_uniform(edge_seed, l);
+          bool row_bit = r >= RMAT_A + RMAT_B;
+          bool col_bit = (r >= RMAT_A and r < RMAT_A + RMAT_B) or
+                         r >= RMAT_A + RMAT_B + RMAT_C;
+          u = (u << 1) | row_bit;
+          v = (v << 1) | col_bit;
+        }
+        u = scramble_vertex(u, scale, seed);
+        v = scramble_vertex(v, scale, seed);
+        if (u == v) {
+          continue;
+        }
+        Tuple<VALUE_TYPE> t;
+        t.row = u;
+        t.col = v;
+        t.value = copy_col_to_value ? static_cast<VALUE_TYPE>(v) : 1;
+        local.push_back(t);
+        t.row = v;
+        t.col = u;
+        t.value = copy_col_to_value ? static_cast<VALUE_TYPE>(u) : 1;
+        local.push_back(t);
       }
-      total_size += snprintf(nullptr, 0, "\n");
     }
 
-    // Allocate memory dynamically
-    char *buffer =
-        (char *)malloc(total_size + 1); // +1 for the null-terminating character
-    if (buffer == nullptr) {
-      // Handle allocation failure
-      cout << "Memory allocation failed." << endl;
-      return;
+    vector<uint64_t> thread_offsets(max_threads + 1, 0);
+    for (int t = 0; t < max_threads; t++) {
+      thread_offsets[t + 1] = thread_offsets[t] + thread_coords[t].size();
+    }
+    vector<Tuple<VALUE_TYPE>> coords(thread_offsets[max_threads]);
+#pragma omp parallel for
+    for (int t = 0; t < max_threads; t++) {
+      std::copy(thread_coords[t].begin(), thread_coords[t].end(),
+                coords.begin() + thread_offsets[t]);
+      vector<Tuple<VALUE_TYPE>>().swap(thread_coords[t]);
     }
 
-    char *current_position = buffer;
+    redistribute_by_row(coords, vertices, MPI_COMM_WORLD);
 
-    for (INDEX_TYPE i = 0; i < expected_rows; ++i) {
-      current_position += snprintf(current_position, total_size, "%lu",
-                                   i + 1 + grid->rank_in_col * rows);
-      for (int j = 0; j < cols; ++j) {
-        current_position += snprintf(current_position, total_size, " %.5f",
-                                     nCoordinates[i * cols + j]);
-      }
-      current_position += snprintf(current_position, total_size, "\n");
+    uint64_t local_nnz = coords.size();
+    uint64_t global_nnz;
+    MPI_Allreduce(&local_nnz, &global_nnz, 1, MPI_UINT64_T, MPI_SUM,
+                  MPI_COMM_WORLD);
+    if (proc_rank == 0) {
+      cout << "R-MAT generator produced " << global_nnz << " nonzeros." << endl;
     }
 
-    MPI_File_write_ordered(fh, buffer, current_position - buffer, MPI_CHAR,
-                           MPI_STATUS_IGNORE);
+    sp_mat->coords = std::move(coords);
+    sp_mat->gRows = vertices;
+    sp_mat->gCols = vertices;
+    sp_mat->gNNz = global_nnz;
+  }
+
+  /**
+   * Writes the partitioned CSR block of every process into a single binary
+   * cache file. Runs with the same process count can load it back with
+   * parallel_read_partition_cache and skip reading, partitioning and CSR
+   * conversion.
+   * @param file_path cache file
+   * @param sp_mat partitioned matrix with an initialized CSR block
+   */
+  template <typename VALUE_TYPE>
+  void parallel_write_partition_cache(string file_path,
+                                      distblas::core::SpMat<VALUE_TYPE> *sp_mat,
+                                      Process3DGrid *grid) {
+    CSRLocal<VALUE_TYPE> *csr = sp_mat->csr_local_data.get();
+    CSRHandle *handle = csr->handler.get();
 
-    // Free the dynamically allocated memory
-    free(buffer);
+    PartitionCacheBlock block;
+    block.rows = handle->rowStart.size() - 1;
+    block.cols = csr->cols;
+    block.nnz = handle->rowStart[block.rows];
+    uint64_t index_bytes = (block.rows + 1 + block.nnz) * sizeof(MKL_INT);
+    uint64_t block_bytes = index_bytes + block.nnz * sizeof(double);
 
+    uint64_t data_start = sizeof(PartitionCacheHeader) +
+                          grid->col_world_size * sizeof(PartitionCacheBlock);
+    uint64_t preceding_bytes = 0;
+    MPI_Exscan(&block_bytes, &preceding_bytes, 1, MPI_UINT64_T, MPI_SUM,
+               grid->col_world);
+    if (grid->rank_in_col == 0) {
+      preceding_bytes = 0;
+    }
+    block.offset = data_start + preceding_bytes;
+
+    MPI_File fh;
+    open_for_write(file_path, grid, &fh);
+
+    if (grid->rank_in_col == 0) {
+      PartitionCacheHeader header;
+      header.magic = PARTITION_CACHE_MAGIC;
+      header.version = PARTITION_CACHE_VERSION;
+      header.world_size = grid->col_world_size;
+      header.gRows = sp_mat->gRows;
+      header.gCols = sp_mat->gCols;
+      header.gNNz = sp_mat->gNNz;
+      header.proc_row_width = sp_mat->proc_row_width;
+      header.proc_col_width = sp_mat->proc_col_width;
+      header.transpose = sp_mat->transpose;
+      header.col_partitioned = sp_mat->col_partitioned;
+      header.index_bytes = sizeof(MKL_INT);
+      header.value_bytes = sizeof(double);
+      MPI_File_write_at(fh, 0, &header, sizeof(PartitionCacheHeader), MPI_BYTE,
+                        MPI_STATUS_IGNORE);
+    }
+    MPI_File_write_at_all(
+        fh,
+        sizeof(PartitionCacheHeader) +
+            grid->rank_in_col * sizeof(PartitionCacheBlock),
+        &block, sizeof(PartitionCacheBlock), MPI_BYTE, MPI_STATUS_IGNORE);
+
+    write_at_all_chunked(fh, block.offset, handle->rowStart.data(),
+                         (block.rows + 1) * sizeof(MKL_INT), grid->col_world);
+    write_at_all_chunked(fh,
+                         block.offset + (block.rows + 1) * sizeof(MKL_INT),
+                         handle->col_idx.data(), block.nnz * sizeof(MKL_INT),
+                         grid->col_world);
+    write_at_all_chunked(fh, block.offset + index_bytes, handle->values.data(),
+                         block.nnz * sizeof(double), grid->col_world);
     MPI_File_close(&fh);
   }
 
+  /**
+   * Loads the CSR block of this process from a partition cache written by
+   * parallel_write_partition_cache. The file is memory mapped and only the
+   * block owned by this process is touched.
+   * @param file_path cache file
+   * @param sp_mat matrix to be filled with metadata and the CSR block
+   */
+  template <typename VALUE_TYPE>
+  void parallel_read_partition_cache(string file_path,
+                                     distblas::core::SpMat<VALUE_TYPE> *sp_mat,
+                                     Process3DGrid *grid) {
+    int fd = open(file_path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      throw std::runtime_error("cannot open partition cache " + file_path);
+    }
+    struct stat file_stat;
+    fstat(fd, &file_stat);
+    uint64_t file_size = file_stat.st_size;
+    if (file_size < sizeof(PartitionCacheHeader)) {
+      close(fd);
+      throw std::runtime_error("truncated partition cache " + file_path);
+    }
+    char *mapped = static_cast<char *>(
+        mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0));
+    close(fd);
+    if (mapped == MAP_FAILED) {
+      throw std::runtime_error("cannot map partition cache " + file_path);
+    }
+
+    PartitionCacheHeader header;
+    memcpy(&header, mapped, sizeof(PartitionCacheHeader));
+    if (header.magic != PARTITION_CACHE_MAGIC or
+        header.version != PARTITION_CACHE_VERSION or
+        header.index_bytes != sizeof(MKL_INT) or
+        header.value_bytes != sizeof(double) or
+        header.world_size != static_cast<uint64_t>(grid->col_world_size)) {
+      munmap(mapped, file_size);
+      throw std::runtime_error("partition cache " + file_path +
+                               " was not written for this configuration");
+    }
+
+    PartitionCacheBlock block;
+    memcpy(&block,
+           mapped + sizeof(PartitionCacheHeader) +
+               grid->rank_in_col * sizeof(PartitionCacheBlock),
+           sizeof(PartitionCacheBlock));
+    uint64_t index_bytes = (block.rows + 1 + block.nnz) * sizeof(MKL_INT);
+    if (block.offset + index_bytes + block.nnz * sizeof(double) > file_size) {
+      munmap(mapped, file_size);
+      throw std::runtime_error("truncated partition cache " + file_path);
+    }
 
+    madvise(mapped + block.offset, index_bytes + block.nnz * sizeof(double),
+            MADV_SEQUENTIAL);
+    vector<MKL_INT> rowStart(block.rows + 1);
+    vector<MKL_INT> col_idx(block.nnz);
+    vector<double> values(block.nnz);
+    memcpy(rowStart.data(), mapped + block.offset,
+           (block.rows + 1) * sizeof(MKL_INT));
+    memcpy(col_idx.data(),
+           mapped + block.offset + (block.rows + 1) * sizeof(MKL_INT),
+           block.nnz * sizeof(MKL_INT));
+    memcpy(values.data(), mapped + block.offset + index_bytes,
+           block.nnz * sizeof(double));
+    munmap(mapped, file_size);
+
+    sp_mat->gRows = header.gRows;
+    sp_mat->gCols = header.gCols;
+    sp_mat->gNNz = header.gNNz;
+    sp_mat->proc_row_width = header.proc_row_width;
+    sp_mat->proc_col_width = header.proc_col_width;
+    sp_mat->transpose = header.transpose;
+    sp_mat->col_partitioned = header.col_partitioned;
+    sp_mat->csr_local_data = make_unique<CSRLocal<VALUE_TYPE>>(
+        block.rows, block.cols, std::move(rowStart), std::move(col_idx),
+        std::move(values), header.transpose);
+  }
+
+  /**
+   * Writes the dense embedding rows as "<vertex id> v1 ... vd" lines.
+   */
   template <typename VALUE_TYPE>
-  void parallel_write(string file_path, vector<vector<VALUE_TYPE>> *matrix,
+  void parallel_write(string file_path, VALUE_TYPE *nCoordinates,
                       INDEX_TYPE rows, uint64_t cols, Process3DGrid *grid,
                       distblas::core::SpMat<VALUE_TYPE> *sp_mat) {
-    MPI_File fh;
-    MPI_File_open(grid->col_world, file_path.c_str(),
-                  MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &fh);
+    INDEX_TYPE expected_rows = get_expected_rows(rows, grid, sp_mat);
+    INDEX_TYPE first_id = 1 + grid->rank_in_col * rows;
+    parallel_write_text(
+        file_path, expected_rows, "", grid,
+        [&](INDEX_TYPE i, vector<char> &out) {
+          append_integer(out, first_id + i);
+          for (uint64_t j = 0; j < cols; ++j) {
+            out.push_back(' ');
+            append_fixed(out, nCoordinates[i * cols + j]);
+          }
+          out.push_back('\n');
+        });
+  }
 
-    uint64_t expected_rows = rows;
-    if (grid->rank_in_col == grid->col_world_size - 1) {
-      auto expected_last_rows = sp_mat->gRows - rows * grid->rank_in_col;
-      cout << " expected rows " << expected_last_rows << endl;
-      expected_rows = min(expected_last_rows, rows);
-    }
+  template <typename VALUE_TYPE>
+  void parallel_write(string file_path, distblas::core::DenseCollector<VALUE_TYPE> *matrix,
+                      INDEX_TYPE rows, uint64_t cols, Process3DGrid *grid,
+                      distblas::core::SpMat<VALUE_TYPE> *sp_mat) {
+    INDEX_TYPE expected_rows = get_expected_rows(rows, grid, sp_mat);
+    INDEX_TYPE first_id = 1 + grid->rank_in_col * rows;
+    parallel_write_text(
+        file_path, expected_rows, "", grid,
+        [&](INDEX_TYPE i, vector<char> &out) {
+          append_integer(out, first_id + i);
+          for (uint64_t j = 0; j < cols; ++j) {
+            out.push_back(' ');
+            append_fixed(out, (*matrix)[i][j]);
+          }
+          out.push_back('\n');
+        });
+  }
 
-    //    int offset= rows-expected_rows;
-    cout << " rank :" << grid->rank_in_col << " expected rows " << expected_rows
-         << endl;
-    size_t total_size = 0;
-    for (INDEX_TYPE i = 0; i < expected_rows; ++i) {
-      total_size +=
-          snprintf(nullptr, 0, "%lu", i + 1 + grid->rank_in_col * rows);
-      for (int j = 0; j < cols; ++j) {
-        total_size += snprintf(nullptr, 0, " %.5f", (*matrix)[i][j]);
-      }
-      total_size += snprintf(nullptr, 0, "\n");
-    }
+  /**
+   * Writes the dense embedding as a row-major .npy array of shape
+   * (gRows, cols). Row i of the array belongs to vertex id i + 1.
+   */
+  template <typename VALUE_TYPE>
+  void parallel_write_npy(string file_path, VALUE_TYPE *nCoordinates,
+                          INDEX_TYPE rows, uint64_t cols, Process3DGrid *grid,
+                          distblas::core::SpMat<VALUE_TYPE> *sp_mat) {
+    INDEX_TYPE expected_rows = get_expected_rows(rows, grid, sp_mat);
+    parallel_write_binary_rows<VALUE_TYPE>(
+        file_path, expected_rows, cols, grid,
+        [&](INDEX_TYPE i) { return nCoordinates + i * cols; });
+  }
 
-    // Allocate memory dynamically
-    char *buffer =
-        (char *)malloc(total_size + 1); // +1 for the null-terminating character
-    if (buffer == nullptr) {
-      // Handle allocation failure
-      cout << "Memory allocation failed." << endl;
-      return;
-    }
+  template <typename VALUE_TYPE>
+  void parallel_write_npy(string file_path, distblas::core::DenseCollector<VALUE_TYPE> *matrix,
+                          INDEX_TYPE rows, uint64_t cols, Process3DGrid *grid,
+                          distblas::core::SpMat<VALUE_TYPE> *sp_mat) {
+    INDEX_TYPE expected_rows = get_expected_rows(rows, grid, sp_mat);
+    parallel_write_binary_rows<VALUE_TYPE>(
+        file_path, expected_rows, cols, grid,
+        [&](INDEX_TYPE i) { return (*matrix)[i].data(); });
+  }
 
-    char *current_position = buffer;
+  /**
+   * Writes a local row-major array of rows x cols values (e.g. BFS levels or
+   * parents) as one .npy array over all processes, skipping padding rows.
+   */
+  template <typename T>
+  void parallel_write_npy(string file_path, const T *data, INDEX_TYPE rows,
+                          uint64_t cols, INDEX_TYPE global_rows,
+                          Process3DGrid *grid) {
+    INDEX_TYPE expected_rows =
+        get_expected_rows_from_global(rows, global_rows, grid);
+    parallel_write_binary_rows<T>(
+        file_path, expected_rows, cols, grid,
+        [&](INDEX_TYPE i) { return data + i * cols; });
+  }
 
-    for (INDEX_TYPE i = 0; i < expected_rows; ++i) {
-      current_position += snprintf(current_position, total_size, "%lu",
-                                   i + 1 + grid->rank_in_col * rows);
-      for (int j = 0; j < cols; ++j) {
-        current_position += snprintf(current_position, total_size, " %.5f",
-                                     (*matrix)[i][j]);
+  /**
+   * Reads whitespace separated 1-based vertex ids (e.g. BFS sources) on the
+   * first process and broadcasts them, returned ids are 0-based. Every id
+   * has to be in [1, global_rows].
+   */
+  vector<INDEX_TYPE> read_vertex_list(string file_path, INDEX_TYPE global_rows,
+                                      Process3DGrid *grid) {
+    vector<INDEX_TYPE> ids;
+    uint64_t count = 0;
+    if (grid->rank_in_col == 0) {
+      ifstream in(file_path);
+      if (!in) {
+        throw std::runtime_error("cannot open vertex list " + file_path);
       }
-      current_position += snprintf(current_position, total_size, "\n");
+      string line, token;
+      uint64_t line_number = 0;
+      while (getline(in, line)) {
+        line_number++;
+        istringstream tokens(line);
+        while (tokens >> token) {
+          INDEX_TYPE id = 0;
+          auto parsed = from_chars(token.data(), token.data() + token.size(), id);
+          if (parsed.ec != errc() or parsed.ptr != token.data() + token.size() or
+              id < 1 or id > global_rows) {
+            throw std::runtime_error(
+                "vertex list " + file_path + " line " + to_string(line_number) +
+                ": id " + token + " is not in [1, " + to_string(global_rows) + "]");
+          }
+          ids.push_back(id - 1);
+        }
+      }
+      count = ids.size();
     }
+    MPI_Bcast(&count, 1, MPI_UINT64_T, 0, grid->col_world);
+    ids.resize(count);
+    MPI_Bcast(ids.data(), count, MPI_UINT64_T, 0, grid->col_world);
+    return ids;
+  }
 
-    MPI_File_write_ordered(fh, buffer, current_position - buffer, MPI_CHAR,
-                           MPI_STATUS_IGNORE);
+  /**
+   * Builds the local CSR block of a random tall-and-skinny operand directly
+   * in memory, so SpGEMM benchmarks do not need a write and read cycle.
+   * Rows are generated in parallel with a counter based RNG, the matrix does
+   * not depend on the number of threads or processes. Every value is 1, as
+   * when the written operand was read back as a boolean matrix.
+   * @param rows local rows (proc_row_width)
+   * @param distribution "er" keeps every entry with probability density,
+   *        "fixed" draws max(cols * density, 1) distinct columns per row and
+   *        "rmat" samples rows of an R-MAT matrix with the same expected nnz
+   *        (skewed row degrees and column popularity)
+   */
+  template <typename VALUE_TYPE>
+  void build_sparse_random_csr(distblas::core::SpMat<VALUE_TYPE> *sp_mat,
+                               INDEX_TYPE rows, INDEX_TYPE global_rows,
+                               INDEX_TYPE cols, double density, uint64_t seed,
+                               string distribution, Process3DGrid *grid) {
+    INDEX_TYPE first_row = grid->rank_in_col * rows;
+    INDEX_TYPE local_rows = get_expected_rows_from_global(rows, global_rows, grid);
+    INDEX_TYPE nnz_per_row = max(static_cast<INDEX_TYPE>(cols * density),
+                                 static_cast<INDEX_TYPE>(1));
+    nnz_per_row = min(nnz_per_row, cols);
 
-    // Free the dynamically allocated memory
-    free(buffer);
+    int row_scale = ceil_log2(global_rows);
+    int col_scale = ceil_log2(cols);
+    double total_edges = static_cast<double>(global_rows) * nnz_per_row;
 
-    MPI_File_close(&fh);
+    vector<MKL_INT> rowStart, col_idx;
+    vector<double> values;
+    build_csr_from_rows(
+        rows, rowStart, col_idx, values,
+        [&](INDEX_TYPE i, vector<MKL_INT> &row_cols, vector<double> &row_values,
+            vector<char> &taken) {
+          if (i >= local_rows) {
+            return;
+          }
+          INDEX_TYPE global_row = first_row + i;
+          uint64_t row_seed = counter_random(seed, global_row);
+          uint64_t draw = 0;
+          if (distribution == "er") {
+            if (density >= 1) {
+              for (INDEX_TYPE c = 0; c < cols; c++) {
+                row_cols.push_back(c);
+              }
+            } else if (density > 0) {
+              double log_q = log(1.0 - density);
+              int64_t c = -1;
+              while (true) {
+                double u = counter_uniform(row_seed, draw++);
+                c += 1 + static_cast<int64_t>(log(1.0 - u) / log_q);
+                if (c >= static_cast<int64_t>(cols)) {
+                  break;
+                }
+                row_cols.push_back(c);
+              }
+            }
+          } else if (distribution == "rmat") {
+            // Expected degree of the row under the R-MAT recursion, columns
+            // are drawn conditioned on the row bits.
+            double expected = total_edges;
+            for (int l = 0; l < row_scale; l++) {
+              bool bit = (global_row >> (row_scale - 1 - l)) & 1;
+              expected *= bit ? (RMAT_C + RMAT_D) : (RMAT_A + RMAT_B);
+            }
+            INDEX_TYPE degree = static_cast<INDEX_TYPE>(expected);
+            if (counter_uniform(row_seed, draw++) < expected - degree) {
+              degree++;
+            }
+            degree = min(degree, cols);
+            // duplicates are redrawn a bounded number of times
+            for (INDEX_TYPE k = 0; k < 8 * degree and row_cols.size() < degree; k++) {
+              INDEX_TYPE c = 0;
+              for (int l = 0; l < col_scale; l++) {
+                double p_one = RMAT_B + RMAT_D;
+                if (l < row_scale) {
+                  bool bit = (global_row >> (row_scale - 1 - l)) & 1;
+                  p_one = bit ? RMAT_D / (RMAT_C + RMAT_D)
+                              : RMAT_B / (RMAT_A + RMAT_B);
+                }
+                c = (c << 1) |
+                    (counter_uniform(row_seed, draw++) < p_one ? 1 : 0);
+              }
+              if (c < cols and !taken[c]) {
+                taken[c] = 1;
+                row_cols.push_back(c);
+              }
+            }
+          } else {
+            // Floyd's algorithm for nnz_per_row distinct columns
+            for (INDEX_TYPE j = cols - nnz_per_row; j < cols; j++) {
+              INDEX_TYPE c = counter_random(row_seed, draw++) % (j + 1);
+              if (taken[c]) {
+                c = j;
+              }
+              taken[c] = 1;
+              row_cols.push_back(c);
+            }
+          }
+          for (auto c : row_cols) {
+            taken[c] = 0;
+          }
+          std::sort(row_cols.begin(), row_cols.end());
+          row_values.assign(row_cols.size(), 1.0);
+        },
+        cols);
+
+    uint64_t local_nnz = col_idx.size();
+    uint64_t global_nnz = 0;
+    MPI_Allreduce(&local_nnz, &global_nnz, 1, MPI_UINT64_T, MPI_SUM,
+                  grid->col_world);
+
+    sp_mat->gRows = global_rows;
+    sp_mat->gCols = cols;
+    sp_mat->gNNz = global_nnz;
+    sp_mat->proc_row_width = rows;
+    sp_mat->proc_col_width = cols;
+    sp_mat->csr_local_data = make_unique<CSRLocal<VALUE_TYPE>>(
+        rows, cols, std::move(rowStart), std::move(col_idx), std::move(values),
+        false);
   }
 
   template <typename VALUE_TYPE>
@@ -369,69 +1311,106 @@ public:
     MPI_File_close(&fh);
   }
 
+  /**
+   * Writes the local CSR block as Matrix Market coordinates. Rows are
+   * formatted into per-thread chunks and every process issues a single
+   * collective write.
+   */
   template <typename VALUE_TYPE>
   void parallel_write_csr(string file_path, CSRHandle *handle,
                           Process3DGrid *grid, INDEX_TYPE local_rows,
                           INDEX_TYPE global_rows, INDEX_TYPE global_cols) {
-    MPI_File fh;
-    MPI_File_open(grid->col_world, file_path.c_str(),
-                  MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &fh);
-
-    int chunk_size = 100000; // Number of elements to write at a time
-    size_t total_size = 0;
-
+    INDEX_TYPE rows = get_expected_csr_rows(handle, grid, local_rows, global_rows);
+    INDEX_TYPE local_sum = handle->rowStart[rows];
     INDEX_TYPE global_sum = 0;
-    INDEX_TYPE local_sum = (*handle).rowStart[(*handle).rowStart.size() - 1];
-
     MPI_Allreduce(&local_sum, &global_sum, 1, MPI_UINT64_T, MPI_SUM,
                   grid->col_world);
 
-    if (grid->rank_in_col == 0) {
-      total_size += snprintf(
-          nullptr, 0,
-          "%%%MatrixMarket matrix coordinate real general\n%lu %lu %lu\n",
-          global_rows, global_cols, global_sum);
-    }
-
-    for (auto i = 0; i < (*handle).rowStart.size(); i++) {
-      for (auto j = (*handle).rowStart[i]; j < (*handle).rowStart[i + 1]; j++) {
-        INDEX_TYPE index = i + grid->rank_in_col * local_rows;
-        INDEX_TYPE col_index = (*handle).col_idx[j];
-        VALUE_TYPE value = (*handle).values[j];
-        total_size +=
-            snprintf(nullptr, 0, "%lu %lu %.5f\n", index, col_index, value);
-      }
-      char *buffer = (char *)malloc(total_size +
-                                    1); // +1 for the null-terminating character
-      if (buffer == nullptr) {
-        // Handle allocation failure
-        cout << "Memory allocation failed." << endl;
-        return;
-      }
+    string header = "%%MatrixMarket matrix coordinate real general\n" +
+                    to_string(global_rows) + " " + to_string(global_cols) +
+                    " " + to_string(global_sum) + "\n";
+    INDEX_TYPE first_row = 1 + grid->rank_in_col * local_rows;
+    parallel_write_text(
+        file_path, rows, header, grid, [&](INDEX_TYPE i, vector<char> &out) {
+          for (auto j = handle->rowStart[i]; j < handle->rowStart[i + 1]; j++) {
+            append_integer(out, first_row + i);
+            out.push_back(' ');
+            append_integer(out, handle->col_idx[j] + 1);
+            out.push_back(' ');
+            append_fixed(out, static_cast<VALUE_TYPE>(handle->values[j]));
+            out.push_back('\n');
+          }
+        });
+  }
 
-      char *current_position = buffer;
-      if (i == 0 and grid->rank_in_col == 0) {
-        current_position += snprintf(
-            current_position, total_size,
-            "%%%MatrixMarket matrix coordinate real general\n%lu %lu %lu\n",
-            global_rows, global_cols, global_sum);
-      }
-      for (auto j = (*handle).rowStart[i]; j < (*handle).rowStart[i + 1]; j++) {
-        INDEX_TYPE index = i + grid->rank_in_col * local_rows;
-        INDEX_TYPE col_index = (*handle).col_idx[j];
-        VALUE_TYPE value = (*handle).values[j];
-        current_position += snprintf(current_position, total_size,
-                                     "%lu %lu %.5f\n", index, col_index, value);
-      }
-      MPI_Status status;
-      MPI_File_write_ordered(fh, buffer, current_position - buffer, MPI_CHAR,
-                             MPI_STATUS_IGNORE);
+  /**
+   * Writes the distributed CSR as one global binary CSR file:
+   * a CSRFileHeader followed by rowStart[rows + 1], col_idx[nnz] and
+   * values[nnz] (int64 indices, VALUE_TYPE values). Row pointers of every
+   * process are shifted by the number of preceding nonzeros so the file can
+   * be loaded directly as a single CSR matrix.
+   */
+  template <typename VALUE_TYPE>
+  void parallel_write_csr_binary(string file_path, CSRHandle *handle,
+                                 Process3DGrid *grid, INDEX_TYPE local_rows,
+                                 INDEX_TYPE global_rows,
+                                 INDEX_TYPE global_cols) {
+    uint64_t rows = get_expected_csr_rows(handle, grid, local_rows, global_rows);
+    uint64_t nnz = handle->rowStart[rows];
 
-      // Free the dynamically allocated memory for each chunk
-      free(buffer);
-      total_size = 0; // Reset total_size for the next chunk
+    uint64_t local_counts[2] = {rows, nnz};
+    uint64_t preceding[2] = {0, 0};
+    uint64_t totals[2] = {0, 0};
+    MPI_Exscan(local_counts, preceding, 2, MPI_UINT64_T, MPI_SUM,
+               grid->col_world);
+    MPI_Allreduce(local_counts, totals, 2, MPI_UINT64_T, MPI_SUM,
+                  grid->col_world);
+    if (grid->rank_in_col == 0) {
+      preceding[0] = 0;
+      preceding[1] = 0;
     }
+    bool last = grid->rank_in_col == grid->col_world_size - 1;
 
+    // The last process also writes the closing row pointer.
+    vector<int64_t> row_ptr(rows + (last ? 1 : 0));
+    vector<int64_t> cols(nnz);
+    vector<VALUE_TYPE> values(nnz);
+#pragma omp parallel for
+    for (uint64_t i = 0; i < row_ptr.size(); i++) {
+      row_ptr[i] = preceding[1] + handle->rowStart[i];
+    }
+#pragma omp parallel for
+    for (uint64_t j = 0; j < nnz; j++) {
+      cols[j] = handle->col_idx[j];
+      values[j] = static_cast<VALUE_TYPE>(handle->values[j]);
+    }
+
+    CSRFileHeader header;
+    header.magic = CSR_FILE_MAGIC;
+    header.rows = totals[0];
+    header.cols = global_cols;
+    header.nnz = totals[1];
+    header.index_bytes = sizeof(int64_t);
+    header.value_bytes = sizeof(VALUE_TYPE);
+
+    uint64_t row_ptr_start = sizeof(CSRFileHeader);
+    uint64_t cols_start = row_ptr_start + (header.rows + 1) * sizeof(int64_t);
+    uint64_t values_start = cols_start + header.nnz * sizeof(int64_t);
+
+    MPI_File fh;
+    open_for_write(file_path, grid, &fh);
+    if (grid->rank_in_col == 0) {
+      MPI_File_write_at(fh, 0, &header, sizeof(CSRFileHeader), MPI_BYTE,
+                        MPI_STATUS_IGNORE);
+    }
+    write_at_all_chunked(fh, row_ptr_start + preceding[0] * sizeof(int64_t),
+                         row_ptr.data(), row_ptr.size() * sizeof(int64_t),
+                         grid->col_world);
+    write_at_all_chunked(fh, cols_start + preceding[1] * sizeof(int64_t),
+                         cols.data(), nnz * sizeof(int64_t), grid->col_world);
+    write_at_all_chunked(fh, values_start + preceding[1] * sizeof(VALUE_TYPE),
+                         values.data(), nnz * sizeof(VALUE_TYPE),
+                         grid->col_world);
     MPI_File_close(&fh);
   }
 };
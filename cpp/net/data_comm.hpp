@@ -2,7 +2,9 @@
 #include "../core/common.h"
 #include "../core/dense_mat.hpp"
 #include "../core/sparse_mat.hpp"
+#include "plan_cache.hpp"
 #include "process_3D_grid.hpp"
+#include "sparse_message.hpp"
 #include <chrono>
 #include <iostream>
 #include <mpi.h>
@@ -34,11 +36,13 @@ public:
   vector<int> sendcounts;
   vector<int> rdispls;
   vector<int> receivecounts;
-  vector<unordered_set<INDEX_TYPE>> receive_col_ids_list;
-  vector<unordered_set<INDEX_TYPE>> send_col_ids_list;
-  unordered_map<INDEX_TYPE, unordered_map<int, bool>> send_indices_to_proc_map;
-  unordered_map<INDEX_TYPE, unordered_map<int, bool>>
-      receive_indices_to_proc_map;
+  // Flattened communication plan: the ids exchanged with process i are
+  // send_ids[send_offsets[i]..send_offsets[i+1]) (likewise for receive),
+  // sorted and unique.
+  vector<INDEX_TYPE> receive_ids;
+  vector<INDEX_TYPE> receive_offsets;
+  vector<INDEX_TYPE> send_ids;
+  vector<INDEX_TYPE> send_offsets;
 
   int batch_id;
 
@@ -59,10 +63,8 @@ public:
     this->receive_counts_cyclic = vector<int>(grid->world_size, 0);
     this->sdispls_cyclic = vector<int>(grid->world_size, 0);
     this->rdispls_cyclic = vector<int>(grid->world_size, 0);
-    this->receive_col_ids_list =
-        vector<unordered_set<INDEX_TYPE>>(grid->world_size);
-    this->send_col_ids_list =
-        vector<unordered_set<INDEX_TYPE>>(grid->world_size);
+    this->receive_offsets = vector<INDEX_TYPE>(grid->world_size + 1, 0);
+    this->send_offsets = vector<INDEX_TYPE>(grid->world_size + 1, 0);
     this->batch_id = batch_id;
     this->alpha = alpha;
   }
@@ -81,10 +83,8 @@ public:
     this->receive_counts_cyclic = vector<int>(grid->world_size, 0);
     this->sdispls_cyclic = vector<int>(grid->world_size, 0);
     this->rdispls_cyclic = vector<int>(grid->world_size, 0);
-    this->receive_col_ids_list =
-        vector<unordered_set<INDEX_TYPE>>(grid->world_size);
-    this->send_col_ids_list =
-        vector<unordered_set<INDEX_TYPE>>(grid->world_size);
+    this->receive_offsets = vector<INDEX_TYPE>(grid->world_size + 1, 0);
+    this->send_offsets = vector<INDEX_TYPE>(grid->world_size + 1, 0);
   }
 
   vector<int> receive_counts_cyclic;
@@ -98,7 +98,16 @@ public:
 
   void onboard_data() {
 
-    int total_send_count = 0;
+    if (PlanCache::enabled() and load_plan()) {
+      return;
+    }
+
+    receivecounts.assign(grid->world_size, 0);
+    sendcounts.assign(grid->world_size, 0);
+    receive_offsets.assign(grid->world_size + 1, 0);
+    send_offsets.assign(grid->world_size + 1, 0);
+    vector<vector<INDEX_TYPE>> receive_col_ids_list(grid->world_size);
+    vector<vector<INDEX_TYPE>> send_col_ids_list(grid->world_size);
     // processing chunks
     // calculating receiving data cols
 
@@ -106,45 +115,39 @@ public:
       // This represents the case for pulling
 
       this->sp_local_receiver->find_col_ids(batch_id, 0, grid->col_world_size,
-                                            receive_col_ids_list,
-                                            receive_indices_to_proc_map, 0);
+                                            receive_col_ids_list, 0);
       // calculating sending data cols
       this->sp_local_sender->find_col_ids(batch_id, 0, grid->col_world_size,
-                                          send_col_ids_list,
-                                          send_indices_to_proc_map, 0);
+                                          send_col_ids_list, 0);
     } else if (alpha == 1.0) {
       // This represents the case for pushing
       this->sp_local_receiver->find_col_ids(batch_id, 0, grid->col_world_size,
-                                            receive_col_ids_list,
-                                            receive_indices_to_proc_map, 1);
+                                            receive_col_ids_list, 1);
 
       // calculating sending data cols
       this->sp_local_sender->find_col_ids(batch_id, 0, grid->col_world_size,
-                                          send_col_ids_list,
-                                          send_indices_to_proc_map, 1);
+                                          send_col_ids_list, 1);
     } else if (alpha > 0 and alpha < 1.0) {
 
       // This represents the case for pull and pushing
       int end_process = get_end_proc(1, alpha, grid->col_world_size);
 
       this->sp_local_receiver->find_col_ids(batch_id, 1, end_process,
-                                            receive_col_ids_list,
-                                            receive_indices_to_proc_map, 1);
+                                            receive_col_ids_list, 1);
 
       // calculating sending data cols
       this->sp_local_sender->find_col_ids(batch_id, 1, end_process,
-                                          send_col_ids_list,
-                                          send_indices_to_proc_map, 1);
+                                          send_col_ids_list, 1);
 
       if (batch_id >= 0) {
         this->sp_local_receiver->find_col_ids(
             batch_id, end_process, grid->col_world_size, receive_col_ids_list,
-            receive_indices_to_proc_map, 0);
+            0);
 
         // calculating sending data cols
         this->sp_local_sender->find_col_ids(
             batch_id, end_process, grid->col_world_size, send_col_ids_list,
-            send_indices_to_proc_map, 0);
+            0);
       }
 
     } else {
@@ -154,9 +157,49 @@ public:
     for (int i = 0; i < grid->world_size; i++) {
       receivecounts[i] = receive_col_ids_list[i].size();
       sendcounts[i] = send_col_ids_list[i].size();
+      receive_offsets[i + 1] = receive_offsets[i] + receivecounts[i];
+      send_offsets[i + 1] = send_offsets[i] + sendcounts[i];
+    }
+    receive_ids.resize(receive_offsets[grid->world_size]);
+    send_ids.resize(send_offsets[grid->world_size]);
+#pragma omp parallel for
+    for (int i = 0; i < grid->world_size; i++) {
+      copy(receive_col_ids_list[i].begin(), receive_col_ids_list[i].end(),
+           receive_ids.begin() + receive_offsets[i]);
+      copy(send_col_ids_list[i].begin(), send_col_ids_list[i].end(),
+           send_ids.begin() + send_offsets[i]);
+    }
+
+    if (PlanCache::enabled()) {
+      save_plan();
     }
   }
 
+  string plan_name() {
+    return "data_comm_b" + to_string(batch_id) + "_a" +
+           to_string(static_cast<int>(alpha * 1000));
+  }
+
+  void save_plan() {
+    PlanWriter writer(plan_name(), grid->rank_in_col, grid->col_world_size);
+    writer.write(sendcounts);
+    writer.write(receivecounts);
+    writer.write(send_offsets);
+    writer.write(send_ids);
+    writer.write(receive_offsets);
+    writer.write(receive_ids);
+  }
+
+  // the cached plan is only used if every process could load its part
+  bool load_plan() {
+    PlanReader reader(plan_name(), grid->rank_in_col, grid->col_world_size);
+    bool loaded = reader.good() and reader.read(sendcounts) and
+                  reader.read(receivecounts) and reader.read(send_offsets) and
+                  reader.read(send_ids) and reader.read(receive_offsets) and
+                  reader.read(receive_ids);
+    return PlanCache::all_loaded(loaded, grid->col_world);
+  }
+
   inline void transfer_data(
       std::vector<DataTuple<VALUE_TYPE, embedding_dim>> *sendbuf_cyclic,
       std::vector<DataTuple<VALUE_TYPE, embedding_dim>> *receivebuf,
@@ -164,7 +207,6 @@ public:
       int starting_proc, int end_proc, bool temp_cache) {
 
     int total_receive_count = 0;
-    vector<int> offset_vector(grid->col_world_size, 0);
 
     int total_send_count = 0;
     send_counts_cyclic = vector<int>(grid->col_world_size, 0);
@@ -205,26 +247,18 @@ public:
 
     if (total_send_count > 0) {
       sendbuf_cyclic->resize(total_send_count);
-      for (const auto &pair :
-           DataComm<INDEX_TYPE, VALUE_TYPE,
-                    embedding_dim>::send_indices_to_proc_map) {
-        auto col_id = pair.first;
-        bool already_fetched = false;
-        std::array<VALUE_TYPE, embedding_dim> dense_vector;
-        for (int i = 0; i < sending_procs.size(); i++) {
-          if (pair.second.count(sending_procs[i]) > 0) {
-            if (!already_fetched) {
-              dense_vector = (this->dense_local)->fetch_local_data(col_id);
-              already_fetched = true;
-            }
-            int offset = sdispls_cyclic[sending_procs[i]];
-            int index = offset_vector[sending_procs[i]] + offset;
-            (*sendbuf_cyclic)[index].col =
-                col_id + (this->sp_local_sender->proc_col_width *
-                          this->grid->global_rank);
-            (*sendbuf_cyclic)[index].value = dense_vector;
-            offset_vector[sending_procs[i]]++;
-          }
+      for (int i = 0; i < sending_procs.size(); i++) {
+        int proc = sending_procs[i];
+        INDEX_TYPE base = send_offsets[proc];
+        int offset = sdispls_cyclic[proc];
+#pragma omp parallel for
+        for (INDEX_TYPE k = 0; k < sendcounts[proc]; k++) {
+          auto col_id = send_ids[base + k];
+          (*sendbuf_cyclic)[offset + k].col =
+              col_id + (this->sp_local_sender->proc_col_width *
+                        this->grid->global_rank);
+          (*sendbuf_cyclic)[offset + k].value =
+              (this->dense_local)->fetch_local_data(col_id);
         }
       }
     }
@@ -250,165 +284,36 @@ public:
     }
   }
 
-  inline void transfer_sparse_data(
-      vector<SpTuple<VALUE_TYPE, sp_tuple_max_dim>> *sendbuf_cyclic,
-      vector<SpTuple<VALUE_TYPE, sp_tuple_max_dim>> *receivebuf, int iteration,
-      int batch_id, int starting_proc, int end_proc) {
+  inline void transfer_sparse_data(vector<char> *sendbuf_cyclic,
+                                   vector<char> *receivebuf, int iteration,
+                                   int batch_id, int starting_proc,
+                                   int end_proc) {
 
-    int total_receive_count = 0;
-    shared_ptr<vector<vector<SpTuple<VALUE_TYPE, sp_tuple_max_dim>>>>
-        data_buffer_ptr = make_shared<
-            vector<vector<SpTuple<VALUE_TYPE, sp_tuple_max_dim>>>>();
-    data_buffer_ptr->resize(grid->col_world_size);
-
-    int total_send_count = 0;
     send_counts_cyclic = vector<int>(grid->col_world_size, 0);
     receive_counts_cyclic = vector<int>(grid->col_world_size, 0);
     sdispls_cyclic = vector<int>(grid->col_world_size, 0);
     rdispls_cyclic = vector<int>(grid->col_world_size, 0);
 
     vector<int> sending_procs;
-    vector<int> receiving_procs;
-
     for (int i = starting_proc; i < end_proc; i++) {
-      int sending_rank = (grid->rank_in_col + i) % grid->col_world_size;
-      int receiving_rank =
-          (grid->rank_in_col >= i)
-              ? (grid->rank_in_col - i) % grid->col_world_size
-              : (grid->col_world_size - i + grid->rank_in_col) %
-                    grid->col_world_size;
-      sending_procs.push_back(sending_rank);
-      receiving_procs.push_back(receiving_rank);
-      (*data_buffer_ptr)[sending_rank] =
-          vector<SpTuple<VALUE_TYPE, sp_tuple_max_dim>>();
+      sending_procs.push_back((grid->rank_in_col + i) % grid->col_world_size);
     }
 
-    for (const auto &pair : DataComm<INDEX_TYPE, VALUE_TYPE,
-                                     embedding_dim>::send_indices_to_proc_map) {
-      auto col_id = pair.first;
-      CSRHandle sparse_tuple = (this->sparse_local)->fetch_local_data(col_id);
-      for (int i = 0; i < sending_procs.size(); i++) {
-        if (pair.second.count(sending_procs[i]) > 0) {
-
-          if (send_counts_cyclic[sending_procs[i]] == 0) {
-            SpTuple<VALUE_TYPE, sp_tuple_max_dim> current;
-            current.rows[0] =
-                2; // rows first two indices are already taken for metadata
-            current.rows[1] = 0;
-            (*data_buffer_ptr)[sending_procs[i]].push_back(current);
-            total_send_count++;
-            send_counts_cyclic[sending_procs[i]]++;
-          }
-
-          SpTuple<VALUE_TYPE, sp_tuple_max_dim> latest =
-              (*data_buffer_ptr)[sending_procs[i]]
-                                [send_counts_cyclic[sending_procs[i]] - 1];
-          auto row_index_offset = latest.rows[0];
-          auto col_index_offset = latest.rows[1];
-          if (row_index_offset >= row_max or
-              col_index_offset >= sp_tuple_max_dim) {
-            SpTuple<VALUE_TYPE, sp_tuple_max_dim> current;
-            current.rows[0] =
-                2; // rows first two indices are already taken for metadata
-            current.rows[1] = 0;
-            (*data_buffer_ptr)[sending_procs[i]].push_back(current);
-            total_send_count++;
-            send_counts_cyclic[sending_procs[i]]++;
-            latest =
-                (*data_buffer_ptr)[sending_procs[i]]
-                                  [send_counts_cyclic[sending_procs[i]] - 1];
-            row_index_offset = latest.rows[0];
-            col_index_offset = latest.rows[1];
-          }
-
-          INDEX_TYPE offset = sparse_tuple.col_idx.size();
-          // start filling from offset position
-          INDEX_TYPE pending_col_pos = sp_tuple_max_dim - col_index_offset;
-          INDEX_TYPE num_of_copying_data = min(offset, pending_col_pos);
-          INDEX_TYPE remaining_data_items = offset - num_of_copying_data;
-
-          latest.rows[row_index_offset] = sparse_tuple.row_idx[0];
-          latest.rows[row_index_offset + 1] = num_of_copying_data;
-          latest.rows[0] = row_index_offset + 2;
-          latest.rows[1] = latest.rows[1] + num_of_copying_data;
-
-          if (num_of_copying_data > 0) {
-            copy(sparse_tuple.col_idx.begin(),
-                 sparse_tuple.col_idx.begin() + num_of_copying_data,
-                 latest.cols.begin() + col_index_offset);
-            copy(sparse_tuple.values.begin(),
-                 sparse_tuple.values.begin() + num_of_copying_data,
-                 latest.values.begin() + col_index_offset);
-          }
-          (*data_buffer_ptr)[sending_procs[i]]
-                            [send_counts_cyclic[sending_procs[i]] - 1] = latest;
-          if (remaining_data_items > 0) {
-            SpTuple<VALUE_TYPE, sp_tuple_max_dim> current;
-            current.rows[0] =
-                2; // rows first two indices are already taken for metadata
-            current.rows[1] = 0;
-            (*data_buffer_ptr)[sending_procs[i]].push_back(current);
-            total_send_count++;
-            send_counts_cyclic[sending_procs[i]]++;
-            latest =
-                (*data_buffer_ptr)[sending_procs[i]]
-                                  [send_counts_cyclic[sending_procs[i]] - 1];
-            row_index_offset = latest.rows[0];
-            col_index_offset = latest.rows[1];
-            latest.rows[row_index_offset] = sparse_tuple.row_idx[0];
-            latest.rows[row_index_offset + 1] = remaining_data_items;
-            latest.rows[0] = row_index_offset + 2;
-            latest.rows[1] = latest.rows[1] + remaining_data_items;
-
-            copy(sparse_tuple.col_idx.begin() + num_of_copying_data - 1,
-                 sparse_tuple.col_idx.begin() + num_of_copying_data - 1 +
-                     remaining_data_items,
-                 latest.cols.begin());
-            copy(sparse_tuple.values.begin() + num_of_copying_data - 1,
-                 sparse_tuple.values.begin() + num_of_copying_data - 1 +
-                     remaining_data_items,
-                 latest.values.begin());
-            (*data_buffer_ptr)[sending_procs[i]]
-                              [send_counts_cyclic[sending_procs[i]] - 1] =
-                                  latest;
-          }
-        }
+    vector<SparseRowBuffer<VALUE_TYPE>> blocks(grid->col_world_size);
+#pragma omp parallel for
+    for (int i = 0; i < sending_procs.size(); i++) {
+      int proc = sending_procs[i];
+      for (INDEX_TYPE k = send_offsets[proc]; k < send_offsets[proc + 1]; k++) {
+        CSRHandle sparse_row = (this->sparse_local)->fetch_local_data(send_ids[k]);
+        blocks[proc].add_row(sparse_row.row_idx[0], sparse_row.col_idx.size(),
+                             sparse_row.col_idx.data(),
+                             sparse_row.values.data());
       }
     }
-    MPI_Barrier(grid->col_world);
-
-    (*sendbuf_cyclic).resize(total_send_count);
-    for (int i = 0; i < grid->col_world_size; i++) {
-      sdispls_cyclic[i] =
-          (i > 0) ? sdispls_cyclic[i - 1] + send_counts_cyclic[i - 1]
-                  : sdispls_cyclic[i];
-      copy((*data_buffer_ptr)[i].begin(), (*data_buffer_ptr)[i].end(),
-           (*sendbuf_cyclic).begin() + sdispls_cyclic[i]);
-    }
-//    auto t = start_clock();
-    MPI_Alltoall(send_counts_cyclic.data(), 1, MPI_INT,
-                 receive_counts_cyclic.data(), 1, MPI_INT, grid->col_world);
-//    stop_clock_and_add(t, "Communication Time");
-
-    for (int i = 0; i < grid->col_world_size; i++) {
-      rdispls_cyclic[i] =
-          (i > 0) ? rdispls_cyclic[i - 1] + receive_counts_cyclic[i - 1]
-                  : rdispls_cyclic[i];
-      total_receive_count += receive_counts_cyclic[i];
-    }
 
-    if (total_receive_count > 0) {
-      receivebuf->resize(total_receive_count);
-    }
-
-    add_perf_stats(total_receive_count, "Data transfers");
-
-   auto t = start_clock();
-    MPI_Alltoallv((*sendbuf_cyclic).data(), send_counts_cyclic.data(),
-                  sdispls_cyclic.data(), SPARSETUPLE, (*receivebuf).data(),
-                  receive_counts_cyclic.data(), rdispls_cyclic.data(),
-                  SPARSETUPLE, grid->col_world);
-    stop_clock_and_add(t, "Communication Time");
+    exchange_sparse_rows(blocks, sendbuf_cyclic, send_counts_cyclic,
+                         sdispls_cyclic, receivebuf, receive_counts_cyclic,
+                         rdispls_cyclic, grid->col_world);
     this->populate_sparse_cache(sendbuf_cyclic, receivebuf, iteration,
                                 batch_id);
   }
@@ -516,52 +421,29 @@ public:
     sendbuf->shrink_to_fit();
   }
 
-  inline void populate_sparse_cache(
-      vector<SpTuple<VALUE_TYPE, sp_tuple_max_dim>> *sendbuf,
-      vector<SpTuple<VALUE_TYPE, sp_tuple_max_dim>> *receivebuf, int iteration,
-      int batch_id, bool force_delete=false) {
+  /**
+   * Appends the received rows to the ghost store of their source process. An
+   * entry inserted in an earlier iteration or batch (or marked for deletion)
+   * is started over.
+   */
+  inline void populate_sparse_cache(vector<char> *sendbuf,
+                                    vector<char> *receivebuf, int iteration,
+                                    int batch_id, bool force_delete = false) {
 
-    #pragma omp parallel for
+#pragma omp parallel for
     for (int i = 0; i < this->grid->col_world_size; i++) {
-      INDEX_TYPE base_index = this->rdispls_cyclic[i];
-      INDEX_TYPE count = this->receive_counts_cyclic[i];
-
-      for (INDEX_TYPE j = base_index; j < base_index + count; j++) {
-        SpTuple<VALUE_TYPE, sp_tuple_max_dim> sp_tuple = (*receivebuf)[j];
-        auto row_offset = sp_tuple.rows[0];
-        auto offset_so_far = 0;
-        for (auto k = 2; k < row_offset; k = k + 2) {
-          auto key = sp_tuple.rows[k];
-          auto copying_count = sp_tuple.rows[k + 1];
-          if (force_delete or (*(this->sparse_local)->tempCachePtr)[i].find(key) ==
-              (*(this->sparse_local)->tempCachePtr)[i].end() or ((*(this->sparse_local)->tempCachePtr)[i][key].inserted_itr!=iteration
-               or (*(this->sparse_local)->tempCachePtr)[i][key].inserted_batch_id)!=batch_id or ((*(this->sparse_local)->tempCachePtr)[i][key].force_delete)) {
-            SparseCacheEntry<VALUE_TYPE> sp_entry;
-            sp_entry.inserted_itr = iteration;
-            sp_entry.inserted_batch_id = batch_id;
-            sp_entry.cols = vector<INDEX_TYPE>();
-            sp_entry.values = vector<VALUE_TYPE>();
-            if (force_delete){
-              sp_entry.force_delete =true;
-            }
-            (*(this->sparse_local)->tempCachePtr)[i][key] = sp_entry;
-          }
-          if (copying_count > 0) {
-            SparseCacheEntry<VALUE_TYPE> cache_entry =
-                (*(this->sparse_local)->tempCachePtr)[i][key];
-            auto entry_offset = cache_entry.cols.size();
-            cache_entry.cols.resize(entry_offset + copying_count);
-            cache_entry.values.resize(entry_offset + copying_count);
-            copy(sp_tuple.cols.begin() + offset_so_far,
-                 sp_tuple.cols.begin() + offset_so_far + copying_count,
-                 cache_entry.cols.begin() + entry_offset);
-            copy(sp_tuple.values.begin() + offset_so_far,
-                 sp_tuple.values.begin() + offset_so_far + copying_count,
-                 cache_entry.values.begin() + entry_offset);
-            offset_so_far += copying_count;
-            (*(this->sparse_local)->tempCachePtr)[i][key] = cache_entry;
-          }
-        }
+      if (this->receive_counts_cyclic[i] == 0) {
+        continue;
+      }
+      SparseRowView<VALUE_TYPE> view(receivebuf->data() +
+                                     sparse_rows_offset(this->rdispls_cyclic[i]));
+      auto &cache = (*(this->sparse_local)->tempCachePtr)[i];
+      cache.reserve(view.nrows, view.nnz);
+      INDEX_TYPE offset = 0;
+      for (INDEX_TYPE r = 0; r < view.nrows; r++) {
+        cache.append(view.rows[r], view.cols + offset, view.values + offset,
+                     view.counts[r], iteration, batch_id, force_delete);
+        offset += view.counts[r];
       }
     }
     receivebuf->clear();
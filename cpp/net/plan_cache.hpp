@@ -0,0 +1,153 @@
+/**
+ * On-disk cache for communication plans. Plans only depend on the input
+ * graph, the partitioning and a few hyper parameters, so recurring runs on the
+ * same graph and process count can load them instead of rebuilding them.
+ */
+#pragma once
+#include "../core/common.h"
+#include <cstring>
+#include <fstream>
+#include <mpi.h>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+using namespace std;
+
+namespace distblas::net {
+
+static constexpr char PLAN_CACHE_MAGIC[8] = {'D', 'E', 'P', 'L',
+                                             'A', 'N', '0', '1'};
+
+class PlanCache {
+
+private:
+  static uint64_t fnv1a(uint64_t hash, const void *data, size_t bytes) {
+    const unsigned char *ptr = static_cast<const unsigned char *>(data);
+    for (size_t i = 0; i < bytes; i++) {
+      hash ^= ptr[i];
+      hash *= 1099511628211ULL;
+    }
+    return hash;
+  }
+
+  template <typename T> static uint64_t fnv1a(uint64_t hash, const T &value) {
+    return fnv1a(hash, &value, sizeof(T));
+  }
+
+public:
+  // directory holding the cached plans, caching is disabled when empty
+  inline static string directory = "";
+
+  // hash of the input graph and the parameters the plans depend on
+  inline static uint64_t key = 0;
+
+  /**
+   * Enables the cache. The input is identified by its path, size and
+   * modification time; sources that are not files (e.g. generated graphs)
+   * should be passed as a descriptive string.
+   */
+  static void configure(const string &dir, const string &input_source,
+                        INDEX_TYPE batch_size, double alpha,
+                        double tile_width_fraction, int world_size) {
+    directory = dir;
+    uint64_t hash = 14695981039346656037ULL;
+    hash = fnv1a(hash, input_source.data(), input_source.size());
+    struct stat st;
+    if (stat(input_source.c_str(), &st) == 0) {
+      hash = fnv1a(hash, static_cast<int64_t>(st.st_size));
+      hash = fnv1a(hash, static_cast<int64_t>(st.st_mtime));
+    }
+    hash = fnv1a(hash, batch_size);
+    hash = fnv1a(hash, alpha);
+    hash = fnv1a(hash, tile_width_fraction);
+    hash = fnv1a(hash, world_size);
+    key = hash;
+  }
+
+  static bool enabled() { return !directory.empty(); }
+
+  static string file_name(const string &plan_name, int rank) {
+    char key_hex[17];
+    snprintf(key_hex, sizeof(key_hex), "%016llx",
+             static_cast<unsigned long long>(key));
+    return directory + "/plan_" + key_hex + "_" + plan_name + "_r" +
+           to_string(rank) + ".bin";
+  }
+
+  // true only if every process of comm loaded its plan
+  static bool all_loaded(bool loaded, MPI_Comm comm) {
+    int local = loaded ? 1 : 0;
+    int global = 0;
+    MPI_Allreduce(&local, &global, 1, MPI_INT, MPI_MIN, comm);
+    return global == 1;
+  }
+};
+
+/**
+ * Writes one process's plan. Every file starts with the magic, the cache key
+ * and the process count so that stale or foreign files are rejected on load.
+ */
+class PlanWriter {
+
+private:
+  ofstream out;
+
+public:
+  PlanWriter(const string &plan_name, int rank, int world_size)
+      : out(PlanCache::file_name(plan_name, rank), ios::binary | ios::trunc) {
+    out.write(PLAN_CACHE_MAGIC, sizeof(PLAN_CACHE_MAGIC));
+    write(PlanCache::key);
+    write(world_size);
+  }
+
+  template <typename T> void write(const T &value) {
+    out.write(reinterpret_cast<const char *>(&value), sizeof(T));
+  }
+
+  template <typename T> void write(const vector<T> &values) {
+    write(static_cast<uint64_t>(values.size()));
+    out.write(reinterpret_cast<const char *>(values.data()),
+              sizeof(T) * values.size());
+  }
+
+  bool good() { return out.good(); }
+};
+
+class PlanReader {
+
+private:
+  ifstream in;
+  bool valid = false;
+
+public:
+  PlanReader(const string &plan_name, int rank, int world_size)
+      : in(PlanCache::file_name(plan_name, rank), ios::binary) {
+    char magic[sizeof(PLAN_CACHE_MAGIC)];
+    uint64_t key = 0;
+    int size = 0;
+    valid = in.good() and
+            in.read(magic, sizeof(magic)).good() and
+            memcmp(magic, PLAN_CACHE_MAGIC, sizeof(magic)) == 0 and
+            read(key) and key == PlanCache::key and read(size) and
+            size == world_size;
+  }
+
+  template <typename T> bool read(T &value) {
+    return in.read(reinterpret_cast<char *>(&value), sizeof(T)).good();
+  }
+
+  template <typename T> bool read(vector<T> &values) {
+    uint64_t size = 0;
+    if (!read(size)) {
+      return false;
+    }
+    values.resize(size);
+    return in.read(reinterpret_cast<char *>(values.data()), sizeof(T) * size)
+        .good();
+  }
+
+  bool good() { return valid and in.good(); }
+};
+
+} // namespace distblas::net
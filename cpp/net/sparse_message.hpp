@@ -0,0 +1,365 @@
+/**
+ * Variable length message format for exchanging sparse rows between
+ * processes. Rows destined to one process are packed into a single block of
+ * contiguous arrays, and the blocks of all processes are exchanged with one
+ * alltoallv counted in 8 byte words.
+ */
+#pragma once
+#include "../core/common.h"
+#include <cstring>
+#include <climits>
+#include <mpi.h>
+#include <stdexcept>
+#include <vector>
+
+using namespace std;
+using namespace distblas::core;
+
+namespace distblas::net {
+
+// block flags
+static constexpr uint64_t SPARSE_ROWS_TILE_TAGS = 1;
+static constexpr uint64_t SPARSE_ROWS_VARINT_COLS = 2;
+static constexpr uint64_t SPARSE_ROWS_FLOAT_VALUES = 4;
+static constexpr uint64_t SPARSE_ROWS_UNIT_VALUES = 8;
+
+/**
+ * Optional encodings of sparse row messages. Columns within a row are sent
+ * as zigzag varint deltas, which takes one or two bytes per index for the
+ * usual 128 to 512 column operands. Float values halve the value payload at
+ * the cost of precision. Blocks whose values are all one (e.g. BFS
+ * frontiers) never carry values, independent of these settings.
+ */
+class SparseMessageEncoding {
+public:
+  inline static bool varint_cols = false;
+  inline static bool float_values = false;
+};
+
+// every array of a block starts on an 8 byte boundary
+inline size_t sparse_rows_padded(size_t bytes) {
+  return (bytes + 7) & ~static_cast<size_t>(7);
+}
+
+/**
+ * Blocks are whole 8 byte words, so exchanges count words rather than bytes
+ * and a rank can move up to 16 GiB before the int counts and displacements of
+ * MPI_Alltoallv run out.
+ */
+inline int sparse_rows_words(size_t bytes) {
+  size_t words = bytes / sizeof(uint64_t);
+  if (words > static_cast<size_t>(INT_MAX)) {
+    throw std::runtime_error("sparse row exchange exceeds INT_MAX words");
+  }
+  return static_cast<int>(words);
+}
+
+// byte offset of a word displacement
+inline size_t sparse_rows_offset(int words) {
+  return static_cast<size_t>(words) * sizeof(uint64_t);
+}
+
+// signed difference of consecutive columns, zigzag mapped to unsigned
+inline uint64_t zigzag_delta(INDEX_TYPE col, INDEX_TYPE previous) {
+  int64_t delta = static_cast<int64_t>(col - previous);
+  return (static_cast<uint64_t>(delta) << 1) ^ static_cast<uint64_t>(delta >> 63);
+}
+
+inline INDEX_TYPE zigzag_apply(INDEX_TYPE previous, uint64_t encoded) {
+  int64_t delta = static_cast<int64_t>(encoded >> 1) ^ -static_cast<int64_t>(encoded & 1);
+  return previous + static_cast<INDEX_TYPE>(delta);
+}
+
+inline size_t varint_size(uint64_t value) {
+  size_t bytes = 1;
+  while (value >= 128) {
+    value >>= 7;
+    bytes++;
+  }
+  return bytes;
+}
+
+inline char *write_varint(char *out, uint64_t value) {
+  while (value >= 128) {
+    *out++ = static_cast<char>((value & 127) | 128);
+    value >>= 7;
+  }
+  *out++ = static_cast<char>(value);
+  return out;
+}
+
+inline const char *read_varint(const char *in, uint64_t &value) {
+  value = 0;
+  int shift = 0;
+  unsigned char byte;
+  do {
+    byte = static_cast<unsigned char>(*in++);
+    value |= static_cast<uint64_t>(byte & 127) << shift;
+    shift += 7;
+  } while (byte & 128);
+  return in;
+}
+
+/**
+ * Sparse rows sent to one process. On the wire a block is
+ *   [nrows][nnz][flags][row ids][row counts][tile tags][cols][values]
+ * where tile tags are only present when SPARSE_ROWS_TILE_TAGS is set, cols
+ * are varints restarting at zero on every row when SPARSE_ROWS_VARINT_COLS is
+ * set, and values are floats or absent depending on the value flags. Rows
+ * without entries are never added, an empty buffer is sent as zero bytes.
+ * Rows are encoded with the SparseMessageEncoding in effect when they are
+ * added.
+ */
+template <typename VALUE_TYPE> class SparseRowBuffer {
+
+public:
+  vector<INDEX_TYPE> rows;
+  vector<INDEX_TYPE> counts;
+  vector<INDEX_TYPE> tiles;
+  vector<INDEX_TYPE> cols;
+  vector<VALUE_TYPE> values;
+  bool unit_values = true;
+  // size of the varint columns, counted as rows are added
+  size_t varint_col_bytes = 0;
+
+  template <typename COL, typename VAL>
+  void add_row(INDEX_TYPE row, INDEX_TYPE count, const COL *row_cols,
+               const VAL *row_values, int tile = -1) {
+    if (count == 0) {
+      return;
+    }
+    rows.push_back(row);
+    counts.push_back(count);
+    if (tile >= 0) {
+      tiles.push_back(static_cast<INDEX_TYPE>(tile));
+    }
+    cols.insert(cols.end(), row_cols, row_cols + count);
+    if (SparseMessageEncoding::varint_cols) {
+      INDEX_TYPE previous = 0;
+      for (INDEX_TYPE k = 0; k < count; k++) {
+        INDEX_TYPE col = static_cast<INDEX_TYPE>(row_cols[k]);
+        varint_col_bytes += varint_size(zigzag_delta(col, previous));
+        previous = col;
+      }
+    }
+    values.insert(values.end(), row_values, row_values + count);
+    for (INDEX_TYPE k = 0; k < count and unit_values; k++) {
+      unit_values = row_values[k] == 1;
+    }
+  }
+
+  bool empty() const { return rows.empty(); }
+
+  uint64_t flags() const {
+    uint64_t flags = tiles.empty() ? 0 : SPARSE_ROWS_TILE_TAGS;
+    if (SparseMessageEncoding::varint_cols) {
+      flags |= SPARSE_ROWS_VARINT_COLS;
+    }
+    if (unit_values) {
+      flags |= SPARSE_ROWS_UNIT_VALUES;
+    } else if (SparseMessageEncoding::float_values) {
+      flags |= SPARSE_ROWS_FLOAT_VALUES;
+    }
+    return flags;
+  }
+
+  size_t bytes() const {
+    if (empty()) {
+      return 0;
+    }
+    uint64_t block_flags = flags();
+    size_t col_bytes = (block_flags & SPARSE_ROWS_VARINT_COLS)
+                           ? varint_col_bytes
+                           : cols.size() * sizeof(INDEX_TYPE);
+    size_t value_bytes = values.size() * sizeof(VALUE_TYPE);
+    if (block_flags & SPARSE_ROWS_UNIT_VALUES) {
+      value_bytes = 0;
+    } else if (block_flags & SPARSE_ROWS_FLOAT_VALUES) {
+      value_bytes = values.size() * sizeof(float);
+    }
+    return 3 * sizeof(uint64_t) +
+           sparse_rows_padded(rows.size() * sizeof(INDEX_TYPE)) +
+           sparse_rows_padded(counts.size() * sizeof(INDEX_TYPE)) +
+           sparse_rows_padded(tiles.size() * sizeof(INDEX_TYPE)) +
+           sparse_rows_padded(col_bytes) + sparse_rows_padded(value_bytes);
+  }
+
+  void pack(char *out) const {
+    if (empty()) {
+      return;
+    }
+    uint64_t header[3] = {rows.size(), cols.size(), flags()};
+    memcpy(out, header, sizeof(header));
+    out += sizeof(header);
+    out = pack_array(out, rows.data(), rows.size());
+    out = pack_array(out, counts.data(), counts.size());
+    out = pack_array(out, tiles.data(), tiles.size());
+    if (header[2] & SPARSE_ROWS_VARINT_COLS) {
+      char *start = out;
+      INDEX_TYPE offset = 0;
+      for (INDEX_TYPE r = 0; r < rows.size(); r++) {
+        INDEX_TYPE previous = 0;
+        for (INDEX_TYPE k = offset; k < offset + counts[r]; k++) {
+          out = write_varint(out, zigzag_delta(cols[k], previous));
+          previous = cols[k];
+        }
+        offset += counts[r];
+      }
+      size_t written = out - start;
+      memset(out, 0, sparse_rows_padded(written) - written);
+      out = start + sparse_rows_padded(written);
+    } else {
+      out = pack_array(out, cols.data(), cols.size());
+    }
+    if (header[2] & SPARSE_ROWS_FLOAT_VALUES) {
+      vector<float> float_values(values.begin(), values.end());
+      pack_array(out, float_values.data(), float_values.size());
+    } else if (!(header[2] & SPARSE_ROWS_UNIT_VALUES)) {
+      pack_array(out, values.data(), values.size());
+    }
+  }
+
+private:
+  template <typename T>
+  static char *pack_array(char *out, const T *data, size_t size) {
+    size_t bytes = size * sizeof(T);
+    if (bytes > 0) {
+      memcpy(out, data, bytes);
+    }
+    memset(out + bytes, 0, sparse_rows_padded(bytes) - bytes);
+    return out + sparse_rows_padded(bytes);
+  }
+};
+
+/**
+ * Read only view of a received block. The arrays point into the receive
+ * buffer; row r owns cols/values [offset, offset + counts[r]) where offset is
+ * the running sum of the previous counts. Encoded columns and values are
+ * decoded into storage owned by the view, so a view must not outlive the
+ * scope that constructed it and is not copyable.
+ */
+template <typename VALUE_TYPE> struct SparseRowView {
+  uint64_t nrows = 0;
+  uint64_t nnz = 0;
+  uint64_t flags = 0;
+  const INDEX_TYPE *rows = nullptr;
+  const INDEX_TYPE *counts = nullptr;
+  const INDEX_TYPE *tiles = nullptr;
+  const INDEX_TYPE *cols = nullptr;
+  const VALUE_TYPE *values = nullptr;
+
+  vector<INDEX_TYPE> decoded_cols;
+  vector<VALUE_TYPE> decoded_values;
+
+  SparseRowView() = default;
+  SparseRowView(const SparseRowView &) = delete;
+  SparseRowView &operator=(const SparseRowView &) = delete;
+
+  explicit SparseRowView(const char *data) {
+    const uint64_t *header = reinterpret_cast<const uint64_t *>(data);
+    nrows = header[0];
+    nnz = header[1];
+    flags = header[2];
+    data += 3 * sizeof(uint64_t);
+    rows = reinterpret_cast<const INDEX_TYPE *>(data);
+    data += sparse_rows_padded(nrows * sizeof(INDEX_TYPE));
+    counts = reinterpret_cast<const INDEX_TYPE *>(data);
+    data += sparse_rows_padded(nrows * sizeof(INDEX_TYPE));
+    if (flags & SPARSE_ROWS_TILE_TAGS) {
+      tiles = reinterpret_cast<const INDEX_TYPE *>(data);
+      data += sparse_rows_padded(nrows * sizeof(INDEX_TYPE));
+    }
+    if (flags & SPARSE_ROWS_VARINT_COLS) {
+      decoded_cols.resize(nnz);
+      const char *in = data;
+      INDEX_TYPE offset = 0;
+      for (INDEX_TYPE r = 0; r < nrows; r++) {
+        INDEX_TYPE previous = 0;
+        for (INDEX_TYPE k = offset; k < offset + counts[r]; k++) {
+          uint64_t encoded;
+          in = read_varint(in, encoded);
+          previous = zigzag_apply(previous, encoded);
+          decoded_cols[k] = previous;
+        }
+        offset += counts[r];
+      }
+      cols = decoded_cols.data();
+      data += sparse_rows_padded(in - data);
+    } else {
+      cols = reinterpret_cast<const INDEX_TYPE *>(data);
+      data += sparse_rows_padded(nnz * sizeof(INDEX_TYPE));
+    }
+    if (flags & SPARSE_ROWS_UNIT_VALUES) {
+      decoded_values.assign(nnz, 1);
+      values = decoded_values.data();
+    } else if (flags & SPARSE_ROWS_FLOAT_VALUES) {
+      const float *float_values = reinterpret_cast<const float *>(data);
+      decoded_values.assign(float_values, float_values + nnz);
+      values = decoded_values.data();
+    } else {
+      values = reinterpret_cast<const VALUE_TYPE *>(data);
+    }
+  }
+};
+
+/**
+ * Exchanges already packed blocks: send counts are traded first so that every
+ * process can size its receive buffer, then the payload moves in one
+ * alltoallv. Counts and displacements are in words (see sparse_rows_words).
+ */
+inline void exchange_packed_rows(vector<char> *sendbuf, vector<int> &send_counts,
+                                 vector<int> &sdispls, vector<char> *receivebuf,
+                                 vector<int> &receive_counts,
+                                 vector<int> &rdispls, MPI_Comm comm) {
+  int world_size = send_counts.size();
+  MPI_Alltoall(send_counts.data(), 1, MPI_INT, receive_counts.data(), 1,
+               MPI_INT, comm);
+
+  size_t total_receive_words = 0;
+  for (int i = 0; i < world_size; i++) {
+    rdispls[i] = sparse_rows_words(total_receive_words * sizeof(uint64_t));
+    total_receive_words += receive_counts[i];
+  }
+  sparse_rows_words(total_receive_words * sizeof(uint64_t));
+  receivebuf->resize(total_receive_words * sizeof(uint64_t));
+
+  auto t = start_clock();
+  MPI_Alltoallv(sendbuf->data(), send_counts.data(), sdispls.data(), MPI_UINT64_T,
+                receivebuf->data(), receive_counts.data(), rdispls.data(),
+                MPI_UINT64_T, comm);
+  stop_clock_and_add(t, "Communication Time");
+}
+
+/**
+ * Packs one block per destination (in parallel) and exchanges them. On
+ * return receive_counts/rdispls hold the word extent of each source's block.
+ */
+template <typename VALUE_TYPE>
+void exchange_sparse_rows(vector<SparseRowBuffer<VALUE_TYPE>> &blocks,
+                          vector<char> *sendbuf, vector<int> &send_counts,
+                          vector<int> &sdispls, vector<char> *receivebuf,
+                          vector<int> &receive_counts, vector<int> &rdispls,
+                          MPI_Comm comm) {
+  int world_size = blocks.size();
+  size_t total_send_bytes = 0;
+  INDEX_TYPE total_send_nnz = 0;
+  for (int i = 0; i < world_size; i++) {
+    send_counts[i] = sparse_rows_words(blocks[i].bytes());
+    sdispls[i] = sparse_rows_words(total_send_bytes);
+    total_send_bytes += blocks[i].bytes();
+    total_send_nnz += blocks[i].cols.size();
+  }
+  sparse_rows_words(total_send_bytes);
+  sendbuf->resize(total_send_bytes);
+
+#pragma omp parallel for
+  for (int i = 0; i < world_size; i++) {
+    blocks[i].pack(sendbuf->data() + sparse_rows_offset(sdispls[i]));
+  }
+  add_perf_stats(total_send_nnz, "Data transfers");
+
+  exchange_packed_rows(sendbuf, send_counts, sdispls, receivebuf,
+                       receive_counts, rdispls, comm);
+}
+
+} // namespace distblas::net
@@ -2,19 +2,49 @@
 #include "../core/common.h"
 #include "../core/sparse_mat_tile.hpp"
 #include "data_comm.hpp"
+#include "sparse_message.hpp"
 #include <math.h>
 #include <memory>
 #include "../core/dense_mat.hpp"
+#include "../core/output_mask.hpp"
 
 using namespace distblas::core;
 using namespace std;
 
 namespace distblas::net {
 
+/**
+ * Tile layout, per tile index sets and negotiated tile modes of a
+ * TileDataComm. The layout and index sets only depend on the sparsity of A and
+ * the tiling, so a plan is built once and can be shared by every TileDataComm
+ * multiplying the same A (repeated SpGEMM calls, MultiSourceBFS levels).
+ */
+template <typename INDEX_TYPE, typename VALUE_TYPE> struct TilePlan {
+  shared_ptr<vector<vector<vector<SparseTile<INDEX_TYPE, VALUE_TYPE>>>>>
+      receiver_proc_tile_map;
+  shared_ptr<vector<vector<vector<SparseTile<INDEX_TYPE, VALUE_TYPE>>>>>
+      sender_proc_tile_map;
+  shared_ptr<
+      vector<vector<unordered_map<INDEX_TYPE, unordered_map<int, bool>>>>>
+      send_indices_proc_map;
+  shared_ptr<
+      vector<vector<unordered_map<INDEX_TYPE, unordered_map<int, bool>>>>>
+      receive_indices_proc_map;
+
+  // tile index sets have been computed from A
+  bool indexed = false;
+
+  // tile modes are valid for the current input and remote compute setting
+  bool negotiated = false;
+  bool negotiated_remote = false;
+};
+
 template <typename INDEX_TYPE, typename VALUE_TYPE, size_t embedding_dim>
 class TileDataComm : public DataComm<INDEX_TYPE, VALUE_TYPE, embedding_dim> {
 
 private:
+  shared_ptr<TilePlan<INDEX_TYPE, VALUE_TYPE>> plan;
+
   shared_ptr<
       vector<vector<unordered_map<INDEX_TYPE, unordered_map<int, bool>>>>>
       send_indices_proc_map;
@@ -35,19 +65,30 @@ private:
 
   double merge_cost_factor = 1.0;
 
+  // mask of the output rows of this process and the rows of A it applies to
+  OutputMask *output_mask = nullptr;
+  CSRLocal<VALUE_TYPE> *mask_csr = nullptr;
+
+  // mask rows of the current batch of every process this one computes for
+  vector<unique_ptr<OutputMask>> remote_masks;
+
 public:
   shared_ptr<vector<vector<vector<SparseTile<INDEX_TYPE, VALUE_TYPE>>>>>
       receiver_proc_tile_map;
   shared_ptr<vector<vector<vector<SparseTile<INDEX_TYPE, VALUE_TYPE>>>>>
       sender_proc_tile_map;
 
+  // output collectors of remote tiles, returned by reset()
+  DenseCollectorPool<VALUE_TYPE> collector_pool;
+
   TileDataComm(distblas::core::SpMat<VALUE_TYPE> *sp_local_receiver,
                distblas::core::SpMat<VALUE_TYPE> *sp_local_sender,
                distblas::core::SpMat<VALUE_TYPE> *sparse_local,
                Process3DGrid *grid, double alpha, int total_batches,
                double tile_width_fraction, bool hash_spgemm = true,
                bool embedding = false, double merge_cost_factor = 1.0,
-               DistributedMat* state_holder=nullptr)
+               DistributedMat* state_holder=nullptr,
+               shared_ptr<TilePlan<INDEX_TYPE, VALUE_TYPE>> plan = nullptr)
       : DataComm<INDEX_TYPE, VALUE_TYPE, embedding_dim>(
             sp_local_receiver, sp_local_sender, sparse_local, grid, -1, alpha) {
     tiles_per_process_row = static_cast<int>(1 / (tile_width_fraction));
@@ -59,6 +100,23 @@ public:
     this->state_holder= state_holder;
     SparseTile<INDEX_TYPE, VALUE_TYPE>::tile_width_fraction =
         tile_width_fraction;
+
+    auto tiles_per_process =
+        SparseTile<INDEX_TYPE, VALUE_TYPE>::get_tiles_per_process_row();
+    auto total_tiles =
+        total_batches * this->grid->col_world_size * tiles_per_process;
+
+    add_perf_stats(total_tiles, "Total Tiles");
+
+    if (plan != nullptr) {
+      this->plan = plan;
+      receiver_proc_tile_map = plan->receiver_proc_tile_map;
+      sender_proc_tile_map = plan->sender_proc_tile_map;
+      send_indices_proc_map = plan->send_indices_proc_map;
+      receive_indices_proc_map = plan->receive_indices_proc_map;
+      return;
+    }
+
     receiver_proc_tile_map =
         make_shared<vector<vector<vector<SparseTile<INDEX_TYPE, VALUE_TYPE>>>>>(
             total_batches,
@@ -76,8 +134,6 @@ public:
                     tiles_per_process_row,
                     SparseTile<INDEX_TYPE, VALUE_TYPE>(grid, hash_spgemm))));
 
-    auto tiles_per_process =
-        SparseTile<INDEX_TYPE, VALUE_TYPE>::get_tiles_per_process_row();
     send_indices_proc_map = make_shared<
         vector<vector<unordered_map<INDEX_TYPE, unordered_map<int, bool>>>>>(
         total_batches,
@@ -89,10 +145,11 @@ public:
         vector<unordered_map<INDEX_TYPE, unordered_map<int, bool>>>(
             tiles_per_process));
 
-    auto total_tiles =
-        total_batches * this->grid->col_world_size * tiles_per_process;
-
-    add_perf_stats(total_tiles, "Total Tiles");
+    this->plan = make_shared<TilePlan<INDEX_TYPE, VALUE_TYPE>>();
+    this->plan->receiver_proc_tile_map = receiver_proc_tile_map;
+    this->plan->sender_proc_tile_map = sender_proc_tile_map;
+    this->plan->send_indices_proc_map = send_indices_proc_map;
+    this->plan->receive_indices_proc_map = receive_indices_proc_map;
 
     if (alpha == 0) {
 #pragma omp parallel for
@@ -161,17 +218,129 @@ public:
 
   ~TileDataComm() {}
 
+  /**
+   * Makes later row transfers masked: rows are requested per output batch
+   * instead of following the sender tiles, and only the columns some open
+   * output row needs are shipped. csr holds the local rows of A with global
+   * column ids. A null mask restores the unmasked transfer.
+   */
+  void set_output_mask(OutputMask *mask, CSRLocal<VALUE_TYPE> *csr) {
+    output_mask = mask;
+    mask_csr = csr;
+  }
+
+  /**
+   * Sends the output mask rows of a batch to every process that computes
+   * remote tiles of the batch for this one, so those processes mask their
+   * partial rows before packing them. Afterwards remote_mask(r) holds the
+   * batch rows of process r, or nullptr when nothing is computed for r.
+   */
+  void exchange_remote_masks(int batch_id) {
+    int world_size = this->grid->col_world_size;
+    INDEX_TYPE row_start = batch_id * this->sp_local_receiver->batch_size;
+    INDEX_TYPE row_end = min(row_start + this->sp_local_receiver->batch_size,
+                             this->sp_local_receiver->proc_row_width);
+    INDEX_TYPE words = output_mask->words();
+    int batch_words = static_cast<int>((row_end - row_start) * words);
+
+    vector<int> send_counts(world_size, 0), sdispls(world_size, 0);
+    vector<int> receive_counts(world_size, 0), rdispls(world_size, 0);
+    for (int r = 0; r < world_size; r++) {
+      if (r == this->grid->rank_in_col) {
+        continue;
+      }
+      for (auto &tile : (*receiver_proc_tile_map)[batch_id][r]) {
+        if (tile.mode == 1) {
+          send_counts[r] = batch_words;
+        }
+      }
+    }
+    MPI_Alltoall(send_counts.data(), 1, MPI_INT, receive_counts.data(), 1,
+                 MPI_INT, this->grid->col_world);
+    int total_receive = 0;
+    for (int r = 0; r < world_size; r++) {
+      rdispls[r] = total_receive;
+      total_receive += receive_counts[r];
+    }
+    vector<uint64_t> receivebuf(max(total_receive, 1));
+
+    auto t = start_clock();
+    MPI_Alltoallv(output_mask->row_data(row_start), send_counts.data(),
+                  sdispls.data(), MPI_UINT64_T, receivebuf.data(),
+                  receive_counts.data(), rdispls.data(), MPI_UINT64_T,
+                  this->grid->col_world);
+    stop_clock_and_add(t, "Communication Time");
+
+    remote_masks.resize(world_size);
+    for (int r = 0; r < world_size; r++) {
+      remote_masks[r].reset();
+      if (receive_counts[r] == 0) {
+        continue;
+      }
+      remote_masks[r] = make_unique<OutputMask>(receive_counts[r] / words,
+                                                output_mask->width(),
+                                                output_mask->is_complemented());
+      copy(receivebuf.begin() + rdispls[r],
+           receivebuf.begin() + rdispls[r] + receive_counts[r],
+           remote_masks[r]->row_data(0));
+      remote_masks[r]->refresh();
+    }
+  }
+
+  OutputMask *remote_mask(int rank) {
+    return static_cast<size_t>(rank) < remote_masks.size() ? remote_masks[rank].get()
+                                                    : nullptr;
+  }
+
+  shared_ptr<TilePlan<INDEX_TYPE, VALUE_TYPE>> get_plan() { return plan; }
+
+  /**
+   * Builds the tile index sets on first use and negotiates tile modes with the
+   * other processes. Later calls are free as long as neither the input
+   * (see update_local_input) nor enable_remote_compute changed.
+   */
   void onboard_data(bool enable_remote_compute=true) {
     if (this->alpha == 0) {
-      for (int i = 0; i < total_batches; i++) {
-        this->sp_local_receiver->find_col_ids_with_tiling(
-            i, 0, this->grid->col_world_size, receiver_proc_tile_map.get(),
-            receive_indices_proc_map.get(), 0);
-        // calculating sending data cols
-        this->sp_local_sender->find_col_ids_with_tiling(
-            i, 0, this->grid->col_world_size, sender_proc_tile_map.get(),
-            send_indices_proc_map.get(), 0, "+", this->sparse_local);
+      if (!plan->indexed and !(PlanCache::enabled() and load_plan())) {
+        for (int i = 0; i < total_batches; i++) {
+          this->sp_local_receiver->find_col_ids_with_tiling(
+              i, 0, this->grid->col_world_size, receiver_proc_tile_map.get(),
+              receive_indices_proc_map.get(), 0);
+          // calculating sending data cols
+          this->sp_local_sender->find_col_ids_with_tiling(
+              i, 0, this->grid->col_world_size, sender_proc_tile_map.get(),
+              send_indices_proc_map.get(), 0);
+        }
+        if (PlanCache::enabled()) {
+          save_plan();
+        }
       }
+      plan->indexed = true;
+
+      if (plan->negotiated and
+          plan->negotiated_remote == enable_remote_compute) {
+        return;
+      }
+      reset_tile_modes();
+      plan->negotiated = true;
+      plan->negotiated_remote = enable_remote_compute;
+
+      if (!embedding and !enable_remote_compute) {
+        // every receiver tile pulls its data and every sender tile ships it,
+        // so there is nothing to negotiate
+#pragma omp parallel for collapse(2)
+        for (int i = 0; i < total_batches; i++) {
+          for (int j = 0; j < this->grid->col_world_size; j++) {
+            for (int k = 0; k < tiles_per_process_row; k++) {
+              (*receiver_proc_tile_map)[i][j][k].mode = 0;
+            }
+          }
+        }
+        return;
+      }
+
+      this->sp_local_sender->get_receivable_datacount(
+          sender_proc_tile_map.get(), total_batches, this->sparse_local);
       // This represents the case for pulling
       this->sparse_local->get_transferrable_datacount(
           sender_proc_tile_map.get(), total_batches, true, false);
@@ -288,661 +457,337 @@ public:
     }
   }
 
+  /**
+   * Adds a row of the local input to a message block. Embedding rows are
+   * read from the dense collector, all others straight from the CSR block.
+   */
+  inline void append_local_row(SparseRowBuffer<VALUE_TYPE> &block,
+                               INDEX_TYPE local_key, bool embedding,
+                               int tile = -1) {
+    if (embedding) {
+      CSRHandle sparse_row = (this->sparse_local)->fetch_local_data(local_key, embedding, static_cast<VALUE_TYPE>(INT_MIN));
+      block.add_row(sparse_row.row_idx[0], sparse_row.col_idx.size(),
+                    sparse_row.col_idx.data(), sparse_row.values.data(), tile);
+    } else {
+      CSRHandle *handle = (this->sparse_local)->csr_local_data->handler.get();
+      INDEX_TYPE global_key = local_key + this->sparse_local->proc_row_width * this->grid->rank_in_col;
+      auto start = handle->rowStart[local_key];
+      block.add_row(global_key, handle->rowStart[local_key + 1] - start,
+                    handle->col_idx.data() + start, handle->values.data() + start, tile);
+    }
+  }
+
   inline void transfer_sparse_data(
-      vector<SpTuple<VALUE_TYPE, sp_tuple_max_dim>> *sendbuf_cyclic,
-      vector<SpTuple<VALUE_TYPE, sp_tuple_max_dim>> *receivebuf, int iteration,
+      vector<char> *sendbuf_cyclic, vector<char> *receivebuf, int iteration,
       int batch_id, int starting_proc, int end_proc, int start_tile,
       int end_tile, bool embedding=false, DistributedMat* state_holder=nullptr) {
+    if (output_mask != nullptr and !embedding) {
+      transfer_masked_rows(sendbuf_cyclic, receivebuf, iteration, batch_id,
+                           starting_proc, end_proc);
+      return;
+    }
     auto t = start_clock();
 
-    int total_receive_count = 0;
-    shared_ptr<vector<vector<SpTuple<VALUE_TYPE, sp_tuple_max_dim>>>>
-        data_buffer_ptr = make_shared<
-            vector<vector<SpTuple<VALUE_TYPE, sp_tuple_max_dim>>>>();
-    data_buffer_ptr->resize(this->grid->col_world_size);
-
-    int total_send_count = 0;
     this->send_counts_cyclic = vector<int>(this->grid->col_world_size, 0);
     this->receive_counts_cyclic = vector<int>(this->grid->col_world_size, 0);
     this->sdispls_cyclic = vector<int>(this->grid->col_world_size, 0);
     this->rdispls_cyclic = vector<int>(this->grid->col_world_size, 0);
 
     vector<int> sending_procs;
-    vector<int> receiving_procs;
-
     for (int i = starting_proc; i < end_proc; i++) {
-      int sending_rank =
-          (this->grid->rank_in_col + i) % this->grid->col_world_size;
-      int receiving_rank =
-          (this->grid->rank_in_col >= i)
-              ? (this->grid->rank_in_col - i) % this->grid->col_world_size
-              : (this->grid->col_world_size - i + this->grid->rank_in_col) %
-                    this->grid->col_world_size;
-      sending_procs.push_back(sending_rank);
-      receiving_procs.push_back(receiving_rank);
-      (*data_buffer_ptr)[sending_rank] =
-          vector<SpTuple<VALUE_TYPE, sp_tuple_max_dim>>();
-    }
-
-    for (int tile = start_tile; tile < end_tile; tile++) {
-      for (const auto &pair : (*send_indices_proc_map)[batch_id][tile]) {
-        auto col_id = pair.first;
-        CSRHandle sparse_tuple = (this->sparse_local)->fetch_local_data(col_id, embedding,static_cast<VALUE_TYPE>(INT_MIN));
-        if (sparse_tuple.col_idx.size() > 0) {
-          for (int i = 0; i < sending_procs.size(); i++) {
-            if (pair.second.count(sending_procs[i]) > 0 and
-                (*sender_proc_tile_map)[batch_id][sending_procs[i]][tile].mode == 1) {
-              if (this->send_counts_cyclic[sending_procs[i]] == 0) {
-                SpTuple<VALUE_TYPE, sp_tuple_max_dim> current;
-                current.rows[0] =2; // rows first two indices are already taken for metadata
-                current.rows[1] = 0;
-                (*data_buffer_ptr)[sending_procs[i]].push_back(current);
-                total_send_count++;
-                this->send_counts_cyclic[sending_procs[i]]++;
-              }
-
-              SpTuple<VALUE_TYPE, sp_tuple_max_dim> latest = (*data_buffer_ptr)
-                  [sending_procs[i]]
-                  [this->send_counts_cyclic[sending_procs[i]] - 1];
-              auto row_index_offset = latest.rows[0];
-              auto col_index_offset = latest.rows[1];
-              if (row_index_offset >= row_max-2 or col_index_offset >= sp_tuple_max_dim) {
-                SpTuple<VALUE_TYPE, sp_tuple_max_dim> current;
-                current.rows[0] =2; // rows first two indices are already taken for metadata
-                current.rows[1] = 0;
-                (*data_buffer_ptr)[sending_procs[i]].push_back(current);
-                total_send_count++;
-                this->send_counts_cyclic[sending_procs[i]]++;
-                latest = (*data_buffer_ptr)[sending_procs[i]][this->send_counts_cyclic[sending_procs[i]] - 1];
-                row_index_offset = latest.rows[0];
-                col_index_offset = latest.rows[1];
-              }
+      sending_procs.push_back((this->grid->rank_in_col + i) % this->grid->col_world_size);
+    }
 
-              INDEX_TYPE offset = sparse_tuple.col_idx.size();
-              // start filling from offset position
-              INDEX_TYPE pending_col_pos = sp_tuple_max_dim - col_index_offset;
-              INDEX_TYPE num_of_copying_data = min(offset, pending_col_pos);
-              INDEX_TYPE remaining_data_items = offset - num_of_copying_data;
-              offset =num_of_copying_data;
-              latest.rows[row_index_offset] = sparse_tuple.row_idx[0];
-              latest.rows[row_index_offset + 1] = num_of_copying_data;
-              latest.rows[0] = row_index_offset + 2;
-              latest.rows[1] = latest.rows[1] + num_of_copying_data;
-
-              if (num_of_copying_data > 0) {
-                copy(sparse_tuple.col_idx.begin(),
-                     sparse_tuple.col_idx.begin() + num_of_copying_data,
-                     latest.cols.begin() + col_index_offset);
-                copy(sparse_tuple.values.begin(),
-                     sparse_tuple.values.begin() + num_of_copying_data,
-                     latest.values.begin() + col_index_offset);
-                add_perf_stats(num_of_copying_data, "Data transfers");
-              }
-              (*data_buffer_ptr)[sending_procs[i]][this->send_counts_cyclic[sending_procs[i]] -1] = latest;
-              do {
-                if (remaining_data_items > 0) {
-
-                   num_of_copying_data = min(remaining_data_items, static_cast<INDEX_TYPE>(sp_tuple_max_dim));
-                   remaining_data_items = remaining_data_items - num_of_copying_data;
-
-                  SpTuple<VALUE_TYPE, sp_tuple_max_dim> current;
-                  current.rows[0] = 2; // rows first two indices are already taken for metadata
-                  current.rows[1] = 0;
-                  (*data_buffer_ptr)[sending_procs[i]].push_back(current);
-                  total_send_count++;
-                  this->send_counts_cyclic[sending_procs[i]]++;
-                  latest = (*data_buffer_ptr)
-                      [sending_procs[i]]
-                      [this->send_counts_cyclic[sending_procs[i]] - 1];
-                  row_index_offset = latest.rows[0];
-                  col_index_offset = latest.rows[1];
-                  latest.rows[row_index_offset] = sparse_tuple.row_idx[0];
-                  latest.rows[row_index_offset + 1] = num_of_copying_data;
-                  latest.rows[0] = row_index_offset + 2;
-                  latest.rows[1] = latest.rows[1] + num_of_copying_data;
-
-                  copy(sparse_tuple.col_idx.begin() + offset - 1,
-                       sparse_tuple.col_idx.begin() + offset - 1 +
-                           num_of_copying_data,
-                       latest.cols.begin());
-                  copy(sparse_tuple.values.begin() + offset - 1,
-                       sparse_tuple.values.begin() + offset - 1 +
-                           num_of_copying_data,
-                       latest.values.begin());
-                  (*data_buffer_ptr)
-                      [sending_procs[i]]
-                      [this->send_counts_cyclic[sending_procs[i]] - 1] = latest;
-                  add_perf_stats(num_of_copying_data, "Data transfers");
-                  offset +=num_of_copying_data;
-                }
-              }while(remaining_data_items>0);
-            }
+    // the rows a process needs for a tile are the column ids of its sender tile
+    vector<SparseRowBuffer<VALUE_TYPE>> blocks(this->grid->col_world_size);
+#pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < sending_procs.size(); i++) {
+      int proc = sending_procs[i];
+      for (int tile = start_tile; tile < end_tile; tile++) {
+        SparseTile<INDEX_TYPE, VALUE_TYPE> &sp_tile = (*sender_proc_tile_map)[batch_id][proc][tile];
+        if (sp_tile.mode == 1) {
+          for (auto col_id : sp_tile.col_id_set) {
+            append_local_row(blocks[proc], col_id, embedding);
           }
         }
       }
     }
-    (*sendbuf_cyclic).resize(total_send_count);
-    for (int i = 0; i < this->grid->col_world_size; i++) {
-      this->sdispls_cyclic[i] = (i > 0) ? this->sdispls_cyclic[i - 1] +
-                                              this->send_counts_cyclic[i - 1]
-                                        : this->sdispls_cyclic[i];
-      copy((*data_buffer_ptr)[i].begin(), (*data_buffer_ptr)[i].end(),
-           (*sendbuf_cyclic).begin() + this->sdispls_cyclic[i]);
-    }
-
-//    auto t = start_clock();
-    MPI_Alltoall(this->send_counts_cyclic.data(), 1, MPI_INT,
-                 this->receive_counts_cyclic.data(), 1, MPI_INT,
-                 this->grid->col_world);
-//    stop_clock_and_add(t, "Communication Time");
-//    add_perf_stats(sizeof(int)*this->grid->col_world_size, "Data transfers");
-    for (int i = 0; i < this->grid->col_world_size; i++) {
-      this->rdispls_cyclic[i] = (i > 0) ? this->rdispls_cyclic[i - 1] +
-                                              this->receive_counts_cyclic[i - 1]
-                                        : this->rdispls_cyclic[i];
-      total_receive_count += this->receive_counts_cyclic[i];
+    stop_clock_and_add(t, "Communication Data Loading");
+
+    exchange_sparse_rows(blocks, sendbuf_cyclic, this->send_counts_cyclic,
+                         this->sdispls_cyclic, receivebuf,
+                         this->receive_counts_cyclic, this->rdispls_cyclic,
+                         this->grid->col_world);
+    t = start_clock();
+    this->populate_sparse_cache(sendbuf_cyclic, receivebuf, iteration,batch_id);
+    stop_clock_and_add(t, "Communicated Data Store");
+  }
+
+  /**
+   * Masked pull of the batch rows. Every process asks the owners for the rows
+   * of B its open output rows of the batch reach through pulled tiles, each
+   * request carrying the columns those output rows still let through; the
+   * owners ship the rows restricted to these columns. Rows only reached from
+   * closed output rows are never requested.
+   */
+  void transfer_masked_rows(vector<char> *sendbuf, vector<char> *receivebuf,
+                            int iteration, int batch_id, int starting_proc,
+                            int end_proc) {
+    auto t = start_clock();
+    int rank = this->grid->rank_in_col;
+    int world_size = this->grid->col_world_size;
+    INDEX_TYPE width = this->sp_local_receiver->proc_col_width;
+    INDEX_TYPE words = output_mask->words();
+    size_t record = words + 1;
+    INDEX_TYPE row_start = batch_id * this->sp_local_receiver->batch_size;
+    INDEX_TYPE row_end =
+        std::min(row_start + this->sp_local_receiver->batch_size,
+                 this->sp_local_receiver->proc_row_width);
+    CSRHandle *handle = mask_csr->handler.get();
+    this->send_counts_cyclic = vector<int>(world_size, 0);
+    this->receive_counts_cyclic = vector<int>(world_size, 0);
+    this->sdispls_cyclic = vector<int>(world_size, 0);
+    this->rdispls_cyclic = vector<int>(world_size, 0);
+
+    // the processes whose rows this process pulls in this window
+    vector<char> owners(world_size, 0);
+    for (int i = starting_proc; i < end_proc; i++) {
+      int owner = (rank - i % world_size + world_size) % world_size;
+      owners[owner] = owner != rank;
     }
 
-    if (total_receive_count > 0) {
-      receivebuf->resize(total_receive_count);
+    vector<vector<uint64_t>> requests(world_size);
+#pragma omp parallel for schedule(dynamic)
+    for (int owner = 0; owner < world_size; owner++) {
+      if (!owners[owner]) {
+        continue;
+      }
+      unordered_map<INDEX_TYPE, size_t> position;
+      vector<uint64_t> &list = requests[owner];
+      for (INDEX_TYPE i = row_start; i < row_end; i++) {
+        if (output_mask->row_closed(i)) {
+          continue;
+        }
+        for (auto j = handle->rowStart[i]; j < handle->rowStart[i + 1]; j++) {
+          INDEX_TYPE col = handle->col_idx[j];
+          if (col / width != owner) {
+            continue;
+          }
+          int tile = SparseTile<INDEX_TYPE, VALUE_TYPE>::get_tile_id(
+              batch_id, col - owner * width, width, owner);
+          if ((*receiver_proc_tile_map)[batch_id][owner][tile].mode != 0) {
+            continue;
+          }
+          auto it = position.find(col);
+          if (it == position.end()) {
+            it = position.emplace(col, list.size()).first;
+            list.push_back(col);
+            list.resize(list.size() + words, 0);
+          }
+          for (INDEX_TYPE w = 0; w < words; w++) {
+            list[it->second + 1 + w] |= output_mask->open_word(i, w);
+          }
+        }
+      }
     }
 
-    MPI_Barrier(this->grid->col_world);
+    vector<int> request_counts(world_size), requested_counts(world_size);
+    vector<int> request_displs(world_size, 0), requested_displs(world_size, 0);
+    vector<uint64_t> request_buffer;
+    for (int r = 0; r < world_size; r++) {
+      request_counts[r] = requests[r].size();
+      request_displs[r] = request_buffer.size();
+      request_buffer.insert(request_buffer.end(), requests[r].begin(),
+                            requests[r].end());
+    }
+    MPI_Alltoall(request_counts.data(), 1, MPI_INT, requested_counts.data(), 1,
+                 MPI_INT, this->grid->col_world);
+    for (int r = 1; r < world_size; r++) {
+      requested_displs[r] = requested_displs[r - 1] + requested_counts[r - 1];
+    }
+    vector<uint64_t> requested(requested_displs[world_size - 1] +
+                               requested_counts[world_size - 1]);
+    MPI_Alltoallv(request_buffer.data(), request_counts.data(),
+                  request_displs.data(), MPI_UINT64_T, requested.data(),
+                  requested_counts.data(), requested_displs.data(),
+                  MPI_UINT64_T, this->grid->col_world);
+
+    CSRHandle *input = (this->sparse_local)->csr_local_data->handler.get();
+    vector<SparseRowBuffer<VALUE_TYPE>> blocks(world_size);
+#pragma omp parallel for schedule(dynamic)
+    for (int r = 0; r < world_size; r++) {
+      vector<INDEX_TYPE> cols;
+      vector<VALUE_TYPE> values;
+      for (INDEX_TYPE k = requested_displs[r];
+           k < requested_displs[r] + requested_counts[r]; k += record) {
+        INDEX_TYPE global_key = requested[k];
+        INDEX_TYPE local_key = global_key - rank * width;
+        const uint64_t *open = requested.data() + k + 1;
+        cols.clear();
+        values.clear();
+        for (auto j = input->rowStart[local_key]; j < input->rowStart[local_key + 1]; j++) {
+          INDEX_TYPE d = input->col_idx[j];
+          if (d < output_mask->width() and ((open[d / 64] >> (d % 64)) & 1)) {
+            cols.push_back(d);
+            values.push_back(input->values[j]);
+          }
+        }
+        blocks[r].add_row(global_key, cols.size(), cols.data(), values.data());
+      }
+    }
     stop_clock_and_add(t, "Communication Data Loading");
-     t = start_clock();
-    MPI_Alltoallv((*sendbuf_cyclic).data(), this->send_counts_cyclic.data(),
-                  this->sdispls_cyclic.data(), SPARSETUPLE,
-                  (*receivebuf).data(), this->receive_counts_cyclic.data(),
-                  this->rdispls_cyclic.data(), SPARSETUPLE,
-                  this->grid->col_world);
-    stop_clock_and_add(t, "Communication Time");
-//    add_perf_stats(total_receive_count*sizeof(SpTuple<VALUE_TYPE,sp_tuple_max_dim>), "Data transfers");
-     t = start_clock();
-    this->populate_sparse_cache(sendbuf_cyclic, receivebuf, iteration,batch_id);
+
+    exchange_sparse_rows(blocks, sendbuf, this->send_counts_cyclic,
+                         this->sdispls_cyclic, receivebuf,
+                         this->receive_counts_cyclic, this->rdispls_cyclic,
+                         this->grid->col_world);
+    t = start_clock();
+    this->populate_sparse_cache(sendbuf, receivebuf, iteration, batch_id);
     stop_clock_and_add(t, "Communicated Data Store");
   }
 
+  /**
+   * Sends the rows of col_ids owned by this process to every other process
+   * (e.g. negative samples). The packed block is shared by all destinations.
+   */
   void transfer_sparse_data(vector<INDEX_TYPE> &col_ids, int iteration, int batch_id) {
 
-    vector<vector<INDEX_TYPE>> receive_col_ids_list(this->grid->col_world_size);
-    vector<INDEX_TYPE> send_col_ids_list;
-
-    int total_send_count = 0;
-    int total_receive_count = 0;
-
     this->send_counts_cyclic = vector<int>(this->grid->col_world_size, 0);
     this->receive_counts_cyclic = vector<int>(this->grid->col_world_size, 0);
     this->sdispls_cyclic = vector<int>(this->grid->col_world_size, 0);
     this->rdispls_cyclic = vector<int>(this->grid->col_world_size, 0);
 
+    SparseRowBuffer<VALUE_TYPE> block;
     for (int i = 0; i < col_ids.size(); i++) {
       int owner_rank = col_ids[i] / (this->sp_local_receiver)->proc_row_width;
       if (owner_rank == this->grid->rank_in_col) {
-        send_col_ids_list.push_back(col_ids[i]);
-      } else {
-        receive_col_ids_list[owner_rank].push_back(col_ids[i]);
+        int local_key = col_ids[i] - (this->grid->rank_in_col) * (this->sp_local_receiver)->proc_row_width;
+        append_local_row(block, local_key, true);
       }
     }
+    add_perf_stats(block.cols.size(), "Data transfers");
 
+    auto sendbuf = make_unique<vector<char>>(block.bytes());
+    auto receivebuf_ptr = make_unique<vector<char>>();
+    block.pack(sendbuf->data());
     for (int i = 0; i < this->grid->col_world_size; i++) {
-      total_send_count = send_col_ids_list.size();
-      if (i != this->grid->rank_in_col) {
-        this->send_counts_cyclic[i] = total_send_count;
-      } else {
-        this->send_counts_cyclic[i] = 0;
-      }
-      this->receive_counts_cyclic[i] = receive_col_ids_list[i].size();
+      this->send_counts_cyclic[i] = (i != this->grid->rank_in_col) ? sparse_rows_words(block.bytes()) : 0;
     }
 
-    this->sdispls_cyclic[0] = 0;
-    this->rdispls_cyclic[0] = 0;
-    for (int i = 0; i < this->grid->col_world_size; i++) {
-
-      this->sdispls_cyclic[i] = 0;
-      this->rdispls_cyclic[i] =
-          (i > 0) ? this->rdispls_cyclic[i - 1] + this->receive_counts_cyclic[i - 1]
-                  : this->rdispls_cyclic[i];
-      total_receive_count = total_receive_count + this->receive_counts_cyclic[i];
-    }
-
-    unique_ptr<std::vector<SpTuple<VALUE_TYPE, sp_tuple_max_dim>>> sendbuf =
-        unique_ptr<std::vector<SpTuple<VALUE_TYPE, sp_tuple_max_dim>>>(
-            new vector<SpTuple<VALUE_TYPE, sp_tuple_max_dim>>());
-
-    unique_ptr<std::vector<SpTuple<VALUE_TYPE, sp_tuple_max_dim>>>
-        receivebuf_ptr =
-            unique_ptr<std::vector<SpTuple<VALUE_TYPE, sp_tuple_max_dim>>>(
-                new vector<SpTuple<VALUE_TYPE, sp_tuple_max_dim>>());
-
-    receivebuf_ptr.get()->resize(total_receive_count);
-
-    for (int j = 0; j < send_col_ids_list.size(); j++) {
-      int local_key = send_col_ids_list[j] - (this->grid->rank_in_col) * (this->sp_local_receiver)->proc_row_width;
-      CSRHandle sparse_tuple  =(this->sparse_local)->fetch_local_data(local_key,true, static_cast<VALUE_TYPE>(INT_MIN));
-
-      SpTuple<VALUE_TYPE, sp_tuple_max_dim> current;
-      INDEX_TYPE num_of_copying_data = sparse_tuple.col_idx.size();
-      current.rows[0] =2; // rows first two indices are already taken for metadata
-      current.rows[1] = 0;
-      current.rows[current.rows[0]] = sparse_tuple.row_idx[0];
-      current.rows[current.rows[0]+1] = num_of_copying_data;
-      copy(sparse_tuple.col_idx.begin() ,
-           sparse_tuple.col_idx.begin() + num_of_copying_data ,
-           current.cols.begin());
-      copy(sparse_tuple.values.begin(),
-           sparse_tuple.values.begin() + num_of_copying_data,
-           current.values.begin());
-      add_perf_stats(num_of_copying_data, "Data transfers");
-      current.rows[0] =  current.rows[0]+2;
-      current.rows[1] =current.rows[1]+num_of_copying_data;
-      (*sendbuf).push_back(current);
-    }
     MPI_Barrier(this->grid->col_world);
-    auto t = start_clock();
-    MPI_Alltoallv((*sendbuf).data(), this->send_counts_cyclic.data(), this->sdispls_cyclic.data(),
-                  SPARSETUPLE, (*receivebuf_ptr.get()).data(),
-                  this->receive_counts_cyclic.data(), this->rdispls_cyclic.data(),
-                  SPARSETUPLE, this->grid->col_world);
-    stop_clock_and_add(t, "Communication Time");
-    MPI_Request dumy;
+    exchange_packed_rows(sendbuf.get(), this->send_counts_cyclic,
+                         this->sdispls_cyclic, receivebuf_ptr.get(),
+                         this->receive_counts_cyclic, this->rdispls_cyclic,
+                         this->grid->col_world);
     this->populate_sparse_cache(sendbuf.get(), receivebuf_ptr.get(),  iteration,batch_id,true); // we should not do this
   }
 
   inline void transfer_remotely_computable_data(
-      vector<SpTuple<VALUE_TYPE, sp_tuple_max_dim>> *sendbuf_cyclic,
-      vector<SpTuple<VALUE_TYPE, sp_tuple_max_dim>> *receivebuf, int iteration,
+      vector<char> *sendbuf_cyclic, vector<char> *receivebuf, int iteration,
       int batch_id, int starting_proc, int end_proc, int start_tile,
       int end_tile, bool embedding=false) {
 
-    int total_receive_count = 0;
-    unique_ptr<vector<vector<SpTuple<VALUE_TYPE, sp_tuple_max_dim>>>>
-        data_buffer_ptr = make_unique<
-            vector<vector<SpTuple<VALUE_TYPE, sp_tuple_max_dim>>>>();
-    data_buffer_ptr->resize(this->grid->col_world_size);
-
-    int total_send_count = 0;
     this->send_counts_cyclic = vector<int>(this->grid->col_world_size, 0);
     this->receive_counts_cyclic = vector<int>(this->grid->col_world_size, 0);
     this->sdispls_cyclic = vector<int>(this->grid->col_world_size, 0);
     this->rdispls_cyclic = vector<int>(this->grid->col_world_size, 0);
 
     vector<int> sending_procs;
-    vector<int> receiving_procs;
-
     for (int i = starting_proc; i < end_proc; i++) {
-      int sending_rank =
-          (this->grid->rank_in_col + i) % this->grid->col_world_size;
-      int receiving_rank =
-          (this->grid->rank_in_col >= i)
-              ? (this->grid->rank_in_col - i) % this->grid->col_world_size
-              : (this->grid->col_world_size - i + this->grid->rank_in_col) %
-                    this->grid->col_world_size;
-      sending_procs.push_back(sending_rank);
-      receiving_procs.push_back(receiving_rank);
-      (*data_buffer_ptr)[sending_rank] =
-          vector<SpTuple<VALUE_TYPE, sp_tuple_max_dim>>();
+      sending_procs.push_back((this->grid->rank_in_col + i) % this->grid->col_world_size);
     }
 
+    vector<SparseRowBuffer<VALUE_TYPE>> blocks(this->grid->col_world_size);
+#pragma omp parallel for schedule(dynamic)
     for (int i = 0; i < sending_procs.size(); i++) {
+      int proc = sending_procs[i];
       for (int tile = start_tile; tile < end_tile; tile++) {
-        SparseTile<INDEX_TYPE,VALUE_TYPE>& spTile =  (*receiver_proc_tile_map)[batch_id][sending_procs[i]][tile];
+        SparseTile<INDEX_TYPE,VALUE_TYPE>& spTile =  (*receiver_proc_tile_map)[batch_id][proc][tile];
         if (spTile.mode ==1) {
-          for (auto it=spTile.row_id_set.begin(); it!= spTile.row_id_set.end();++it) {
-            auto index = *it;
-            CSRHandle sparse_tuple =(this->sparse_local)->fetch_local_data(index,embedding,static_cast<VALUE_TYPE>(INT_MIN));
-
-            if (sparse_tuple.col_idx.size() > 0) {
-              if (this->send_counts_cyclic[sending_procs[i]] == 0) {
-                SpTuple<VALUE_TYPE, sp_tuple_max_dim> current;
-                current.rows[0] =
-                    2; // rows first two indices are already taken for metadata
-                current.rows[1] = 0;
-                (*data_buffer_ptr)[sending_procs[i]].push_back(current);
-                total_send_count++;
-                this->send_counts_cyclic[sending_procs[i]]++;
-              }
-              SpTuple<VALUE_TYPE, sp_tuple_max_dim> latest = (*data_buffer_ptr)
-                  [sending_procs[i]]
-                  [this->send_counts_cyclic[sending_procs[i]] - 1];
-
-              auto row_index_offset = latest.rows[0];
-              auto col_index_offset = latest.rows[1];
-              if (row_index_offset >= row_max - 3 or
-                  col_index_offset >= sp_tuple_max_dim) {
-                SpTuple<VALUE_TYPE, sp_tuple_max_dim> current;
-                current.rows[0] =
-                    2; // rows first two indices are already taken for metadata
-                current.rows[1] = 0;
-                (*data_buffer_ptr)[sending_procs[i]].push_back(current);
-                total_send_count++;
-                this->send_counts_cyclic[sending_procs[i]]++;
-                latest = (*data_buffer_ptr)
-                    [sending_procs[i]]
-                    [this->send_counts_cyclic[sending_procs[i]] - 1];
-                row_index_offset = latest.rows[0];
-                col_index_offset = latest.rows[1];
-              }
-
-              INDEX_TYPE offset = sparse_tuple.col_idx.size();
-              // start filling from offset position
-              INDEX_TYPE pending_col_pos = sp_tuple_max_dim - col_index_offset;
-              INDEX_TYPE num_of_copying_data = min(offset, pending_col_pos);
-              INDEX_TYPE remaining_data_items = offset - num_of_copying_data;
-
-              latest.rows[row_index_offset] = sparse_tuple.row_idx[0];
-              latest.rows[row_index_offset + 1] = num_of_copying_data;
-              latest.rows[row_index_offset + 2] = static_cast<INDEX_TYPE>(tile);
-              latest.rows[0] = row_index_offset + 3;
-              latest.rows[1] = latest.rows[1] + num_of_copying_data;
-
-              if (num_of_copying_data > 0) {
-                copy(sparse_tuple.col_idx.begin(),
-                     sparse_tuple.col_idx.begin() + num_of_copying_data,
-                     latest.cols.begin() + col_index_offset);
-                copy(sparse_tuple.values.begin(),
-                     sparse_tuple.values.begin() + num_of_copying_data,
-                     latest.values.begin() + col_index_offset);
-              }
-              (*data_buffer_ptr)[sending_procs[i]]
-                                [this->send_counts_cyclic[sending_procs[i]] -
-                                 1] = latest;
-              if (remaining_data_items > 0) {
-                SpTuple<VALUE_TYPE, sp_tuple_max_dim> current;
-                current.rows[0] =
-                    2; // rows first two indices are already taken for metadata
-                current.rows[1] = 0;
-                (*data_buffer_ptr)[sending_procs[i]].push_back(current);
-                total_send_count++;
-                this->send_counts_cyclic[sending_procs[i]]++;
-                latest = (*data_buffer_ptr)
-                    [sending_procs[i]]
-                    [(*data_buffer_ptr)[sending_procs[i]].size() - 1];
-                row_index_offset = latest.rows[0];
-                col_index_offset = latest.rows[1];
-                latest.rows[row_index_offset] = sparse_tuple.row_idx[0];
-                latest.rows[row_index_offset + 1] = remaining_data_items;
-                latest.rows[row_index_offset + 2] =
-                    static_cast<INDEX_TYPE>(tile);
-                latest.rows[0] = row_index_offset + 3;
-                latest.rows[1] = latest.rows[1] + remaining_data_items;
-
-                copy(sparse_tuple.col_idx.begin() + num_of_copying_data - 1,
-                     sparse_tuple.col_idx.begin() + num_of_copying_data - 1 +
-                         remaining_data_items,
-                     latest.cols.begin());
-                copy(sparse_tuple.values.begin() + num_of_copying_data - 1,
-                     sparse_tuple.values.begin() + num_of_copying_data - 1 +
-                         remaining_data_items,
-                     latest.values.begin());
-                (*data_buffer_ptr)[sending_procs[i]]
-                                  [this->send_counts_cyclic[sending_procs[i]] -
-                                   1] = latest;
-              }
-            }
+          for (auto index : spTile.row_id_set) {
+            append_local_row(blocks[proc], index, embedding, tile);
           }
         }
       }
     }
-    if (total_send_count>0) {
-      (*sendbuf_cyclic).resize(total_send_count);
-
-      for (int i = 0; i < this->grid->col_world_size; i++) {
-        this->sdispls_cyclic[i] = (i > 0) ? this->sdispls_cyclic[i - 1] +
-                                                this->send_counts_cyclic[i - 1]
-                                          : this->sdispls_cyclic[i];
-        copy((*data_buffer_ptr)[i].begin(), (*data_buffer_ptr)[i].end(),
-             (*sendbuf_cyclic).begin() + this->sdispls_cyclic[i]);
-      }
-    }
-//    MPI_Barrier(this->grid->col_world);
-//    auto t = start_clock();
-    MPI_Alltoall(this->send_counts_cyclic.data(), 1, MPI_INT,
-                 this->receive_counts_cyclic.data(), 1, MPI_INT,
-                 this->grid->col_world);
-//    stop_clock_and_add(t, "Communication Time");
-//    add_perf_stats(sizeof(int)*this->grid->col_world_size, "Data transfers");
-
-    for (int i = 0; i < this->grid->col_world_size; i++) {
-      this->rdispls_cyclic[i] = (i > 0) ? this->rdispls_cyclic[i - 1] +
-                                              this->receive_counts_cyclic[i - 1]
-                                        : this->rdispls_cyclic[i];
-      total_receive_count += this->receive_counts_cyclic[i];
-    }
-
-    if (total_receive_count > 0) {
-      receivebuf->resize(total_receive_count);
-    }
-
 
-    //
     MPI_Barrier(this->grid->col_world);
-   auto  t = start_clock();
-    MPI_Alltoallv((*sendbuf_cyclic).data(), this->send_counts_cyclic.data(),
-                  this->sdispls_cyclic.data(), SPARSETUPLE,
-                  (*receivebuf).data(), this->receive_counts_cyclic.data(),
-                  this->rdispls_cyclic.data(), SPARSETUPLE,
-                  this->grid->col_world);
-    stop_clock_and_add(t, "Communication Time");
-//    add_perf_stats(total_receive_count*sizeof(SpTuple<VALUE_TYPE,sp_tuple_max_dim>), "Data transfers");
+    exchange_sparse_rows(blocks, sendbuf_cyclic, this->send_counts_cyclic,
+                         this->sdispls_cyclic, receivebuf,
+                         this->receive_counts_cyclic, this->rdispls_cyclic,
+                         this->grid->col_world);
     this->store_remotely_computed_data(sendbuf_cyclic, receivebuf, iteration,batch_id,false);
   }
 
-
-
-
-
   inline void receive_remotely_computed_data(
-      vector<SpTuple<VALUE_TYPE, sp_tuple_max_dim>> *sendbuf_cyclic,
-      vector<SpTuple<VALUE_TYPE, sp_tuple_max_dim>> *receivebuf, int iteration,
+      vector<char> *sendbuf_cyclic, vector<char> *receivebuf, int iteration,
       int batch_id, int starting_proc, int end_proc, int start_tile,
       int end_tile) {
 
-    int total_receive_count = 0;
-    unique_ptr<vector<vector<SpTuple<VALUE_TYPE, sp_tuple_max_dim>>>>
-        data_buffer_ptr = make_unique<
-            vector<vector<SpTuple<VALUE_TYPE, sp_tuple_max_dim>>>>();
-    data_buffer_ptr->resize(this->grid->col_world_size);
-
-    int total_send_count = 0;
     this->send_counts_cyclic = vector<int>(this->grid->col_world_size, 0);
     this->receive_counts_cyclic = vector<int>(this->grid->col_world_size, 0);
     this->sdispls_cyclic = vector<int>(this->grid->col_world_size, 0);
     this->rdispls_cyclic = vector<int>(this->grid->col_world_size, 0);
 
     vector<int> sending_procs;
-    vector<int> receiving_procs;
-
     for (int i = starting_proc; i < end_proc; i++) {
-      int sending_rank =
-          (this->grid->rank_in_col + i) % this->grid->col_world_size;
-      int receiving_rank =
-          (this->grid->rank_in_col >= i)
-              ? (this->grid->rank_in_col - i) % this->grid->col_world_size
-              : (this->grid->col_world_size - i + this->grid->rank_in_col) %
-                    this->grid->col_world_size;
-      sending_procs.push_back(sending_rank);
-      receiving_procs.push_back(receiving_rank);
-      (*data_buffer_ptr)[sending_rank] =
-          vector<SpTuple<VALUE_TYPE, sp_tuple_max_dim>>();
+      sending_procs.push_back((this->grid->rank_in_col + i) % this->grid->col_world_size);
     }
 
+    vector<SparseRowBuffer<VALUE_TYPE>> blocks(this->grid->col_world_size);
     for (int i = 0; i < sending_procs.size(); i++) {
+      int proc = sending_procs[i];
       for (int tile = start_tile; tile < end_tile; tile++) {
-       SparseTile<INDEX_TYPE,VALUE_TYPE>& spTile =  (*sender_proc_tile_map)[batch_id][sending_procs[i]][tile];
+        SparseTile<INDEX_TYPE,VALUE_TYPE>& spTile =  (*sender_proc_tile_map)[batch_id][proc][tile];
         if (spTile.mode ==0) {
           spTile.initialize_CSR_blocks();
-          for (INDEX_TYPE index =spTile.row_starting_index;index < spTile.row_end_index;++index) {
-            CSRHandle sparse_tuple =spTile.fetch_remote_data(index);
-
-            if (sparse_tuple.col_idx.size() > 0) {
-              if (this->send_counts_cyclic[sending_procs[i]] == 0) {
-                SpTuple<VALUE_TYPE, sp_tuple_max_dim> current;
-                current.rows[0] =
-                    2; // rows first two indices are already taken for metadata
-                current.rows[1] = 0;
-                (*data_buffer_ptr)[sending_procs[i]].push_back(current);
-                total_send_count++;
-                this->send_counts_cyclic[sending_procs[i]]++;
-              }
-              SpTuple<VALUE_TYPE, sp_tuple_max_dim> latest = (*data_buffer_ptr)
-                  [sending_procs[i]]
-                  [this->send_counts_cyclic[sending_procs[i]] - 1];
-
-              auto row_index_offset = latest.rows[0];
-              auto col_index_offset = latest.rows[1];
-              if (row_index_offset >= row_max - 3 or
-                  col_index_offset >= sp_tuple_max_dim) {
-                SpTuple<VALUE_TYPE, sp_tuple_max_dim> current;
-                current.rows[0] =
-                    2; // rows first two indices are already taken for metadata
-                current.rows[1] = 0;
-                (*data_buffer_ptr)[sending_procs[i]].push_back(current);
-                total_send_count++;
-                this->send_counts_cyclic[sending_procs[i]]++;
-                latest = (*data_buffer_ptr)
-                    [sending_procs[i]]
-                    [this->send_counts_cyclic[sending_procs[i]] - 1];
-                row_index_offset = latest.rows[0];
-                col_index_offset = latest.rows[1];
-              }
-
-              INDEX_TYPE offset = sparse_tuple.col_idx.size();
-              // start filling from offset position
-              INDEX_TYPE pending_col_pos = sp_tuple_max_dim - col_index_offset;
-              INDEX_TYPE num_of_copying_data = min(offset, pending_col_pos);
-              INDEX_TYPE remaining_data_items = offset - num_of_copying_data;
-
-              latest.rows[row_index_offset] = sparse_tuple.row_idx[0];
-              latest.rows[row_index_offset + 1] = num_of_copying_data;
-              latest.rows[row_index_offset + 2] = static_cast<INDEX_TYPE>(tile);
-              latest.rows[0] = row_index_offset + 3;
-              latest.rows[1] = latest.rows[1] + num_of_copying_data;
-
-              if (num_of_copying_data > 0) {
-                copy(sparse_tuple.col_idx.begin(),
-                     sparse_tuple.col_idx.begin() + num_of_copying_data,
-                     latest.cols.begin() + col_index_offset);
-                copy(sparse_tuple.values.begin(),
-                     sparse_tuple.values.begin() + num_of_copying_data,
-                     latest.values.begin() + col_index_offset);
-                add_perf_stats(num_of_copying_data, "Data transfers");
-              }
-              (*data_buffer_ptr)[sending_procs[i]]
-                                [this->send_counts_cyclic[sending_procs[i]] -
-                                 1] = latest;
-              if (remaining_data_items > 0) {
-                SpTuple<VALUE_TYPE, sp_tuple_max_dim> current;
-                current.rows[0] =
-                    2; // rows first two indices are already taken for metadata
-                current.rows[1] = 0;
-                (*data_buffer_ptr)[sending_procs[i]].push_back(current);
-                total_send_count++;
-                this->send_counts_cyclic[sending_procs[i]]++;
-                latest = (*data_buffer_ptr)
-                    [sending_procs[i]]
-                    [(*data_buffer_ptr)[sending_procs[i]].size() - 1];
-                row_index_offset = latest.rows[0];
-                col_index_offset = latest.rows[1];
-                latest.rows[row_index_offset] = sparse_tuple.row_idx[0];
-                latest.rows[row_index_offset + 1] = remaining_data_items;
-                latest.rows[row_index_offset + 2] =
-                    static_cast<INDEX_TYPE>(tile);
-                latest.rows[0] = row_index_offset + 3;
-                latest.rows[1] = latest.rows[1] + remaining_data_items;
-
-                copy(sparse_tuple.col_idx.begin() + num_of_copying_data - 1,
-                     sparse_tuple.col_idx.begin() + num_of_copying_data - 1 +
-                         remaining_data_items,
-                     latest.cols.begin());
-                copy(sparse_tuple.values.begin() + num_of_copying_data - 1,
-                     sparse_tuple.values.begin() + num_of_copying_data - 1 +
-                         remaining_data_items,
-                     latest.values.begin());
-                (*data_buffer_ptr)[sending_procs[i]]
-                                  [this->send_counts_cyclic[sending_procs[i]] -
-                                   1] = latest;
-                add_perf_stats(remaining_data_items, "Data transfers");
-              }
-            }
+          CSRHandle *handle = spTile.csr_local_data->handler.get();
+          // rows are addressed relative to the tile's first row
+          for (INDEX_TYPE local_key = 0; local_key + 1 < handle->rowStart.size(); local_key++) {
+            auto start = handle->rowStart[local_key];
+            blocks[proc].add_row(local_key, handle->rowStart[local_key + 1] - start,
+                                 handle->col_idx.data() + start,
+                                 handle->values.data() + start, tile);
           }
         }
       }
     }
-    (*sendbuf_cyclic).resize(total_send_count);
-    for (int i = 0; i < this->grid->col_world_size; i++) {
-      this->sdispls_cyclic[i] = (i > 0) ? this->sdispls_cyclic[i - 1] +
-                                              this->send_counts_cyclic[i - 1]
-                                        : this->sdispls_cyclic[i];
-      copy((*data_buffer_ptr)[i].begin(), (*data_buffer_ptr)[i].end(),
-           (*sendbuf_cyclic).begin() + this->sdispls_cyclic[i]);
-    }
-//    MPI_Barrier(this->grid->col_world);
-//    auto t = start_clock();
-    MPI_Alltoall(this->send_counts_cyclic.data(), 1, MPI_INT,
-                 this->receive_counts_cyclic.data(), 1, MPI_INT,
-                 this->grid->col_world);
-//    add_perf_stats(sizeof(int)*this->grid->col_world_size, "Data transfers");
-//    stop_clock_and_add(t, "Communication Time");
-
-    for (int i = 0; i < this->grid->col_world_size; i++) {
-      this->rdispls_cyclic[i] = (i > 0) ? this->rdispls_cyclic[i - 1] +
-                                              this->receive_counts_cyclic[i - 1]
-                                        : this->rdispls_cyclic[i];
-      total_receive_count += this->receive_counts_cyclic[i];
-    }
 
-    if (total_receive_count > 0) {
-      receivebuf->resize(total_receive_count);
-    }
-
-
-    //
     MPI_Barrier(this->grid->col_world);
-    auto t = start_clock();
-    MPI_Alltoallv((*sendbuf_cyclic).data(), this->send_counts_cyclic.data(),
-                  this->sdispls_cyclic.data(), SPARSETUPLE,
-                  (*receivebuf).data(), this->receive_counts_cyclic.data(),
-                  this->rdispls_cyclic.data(), SPARSETUPLE,
-                  this->grid->col_world);
-    stop_clock_and_add(t, "Communication Time");
-//    add_perf_stats(total_receive_count*sizeof(SpTuple<VALUE_TYPE,sp_tuple_max_dim>), "Data transfers");
+    exchange_sparse_rows(blocks, sendbuf_cyclic, this->send_counts_cyclic,
+                         this->sdispls_cyclic, receivebuf,
+                         this->receive_counts_cyclic, this->rdispls_cyclic,
+                         this->grid->col_world);
     this->store_remotely_computed_data(sendbuf_cyclic, receivebuf, iteration,batch_id,true);
   }
 
-  inline void store_remotely_computed_data(
-      vector<SpTuple<VALUE_TYPE, sp_tuple_max_dim>> *sendbuf,
-      vector<SpTuple<VALUE_TYPE, sp_tuple_max_dim>> *receivebuf, int iteration,
-      int batch_id, bool receive_computed_data) {
+  inline void store_remotely_computed_data(vector<char> *sendbuf,
+                                           vector<char> *receivebuf,
+                                           int iteration, int batch_id,
+                                           bool receive_computed_data) {
 
 #pragma omp parallel for
     for (int i = 0; i < this->grid->col_world_size; i++) {
-      INDEX_TYPE base_index = this->rdispls_cyclic[i];
-      INDEX_TYPE count = this->receive_counts_cyclic[i];
-      for (INDEX_TYPE j = base_index; j < base_index + count; j++) {
-        auto row_offset = (*receivebuf)[j].rows[0];
-        auto offset_so_far = 0;
-        for (auto k = 2; k < row_offset; k = k + 3) {
-          auto key = (*receivebuf)[j].rows[k];
-          auto data_count = (*receivebuf)[j].rows[k + 1];
-          auto tile = (*receivebuf)[j].rows[k + 2];
-          SparseTile<INDEX_TYPE,VALUE_TYPE>&spTile = receive_computed_data?(*receiver_proc_tile_map)[batch_id][i][tile]:(*sender_proc_tile_map)[batch_id][i][tile];
-
-          if (!receive_computed_data)
-            key = key- spTile.row_starting_index;
-
-          SparseCacheEntry<VALUE_TYPE> cache_entry = (*spTile.dataCachePtr)[key];
-          auto entry_offset = cache_entry.cols.size();
-          cache_entry.cols.resize(entry_offset + data_count);
-          cache_entry.values.resize(entry_offset + data_count);
-          copy((*receivebuf)[j].cols.begin() + offset_so_far,
-               (*receivebuf)[j].cols.begin() + offset_so_far + data_count,
-               cache_entry.cols.begin() + entry_offset);
-          copy((*receivebuf)[j].values.begin() + offset_so_far,
-               (*receivebuf)[j].values.begin() + offset_so_far + data_count,
-               cache_entry.values.begin() + entry_offset);
-          offset_so_far += data_count;
-          (*spTile.dataCachePtr)[key] =cache_entry;
-        }
+      if (this->receive_counts_cyclic[i] == 0) {
+        continue;
+      }
+      SparseRowView<VALUE_TYPE> view(receivebuf->data() + sparse_rows_offset(this->rdispls_cyclic[i]));
+      INDEX_TYPE offset = 0;
+      for (INDEX_TYPE r = 0; r < view.nrows; r++) {
+        auto key = view.rows[r];
+        auto data_count = view.counts[r];
+        auto tile = view.tiles[r];
+        SparseTile<INDEX_TYPE,VALUE_TYPE>&spTile = receive_computed_data?(*receiver_proc_tile_map)[batch_id][i][tile]:(*sender_proc_tile_map)[batch_id][i][tile];
+
+        if (!receive_computed_data)
+          key = key- spTile.row_starting_index;
+
+        SparseCacheEntry<VALUE_TYPE> &cache_entry = (*spTile.dataCachePtr)[key];
+        cache_entry.cols.insert(cache_entry.cols.end(), view.cols + offset,
+                                view.cols + offset + data_count);
+        cache_entry.values.insert(cache_entry.values.end(), view.values + offset,
+                                  view.values + offset + data_count);
+        offset += data_count;
       }
     }
     receivebuf->clear();
@@ -951,8 +796,179 @@ public:
     sendbuf->shrink_to_fit();
   }
 
+  /**
+   * Releases the per multiplication state held by the tiles (remote output
+   * collectors and received partial results) so the plan can be reused for
+   * the next multiplication without rebuilding it. Output collectors go back
+   * to collector_pool for the next multiplication.
+   */
+  void reset() {
+    auto itr = total_batches * this->grid->col_world_size * tiles_per_process_row;
+    for (auto in = 0; in < itr; in++) {
+      auto i = in / (this->grid->col_world_size * tiles_per_process_row);
+      auto j = (in / tiles_per_process_row) % this->grid->col_world_size;
+      auto k = in % tiles_per_process_row;
+      for (auto tile_map : {receiver_proc_tile_map.get(), sender_proc_tile_map.get()}) {
+        collector_pool.release(std::move((*tile_map)[i][j][k].dense_collector));
+      }
+    }
+#pragma omp parallel for
+    for (auto in = 0; in < itr; in++) {
+      auto i = in / (this->grid->col_world_size * tiles_per_process_row);
+      auto j = (in / tiles_per_process_row) % this->grid->col_world_size;
+      auto k = in % tiles_per_process_row;
+      for (auto tile_map : {receiver_proc_tile_map.get(), sender_proc_tile_map.get()}) {
+        SparseTile<INDEX_TYPE, VALUE_TYPE> &tile = (*tile_map)[i][j][k];
+        tile.sparse_data_collector.reset();
+        tile.sparse_data_counter.reset();
+        tile.csr_local_data.reset();
+        if (tile.dataCachePtr != nullptr) {
+          tile.initialize_dataCache();
+        }
+      }
+    }
+  }
+
   inline void update_local_input(distblas::core::SpMat<VALUE_TYPE>* sparse_input){
-    (*(this->sparse_local->csr_local_data)) =(*(sparse_input->csr_local_data));
+    // callers that swap the new input into sparse_local need no copy
+    if (sparse_input != this->sparse_local) {
+      (*(this->sparse_local->csr_local_data)) =(*(sparse_input->csr_local_data));
+    }
+    // the tile index sets only depend on A, the negotiated modes depend on the input
+    plan->negotiated = false;
+  }
+
+  /**
+   * Writes the tile index sets of this process to the plan cache. Modes and
+   * counts are not stored as they depend on the multiplied input.
+   */
+  void save_plan() {
+    PlanWriter writer("tile_comm", this->grid->rank_in_col,
+                      this->grid->col_world_size);
+    for (auto tile_map :
+         {receiver_proc_tile_map.get(), sender_proc_tile_map.get()}) {
+      for (auto &batch : *tile_map) {
+        for (auto &proc : batch) {
+          for (auto &tile : proc) {
+            vector<INDEX_TYPE> col_ids(tile.col_id_set.begin(),
+                                       tile.col_id_set.end());
+            vector<INDEX_TYPE> row_ids(tile.row_id_set.begin(),
+                                       tile.row_id_set.end());
+            std::sort(col_ids.begin(), col_ids.end());
+            std::sort(row_ids.begin(), row_ids.end());
+            writer.write(col_ids);
+            writer.write(row_ids);
+          }
+        }
+      }
+    }
+    // id to process maps are stored flattened as ids, offsets and processes
+    for (auto indices_map :
+         {send_indices_proc_map.get(), receive_indices_proc_map.get()}) {
+      for (auto &batch : *indices_map) {
+        for (auto &tile : batch) {
+          vector<INDEX_TYPE> ids;
+          vector<INDEX_TYPE> offsets(1, 0);
+          vector<int> procs;
+          for (auto &pair : tile) {
+            ids.push_back(pair.first);
+            for (auto &proc : pair.second) {
+              procs.push_back(proc.first);
+            }
+            offsets.push_back(procs.size());
+          }
+          writer.write(ids);
+          writer.write(offsets);
+          writer.write(procs);
+        }
+      }
+    }
+  }
+
+  // the cached plan is only used if every process could load its part
+  bool load_plan() {
+    PlanReader reader("tile_comm", this->grid->rank_in_col,
+                      this->grid->col_world_size);
+    bool loaded = reader.good();
+    vector<INDEX_TYPE> col_ids, row_ids;
+    for (auto tile_map :
+         {receiver_proc_tile_map.get(), sender_proc_tile_map.get()}) {
+      for (auto &batch : *tile_map) {
+        for (auto &proc : batch) {
+          for (auto &tile : proc) {
+            tile.col_id_set.clear();
+            tile.row_id_set.clear();
+            if (loaded and reader.read(col_ids) and reader.read(row_ids)) {
+              tile.col_id_set.insert(col_ids.begin(), col_ids.end());
+              tile.row_id_set.insert(row_ids.begin(), row_ids.end());
+            } else {
+              loaded = false;
+            }
+          }
+        }
+      }
+    }
+    vector<INDEX_TYPE> ids, offsets;
+    vector<int> procs;
+    for (auto indices_map :
+         {send_indices_proc_map.get(), receive_indices_proc_map.get()}) {
+      for (auto &batch : *indices_map) {
+        for (auto &tile : batch) {
+          tile.clear();
+          if (loaded and reader.read(ids) and reader.read(offsets) and
+              reader.read(procs) and offsets.size() == ids.size() + 1 and
+              offsets.back() == procs.size()) {
+            for (size_t i = 0; i < ids.size(); i++) {
+              for (auto p = offsets[i]; p < offsets[i + 1]; p++) {
+                tile[ids[i]][procs[p]] = true;
+              }
+            }
+          } else {
+            loaded = false;
+          }
+        }
+      }
+    }
+
+    if (PlanCache::all_loaded(loaded, this->grid->col_world)) {
+      return true;
+    }
+    // start over from empty index sets
+    for (auto tile_map :
+         {receiver_proc_tile_map.get(), sender_proc_tile_map.get()}) {
+      for (auto &batch : *tile_map) {
+        for (auto &proc : batch) {
+          for (auto &tile : proc) {
+            tile.col_id_set.clear();
+            tile.row_id_set.clear();
+          }
+        }
+      }
+    }
+    for (auto indices_map :
+         {send_indices_proc_map.get(), receive_indices_proc_map.get()}) {
+      for (auto &batch : *indices_map) {
+        for (auto &tile : batch) {
+          tile.clear();
+        }
+      }
+    }
+    return false;
+  }
+
+private:
+  void reset_tile_modes() {
+    auto itr = total_batches * this->grid->col_world_size * tiles_per_process_row;
+#pragma omp parallel for
+    for (auto in = 0; in < itr; in++) {
+      auto i = in / (this->grid->col_world_size * tiles_per_process_row);
+      auto j = (in / tiles_per_process_row) % this->grid->col_world_size;
+      auto k = in % tiles_per_process_row;
+      for (auto tile_map : {receiver_proc_tile_map.get(), sender_proc_tile_map.get()}) {
+        (*tile_map)[i][j][k].mode = 1;
+        (*tile_map)[i][j][k].dataCachePtr.reset();
+      }
+    }
   }
 };
 
@@ -0,0 +1,114 @@
+#include "../cpp/core/common.h"
+#include "../cpp/core/distributed_mat.hpp"
+#include "test_check.hpp"
+#include <map>
+#include <random>
+#include <vector>
+
+using namespace std;
+using namespace distblas::core;
+
+static map<int64_t, VALUE_TYPE> row_entries(DistributedMat &mat, INDEX_TYPE row) {
+  map<int64_t, VALUE_TYPE> entries;
+  for (auto &entry : (*mat.sparse_data_collector)[row]) {
+    if (entry.col >= 0) {
+      entries[entry.col] += entry.value;
+    }
+  }
+  return entries;
+}
+
+/**
+ * Rows start from an estimate of 0 and are filled until every column is set,
+ * so they grow through every hash table size up to a dense row.
+ */
+static void test_growth_to_dense(INDEX_TYPE width) {
+  const INDEX_TYPE rows = 4;
+  DistributedMat mat;
+  mat.sparse_data_collector =
+      make_unique<vector<vector<Tuple<VALUE_TYPE>>>>(rows);
+  mat.sparse_data_counter = make_unique<vector<INDEX_TYPE>>(rows, 0);
+  mat.initialize_accumulators(width);
+
+  string config = "width " + to_string(width);
+  check((*mat.sparse_data_collector)[0].size() == min<INDEX_TYPE>(8, width),
+        "initial size " + config);
+
+  mt19937 gen(width);
+  for (INDEX_TYPE i = 0; i < rows; i++) {
+    vector<int64_t> cols(width);
+    for (INDEX_TYPE c = 0; c < width; c++) {
+      cols[c] = c;
+    }
+    shuffle(cols.begin(), cols.end(), gen);
+    map<int64_t, VALUE_TYPE> expected;
+    INDEX_TYPE previous_size = (*mat.sparse_data_collector)[i].size();
+    for (INDEX_TYPE k = 0; k < width; k++) {
+      // every column is hit twice so updates of existing entries are covered
+      for (int repeat = 0; repeat < 2; repeat++) {
+        VALUE_TYPE value = 1 + (i + k + repeat) % 5;
+        mat.accumulate(i, cols[k], value);
+        expected[cols[k]] += value;
+      }
+      INDEX_TYPE size = (*mat.sparse_data_collector)[i].size();
+      check(size >= previous_size, "tables never shrink " + config);
+      previous_size = size;
+      if (size < width) {
+        check((size & (size - 1)) == 0, "power of two table " + config);
+        check(4 * (*mat.sparse_data_counter)[i] <= 3 * size,
+              "load factor " + config);
+      }
+    }
+    check((*mat.sparse_data_collector)[i].size() == width,
+          "row ends dense " + config);
+    check(row_entries(mat, i) == expected, "row sums " + config);
+  }
+}
+
+static void test_reset_range() {
+  DistributedMat mat;
+  mat.sparse_data_collector = make_unique<vector<vector<Tuple<VALUE_TYPE>>>>(3);
+  mat.sparse_data_counter = make_unique<vector<INDEX_TYPE>>(3, 0);
+  mat.initialize_accumulators(64);
+  for (INDEX_TYPE i = 0; i < 3; i++) {
+    mat.accumulate(i, 5, 2);
+  }
+  (*mat.sparse_data_counter)[1] = 0;
+  mat.initialize_accumulators(64, 1, 2);
+  check(row_entries(mat, 0).size() == 1, "rows before the range are kept");
+  check(row_entries(mat, 1).empty(), "rows in the range are cleared");
+  check(row_entries(mat, 2).size() == 1, "rows after the range are kept");
+}
+
+/**
+ * Min plus and max times rows through hash tables and dense rows. A min plus
+ * result of 0 is a real distance, so it has to stay in the row.
+ */
+template <typename SEMIRING>
+static void test_semiring(INDEX_TYPE width, const string &name) {
+  DistributedMat mat;
+  mat.sparse_data_collector = make_unique<vector<vector<Tuple<VALUE_TYPE>>>>(1);
+  mat.sparse_data_counter = make_unique<vector<INDEX_TYPE>>(1, 0);
+  mat.initialize_accumulators(width);
+
+  map<int64_t, VALUE_TYPE> expected;
+  for (INDEX_TYPE k = 0; k < 3 * width; k++) {
+    int64_t col = (k * 5) % width;
+    VALUE_TYPE value = (k * 7) % 4;
+    mat.accumulate<SEMIRING>(0, col, value);
+    auto it = expected.find(col);
+    expected[col] = it == expected.end() ? value : SEMIRING::add(it->second, value);
+  }
+  string config = name + " width " + to_string(width);
+  check(row_entries(mat, 0) == expected, "row " + config);
+}
+
+int main() {
+  for (INDEX_TYPE width : {1, 7, 8, 64, 100, 513}) {
+    test_growth_to_dense(width);
+    test_semiring<MinPlus<VALUE_TYPE>>(width, "min plus");
+    test_semiring<MaxTimes<VALUE_TYPE>>(width, "max times");
+  }
+  test_reset_range();
+  return test_result("accumulator");
+}
@@ -0,0 +1,149 @@
+#include "../cpp/core/common.h"
+#include "../cpp/core/mkl_block_engine.hpp"
+#include "test_check.hpp"
+#include <cmath>
+#include <map>
+#include <random>
+#include <vector>
+
+using namespace std;
+using namespace distblas::core;
+
+/**
+ * Fills csr with a small random graph stored the way dist_embed loads it
+ * with copy_col_to_value set: every value is the column id of its entry.
+ */
+static void build_graph(CSRHandle &csr, INDEX_TYPE n, INDEX_TYPE degree,
+                        mt19937 &gen) {
+  csr.rowStart.assign(n + 1, 0);
+  uniform_int_distribution<INDEX_TYPE> pick(0, n - 1);
+  for (INDEX_TYPE i = 0; i < n; i++) {
+    vector<INDEX_TYPE> cols;
+    for (INDEX_TYPE k = 0; k < degree; k++) {
+      cols.push_back(pick(gen));
+    }
+    sort(cols.begin(), cols.end());
+    cols.erase(unique(cols.begin(), cols.end()), cols.end());
+    for (auto c : cols) {
+      csr.col_idx.push_back(c);
+      csr.values.push_back(static_cast<double>(c));
+    }
+    csr.rowStart[i + 1] = csr.col_idx.size();
+  }
+}
+
+/**
+ * The hand written SpMM kernel adds lr times the operand row of every
+ * neighbour, the MKL block product has to give the same rows.
+ */
+static void test_spmm(CSRHandle &csr, INDEX_TYPE row_start, INDEX_TYPE row_end,
+                      INDEX_TYPE col_start, INDEX_TYPE col_end, mt19937 &gen) {
+  const MKL_INT dim = 8;
+  const double lr = 0.25;
+  INDEX_TYPE n = csr.rowStart.size() - 1;
+  uniform_real_distribution<double> value(-1, 1);
+  vector<double> B(n * dim);
+  for (auto &b : B) {
+    b = value(gen);
+  }
+
+  vector<double> expected((row_end - row_start) * dim, 0);
+  for (INDEX_TYPE i = row_start; i < row_end; i++) {
+    for (auto j = csr.rowStart[i]; j < csr.rowStart[i + 1]; j++) {
+      INDEX_TYPE col = csr.col_idx[j];
+      if (col >= col_start and col < col_end) {
+        for (MKL_INT d = 0; d < dim; d++) {
+          expected[(i - row_start) * dim + d] += lr * B[col * dim + d];
+        }
+      }
+    }
+  }
+
+  MKLBlockEngine engine(&csr);
+  MKLBlock *block = engine.block(row_start, row_end, col_start, col_end, dim, 1);
+  vector<double> C((row_end - row_start) * dim, 0);
+  engine.spmm(block, lr, dim,
+              [&](INDEX_TYPE id) -> const double * { return B.data() + id * dim; },
+              C.data());
+
+  bool same = true;
+  for (size_t k = 0; k < C.size(); k++) {
+    same = same and fabs(C[k] - expected[k]) < 1e-9;
+  }
+  check(same, "spmm rows [" + to_string(row_start) + ", " + to_string(row_end) + ")");
+}
+
+/**
+ * The hand written SpGEMM kernel sums the operand row values of every
+ * neighbour, the MKL block product has to give the same entries.
+ */
+static void test_spgemm(CSRHandle &csr, INDEX_TYPE row_start,
+                        INDEX_TYPE row_end, INDEX_TYPE col_start,
+                        INDEX_TYPE col_end, mt19937 &gen) {
+  const MKL_INT b_cols = 16;
+  INDEX_TYPE n = csr.rowStart.size() - 1;
+  uniform_int_distribution<INDEX_TYPE> pick(0, b_cols - 1);
+  uniform_real_distribution<double> value(-1, 1);
+  vector<vector<INDEX_TYPE>> b_row_cols(n);
+  vector<vector<double>> b_row_values(n);
+  for (INDEX_TYPE i = 0; i < n; i++) {
+    for (int k = 0; k < 3; k++) {
+      b_row_cols[i].push_back(pick(gen));
+    }
+    sort(b_row_cols[i].begin(), b_row_cols[i].end());
+    b_row_cols[i].erase(unique(b_row_cols[i].begin(), b_row_cols[i].end()),
+                        b_row_cols[i].end());
+    for (size_t k = 0; k < b_row_cols[i].size(); k++) {
+      b_row_values[i].push_back(value(gen));
+    }
+  }
+
+  map<pair<INDEX_TYPE, INDEX_TYPE>, double> expected;
+  for (INDEX_TYPE i = row_start; i < row_end; i++) {
+    for (auto j = csr.rowStart[i]; j < csr.rowStart[i + 1]; j++) {
+      INDEX_TYPE col = csr.col_idx[j];
+      if (col >= col_start and col < col_end) {
+        for (size_t k = 0; k < b_row_cols[col].size(); k++) {
+          expected[{i - row_start, b_row_cols[col][k]}] += b_row_values[col][k];
+        }
+      }
+    }
+  }
+
+  MKLBlockEngine engine(&csr);
+  MKLBlock *block = engine.block(row_start, row_end, col_start, col_end, 0, 1);
+  vector<map<INDEX_TYPE, double>> rows(row_end - row_start);
+  engine.spgemm(
+      block, b_cols,
+      [&](INDEX_TYPE id) {
+        MKLBlockRow row;
+        row.cols = b_row_cols[id].data();
+        row.values = b_row_values[id].data();
+        row.count = b_row_cols[id].size();
+        return row;
+      },
+      [&](INDEX_TYPE r, INDEX_TYPE d, double v) { rows[r][d] += v; });
+
+  bool same = true;
+  INDEX_TYPE entries = 0;
+  for (INDEX_TYPE r = 0; r < rows.size(); r++) {
+    for (auto &entry : rows[r]) {
+      auto it = expected.find({r, entry.first});
+      same = same and it != expected.end() and fabs(it->second - entry.second) < 1e-9;
+      entries++;
+    }
+  }
+  same = same and entries == expected.size();
+  check(same, "spgemm rows [" + to_string(row_start) + ", " + to_string(row_end) + ")");
+}
+
+int main() {
+  mt19937 gen(11);
+  CSRHandle csr;
+  build_graph(csr, 40, 5, gen);
+  test_spmm(csr, 0, 40, 0, 40, gen);
+  test_spmm(csr, 5, 25, 10, 30, gen);
+  test_spgemm(csr, 0, 40, 0, 40, gen);
+  test_spgemm(csr, 5, 25, 10, 30, gen);
+  return test_result("mkl block engine");
+}
@@ -0,0 +1,103 @@
+#include "../cpp/core/common.h"
+#include "../cpp/net/sparse_message.hpp"
+#include "test_check.hpp"
+#include <cstring>
+#include <limits>
+#include <vector>
+
+using namespace std;
+using namespace distblas::core;
+using namespace distblas::net;
+
+static void test_varint_round_trip() {
+  const uint64_t max = numeric_limits<uint64_t>::max();
+  vector<uint64_t> values = {0,          1,          127,         128,
+                             16383,      16384,      1ull << 32,  1ull << 62,
+                             1ull << 63, max - 1,    max};
+  for (uint64_t value : values) {
+    char buffer[16];
+    char *end = write_varint(buffer, value);
+    check(static_cast<size_t>(end - buffer) == varint_size(value),
+          "varint size of " + to_string(value));
+    uint64_t decoded = 0;
+    const char *read_end = read_varint(buffer, decoded);
+    check(decoded == value, "varint round trip of " + to_string(value));
+    check(read_end == end, "varint length of " + to_string(value));
+  }
+}
+
+static void test_zigzag_round_trip() {
+  const INDEX_TYPE max = numeric_limits<INDEX_TYPE>::max();
+  vector<pair<INDEX_TYPE, INDEX_TYPE>> steps = {
+      {0, 0},   {0, 1},       {1, 0},       {5, 3},
+      {3, 5},   {0, max},     {max, 0},     {max - 1, max},
+      {max, 1}, {1ull << 63, 0}, {0, 1ull << 63}};
+  for (auto &step : steps) {
+    uint64_t encoded = zigzag_delta(step.second, step.first);
+    check(zigzag_apply(step.first, encoded) == step.second,
+          "zigzag from " + to_string(step.first) + " to " +
+              to_string(step.second));
+  }
+  // small deltas of either sign stay small
+  check(zigzag_delta(4, 5) == 1, "zigzag of -1");
+  check(zigzag_delta(5, 4) == 2, "zigzag of +1");
+}
+
+static void test_block_round_trip(bool varint_cols, bool float_values,
+                                  bool unit_values) {
+  SparseMessageEncoding::varint_cols = varint_cols;
+  SparseMessageEncoding::float_values = float_values;
+  const INDEX_TYPE max = numeric_limits<INDEX_TYPE>::max();
+
+  // unsorted columns give negative deltas within a row
+  vector<vector<INDEX_TYPE>> row_cols = {
+      {7, 3, 200, 0, 129},
+      {max, 0, max - 1, 1ull << 63},
+      {42}};
+  vector<INDEX_TYPE> row_ids = {11, max, 0};
+  vector<vector<VALUE_TYPE>> row_values(row_cols.size());
+  SparseRowBuffer<VALUE_TYPE> block;
+  for (size_t r = 0; r < row_cols.size(); r++) {
+    for (size_t k = 0; k < row_cols[r].size(); k++) {
+      row_values[r].push_back(unit_values ? 1 : 0.5 * (k + 1) - r);
+    }
+    block.add_row(row_ids[r], row_cols[r].size(), row_cols[r].data(),
+                  row_values[r].data(), static_cast<int>(r));
+  }
+  // empty rows are never sent
+  block.add_row(5, 0, row_cols[0].data(), row_values[0].data(), 9);
+
+  string config = "varint " + to_string(varint_cols) + " float " +
+                  to_string(float_values) + " unit " + to_string(unit_values);
+  check(block.bytes() % sizeof(uint64_t) == 0, "padded block " + config);
+  vector<char> buffer(block.bytes());
+  block.pack(buffer.data());
+
+  SparseRowView<VALUE_TYPE> view(buffer.data());
+  check(view.nrows == row_cols.size(), "row count " + config);
+  check(view.nnz == 10, "nnz " + config);
+  INDEX_TYPE offset = 0;
+  for (INDEX_TYPE r = 0; r < view.nrows and r < row_cols.size(); r++) {
+    check(view.rows[r] == row_ids[r], "row id " + config);
+    check(view.counts[r] == row_cols[r].size(), "row length " + config);
+    check(view.tiles[r] == r, "tile tag " + config);
+    for (INDEX_TYPE k = 0; k < view.counts[r]; k++) {
+      check(view.cols[offset + k] == row_cols[r][k], "column " + config);
+      check(view.values[offset + k] == row_values[r][k], "value " + config);
+    }
+    offset += view.counts[r];
+  }
+}
+
+int main() {
+  test_varint_round_trip();
+  test_zigzag_round_trip();
+  for (int varint_cols = 0; varint_cols < 2; varint_cols++) {
+    for (int float_values = 0; float_values < 2; float_values++) {
+      for (int unit_values = 0; unit_values < 2; unit_values++) {
+        test_block_round_trip(varint_cols, float_values, unit_values);
+      }
+    }
+  }
+  return test_result("sparse message");
+}
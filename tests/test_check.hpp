@@ -0,0 +1,26 @@
+/**
+ * Minimal harness shared by the unit tests: check() reports every failed
+ * condition and test_result() turns the count into the exit code.
+ */
+#pragma once
+#include <iostream>
+#include <string>
+
+inline int &test_failures() {
+  static int failures = 0;
+  return failures;
+}
+
+inline void check(bool condition, const std::string &what) {
+  if (!condition) {
+    std::cout << "FAILED: " << what << std::endl;
+    test_failures()++;
+  }
+}
+
+inline int test_result(const std::string &suite) {
+  if (test_failures() == 0) {
+    std::cout << suite << " tests passed" << std::endl;
+  }
+  return test_failures() == 0 ? 0 : 1;
+}